@@ -221,6 +221,8 @@ up_device_collect_props_cb (const char *key, const GValue *value, UpDevice *devi
 	} else if (g_strcmp0 (key, "RecallUrl") == 0) {
 		g_free (device->priv->recall_url);
 		device->priv->recall_url = g_strdup (g_value_get_string (value));
+	} else if (g_strcmp0 (key, "HistoryMemory") == 0) {
+		/* only for debugging the daemon */
 	} else {
 		g_warning ("unhandled property '%s'", key);
 	}
@@ -639,6 +641,94 @@ out:
 	return array;
 }
 
+/**
+ * up_device_get_history_since_sync:
+ * @device: a #UpDevice instance.
+ * @type: The type of history, known values are "rate" and "charge".
+ * @timestamp: only history newer than this is returned, or 0 for all.
+ * @generation: (out): the location to store the history generation, or %NULL.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the device history that is newer than @timestamp, so that a client
+ * can add to the history it already has. If @generation is not the same as
+ * from the last call then older history has been removed or replaced, and
+ * it should be fetched again with a @timestamp of 0.
+ *
+ * Return value: an array of #UpHistoryItem's, which may be empty, else #NULL and @error is used
+ *
+ * Since: 0.9.6
+ **/
+GPtrArray *
+up_device_get_history_since_sync (UpDevice *device, const gchar *type, guint timestamp, guint *generation,
+				  GCancellable *cancellable, GError **error)
+{
+	GError *error_local = NULL;
+	GType g_type_gvalue_array;
+	GPtrArray *gvalue_ptr_array = NULL;
+	GValueArray *gva;
+	GValue *gv;
+	guint i;
+	guint generation_tmp = 0;
+	UpHistoryItem *item;
+	GPtrArray *array = NULL;
+	gboolean ret;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
+	g_return_val_if_fail (device->priv->proxy_device != NULL, NULL);
+
+	g_type_gvalue_array = dbus_g_type_get_collection ("GPtrArray",
+					dbus_g_type_get_struct("GValueArray",
+						G_TYPE_UINT,
+						G_TYPE_DOUBLE,
+						G_TYPE_UINT,
+						G_TYPE_INVALID));
+
+	/* get compound data */
+	ret = dbus_g_proxy_call (device->priv->proxy_device, "GetHistorySince", &error_local,
+				 G_TYPE_STRING, type,
+				 G_TYPE_UINT, timestamp,
+				 G_TYPE_INVALID,
+				 G_TYPE_UINT, &generation_tmp,
+				 g_type_gvalue_array, &gvalue_ptr_array,
+				 G_TYPE_INVALID);
+	if (!ret) {
+		g_set_error (error, 1, 0, "GetHistorySince(%s,%i) on %s failed: %s", type, timestamp,
+			   device->priv->object_path, error_local->message);
+		g_error_free (error_local);
+		goto out;
+	}
+	if (generation != NULL)
+		*generation = generation_tmp;
+
+	/* convert, where no data just means nothing has changed */
+	array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+
+	for (i=0; i<gvalue_ptr_array->len; i++) {
+		gva = (GValueArray *) g_ptr_array_index (gvalue_ptr_array, i);
+		item = up_history_item_new ();
+		/* 0 */
+		gv = g_value_array_get_nth (gva, 0);
+		up_history_item_set_time (item, g_value_get_uint (gv));
+		g_value_unset (gv);
+		/* 1 */
+		gv = g_value_array_get_nth (gva, 1);
+		up_history_item_set_value (item, g_value_get_double (gv));
+		g_value_unset (gv);
+		/* 2 */
+		gv = g_value_array_get_nth (gva, 2);
+		up_history_item_set_state (item, g_value_get_uint (gv));
+		g_value_unset (gv);
+		g_ptr_array_add (array, item);
+		g_value_array_free (gva);
+	}
+
+out:
+	if (gvalue_ptr_array != NULL)
+		g_ptr_array_free (gvalue_ptr_array, TRUE);
+	return array;
+}
+
 /**
  * up_device_get_statistics_sync:
  * @device: a #UpDevice instance.
@@ -717,6 +807,58 @@ out:
 	return array;
 }
 
+/**
+ * up_device_get_statistics_binned_sync:
+ * @device: a #UpDevice instance.
+ * @type: the type of statistics, either "charging" or "discharging".
+ * @bins: the number of bins from 0% to 100%, from 2 to 10000.
+ * @timespan: only history from this many seconds ago is used, or 0 for all.
+ * @values: (out): the location to store the value of each bin.
+ * @accuracies: (out): the location to store the accuracy of each bin.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the same statistics as up_device_get_statistics_sync(), with a
+ * chosen number of bins and range of history. The arrays are of #gdouble's
+ * and should be freed with g_array_unref().
+ *
+ * Return value: %TRUE for success, else %FALSE and @error is used
+ *
+ * Since: 0.9.6
+ **/
+gboolean
+up_device_get_statistics_binned_sync (UpDevice *device, const gchar *type, guint bins, guint timespan,
+				      GArray **values, GArray **accuracies,
+				      GCancellable *cancellable, GError **error)
+{
+	GError *error_local = NULL;
+	GType g_type_double_array;
+	gboolean ret;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (device->priv->proxy_device != NULL, FALSE);
+	g_return_val_if_fail (values != NULL, FALSE);
+	g_return_val_if_fail (accuracies != NULL, FALSE);
+
+	g_type_double_array = dbus_g_type_get_collection ("GArray", G_TYPE_DOUBLE);
+
+	/* get packed data */
+	ret = dbus_g_proxy_call (device->priv->proxy_device, "GetStatisticsBinned", &error_local,
+				 G_TYPE_STRING, type,
+				 G_TYPE_UINT, bins,
+				 G_TYPE_UINT, timespan,
+				 G_TYPE_INVALID,
+				 g_type_double_array, values,
+				 g_type_double_array, accuracies,
+				 G_TYPE_INVALID);
+	if (!ret) {
+		g_set_error (error, 1, 0, "GetStatisticsBinned(%s,%i,%i) on %s failed: %s", type, bins, timespan,
+			     device->priv->object_path, error_local->message);
+		g_error_free (error_local);
+	}
+	return ret;
+}
+
 /*
  * up_device_set_property:
  */
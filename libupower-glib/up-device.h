@@ -86,10 +86,24 @@ GPtrArray	*up_device_get_history_sync		(UpDevice		*device,
 							 guint			 resolution,
 							 GCancellable		*cancellable,
 							 GError			**error);
+GPtrArray	*up_device_get_history_since_sync	(UpDevice		*device,
+							 const gchar		*type,
+							 guint			 timestamp,
+							 guint			*generation,
+							 GCancellable		*cancellable,
+							 GError			**error);
 GPtrArray	*up_device_get_statistics_sync		(UpDevice		*device,
 							 const gchar		*type,
 							 GCancellable		*cancellable,
 							 GError			**error);
+gboolean	 up_device_get_statistics_binned_sync	(UpDevice		*device,
+							 const gchar		*type,
+							 guint			 bins,
+							 guint			 timespan,
+							 GArray			**values,
+							 GArray			**accuracies,
+							 GCancellable		*cancellable,
+							 GError			**error);
 
 /* accessors */
 const gchar	*up_device_get_object_path		(UpDevice		*device);
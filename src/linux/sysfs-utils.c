@@ -42,149 +42,209 @@
 
 #include "sysfs-utils.h"
 
-double
-sysfs_get_double (const char *dir, const char *attribute)
+#ifndef O_CLOEXEC
+#define O_CLOEXEC	0
+#endif
+#ifndef O_DIRECTORY
+#define O_DIRECTORY	0
+#endif
+
+/*
+ * The parsers below take the contents of an attribute, which may end in a
+ * newline, and return FALSE rather than zero when there is no number or
+ * it does not fit, so that a missing value can be told from a real 0.
+ */
+
+gboolean
+sysfs_parse_double (const char *text, double *value)
 {
+	char *end;
 	double result;
-	char *contents;
-	char *filename;
-
-	result = 0.0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
-		result = atof (contents);
-		g_free (contents);
-	}
-	g_free (filename);
 
+	errno = 0;
+	result = g_ascii_strtod (text, &end);
+	if (errno != 0 || end == text)
+		return FALSE;
+	while (g_ascii_isspace (*end))
+		end++;
+	if (*end != '\0')
+		return FALSE;
+	*value = result;
+	return TRUE;
+}
 
-	return result;
+static gboolean
+sysfs_parse_int64 (const char *text, gint64 *value)
+{
+	char *end;
+	gint64 result;
+
+	errno = 0;
+	result = g_ascii_strtoll (text, &end, 10);
+	if (errno != 0 || end == text)
+		return FALSE;
+	while (g_ascii_isspace (*end))
+		end++;
+	if (*end != '\0')
+		return FALSE;
+	*value = result;
+	return TRUE;
 }
 
 gboolean
-sysfs_file_contains (const char *dir, const char *attribute, const char *string)
+sysfs_parse_uint64 (const char *text, guint base, guint64 *value)
 {
-	gboolean result;
-	char *filename;
-	char *s;
+	char *end;
+	guint64 result;
 
-	result = FALSE;
+	/* strtoull silently negates */
+	while (g_ascii_isspace (*text))
+		text++;
+	if (*text == '-')
+		return FALSE;
+
+	errno = 0;
+	result = g_ascii_strtoull (text, &end, base);
+	if (errno != 0 || end == text)
+		return FALSE;
+	while (g_ascii_isspace (*end))
+		end++;
+	if (*end != '\0')
+		return FALSE;
+	*value = result;
+	return TRUE;
+}
 
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &s, NULL, NULL)) {
-		result = (strstr(s, string) != NULL);
-		g_free (s);
-	}
-	g_free (filename);
+gboolean
+sysfs_parse_int (const char *text, int *value)
+{
+	gint64 result;
+
+	if (!sysfs_parse_int64 (text, &result))
+		return FALSE;
+	if (result < G_MININT || result > G_MAXINT)
+		return FALSE;
+	*value = result;
+	return TRUE;
+}
+
+static gboolean
+sysfs_read_fd (int fd, char *buffer, gsize size)
+{
+	ssize_t len;
+
+	do {
+		len = pread (fd, buffer, size - 1, 0);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0)
+		return FALSE;
+	buffer[len] = '\0';
+	return TRUE;
+}
 
+/* read an attribute into a buffer, without allocating */
+static gboolean
+sysfs_read (const char *dir, const char *attribute, char *buffer, gsize size)
+{
+	char filename[PATH_MAX];
+	gboolean ret;
+	int fd;
+
+	if (g_snprintf (filename, sizeof (filename), "%s/%s", dir, attribute) >= (gint) sizeof (filename))
+		return FALSE;
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+	ret = sysfs_read_fd (fd, buffer, size);
+	close (fd);
+	return ret;
+}
+
+double
+sysfs_get_double (const char *dir, const char *attribute)
+{
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
+	double result = 0.0;
+
+	if (sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		sysfs_parse_double (buffer, &result);
 	return result;
 }
 
+gboolean
+sysfs_file_contains (const char *dir, const char *attribute, const char *string)
+{
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		return FALSE;
+	return (strstr (buffer, string) != NULL);
+}
+
 char *
 sysfs_get_string (const char *dir, const char *attribute)
 {
-	char *result;
-	char *filename;
-
-	result = NULL;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (!g_file_get_contents (filename, &result, NULL, NULL)) {
-		result = g_strdup ("");
-	}
-	g_free (filename);
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
 
-	return result;
+	if (!sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		return g_strdup ("");
+	return g_strdup (buffer);
 }
 
 int
 sysfs_get_int (const char *dir, const char *attribute)
 {
-	int result;
-	char *contents;
-	char *filename;
-
-	result = 0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
-		result = atoi (contents);
-		g_free (contents);
-	}
-	g_free (filename);
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
+	int result = 0;
 
+	if (sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		sysfs_parse_int (buffer, &result);
 	return result;
 }
 
 guint
 sysfs_get_hex (const char *dir, const char *attribute)
 {
-	guint result;
-	char *contents;
-	char *filename;
-
-	result = 0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
-		result = strtol (contents, (char **) NULL, 16);
-		g_free (contents);
-	}
-	g_free (filename);
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
+	guint64 result = 0;
 
+	if (!sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		return 0;
+	if (!sysfs_parse_uint64 (buffer, 16, &result) || result > G_MAXUINT)
+		return 0;
 	return result;
 }
 
 gboolean
 sysfs_get_bool (const char *dir, const char *attribute)
 {
-	gboolean result = FALSE;
-	char *contents;
-	char *filename;
-
-	result = 0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
-		g_strdelimit (contents, "\n", '\0');
-		if (g_strcmp0 (contents, "1") == 0)
-			result = TRUE;
-		g_free (contents);
-	}
-	g_free (filename);
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
 
-	return result;
+	if (!sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		return FALSE;
+	g_strdelimit (buffer, "\n", '\0');
+	return (g_strcmp0 (buffer, "1") == 0);
 }
 
 guint64
 sysfs_get_uint64 (const char *dir, const char *attribute)
 {
-	guint64 result;
-	char *contents;
-	char *filename;
-
-	result = 0;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_get_contents (filename, &contents, NULL, NULL)) {
-		result = atoll (contents);
-		g_free (contents);
-	}
-	g_free (filename);
-
+	char buffer[SYSFS_ATTRS_BUFFER_SIZE];
+	guint64 result = 0;
 
+	if (sysfs_read (dir, attribute, buffer, sizeof (buffer)))
+		sysfs_parse_uint64 (buffer, 10, &result);
 	return result;
 }
 
 gboolean
 sysfs_file_exists (const char *dir, const char *attribute)
 {
-	gboolean result;
-	char *filename;
+	char filename[PATH_MAX];
 
-	result = FALSE;
-	filename = g_build_filename (dir, attribute, NULL);
-	if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
-		result = TRUE;
-	}
-	g_free (filename);
-
-	return result;
+	if (g_snprintf (filename, sizeof (filename), "%s/%s", dir, attribute) >= (gint) sizeof (filename))
+		return FALSE;
+	return (access (filename, F_OK) == 0);
 }
 
 char *
@@ -239,3 +299,131 @@ sysfs_resolve_link (const char *dir, const char *attribute)
 	else
 		return NULL;
 }
+
+/*
+ * Attributes that are read on every refresh are kept open, and re-read
+ * from the start with pread() rather than building the path and opening
+ * the file each time. New attributes are opened relative to a cached
+ * descriptor of the device directory. When the device goes away under an
+ * open attribute the kernel returns ENODEV, and the directory and the
+ * attribute are opened again by name.
+ */
+struct SysfsAttrs
+{
+	char		*dir;
+	int		 dirfd;
+	GHashTable	*fds;
+};
+
+SysfsAttrs *
+sysfs_attrs_new (const char *dir)
+{
+	SysfsAttrs *attrs;
+
+	attrs = g_new0 (SysfsAttrs, 1);
+	attrs->dir = g_strdup (dir);
+	attrs->dirfd = -1;
+	attrs->fds = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	return attrs;
+}
+
+static void
+sysfs_attrs_close_cb (gpointer key, gpointer value, gpointer user_data)
+{
+	close (GPOINTER_TO_INT (value));
+}
+
+/* close every open attribute, they are opened again when next read */
+void
+sysfs_attrs_close (SysfsAttrs *attrs)
+{
+	g_hash_table_foreach (attrs->fds, sysfs_attrs_close_cb, NULL);
+	g_hash_table_remove_all (attrs->fds);
+	if (attrs->dirfd >= 0) {
+		close (attrs->dirfd);
+		attrs->dirfd = -1;
+	}
+}
+
+void
+sysfs_attrs_free (SysfsAttrs *attrs)
+{
+	if (attrs == NULL)
+		return;
+	sysfs_attrs_close (attrs);
+	g_hash_table_unref (attrs->fds);
+	g_free (attrs->dir);
+	g_free (attrs);
+}
+
+const char *
+sysfs_attrs_get_dir (SysfsAttrs *attrs)
+{
+	return attrs->dir;
+}
+
+static int
+sysfs_attrs_get_dirfd (SysfsAttrs *attrs)
+{
+	if (attrs->dirfd < 0)
+		attrs->dirfd = open (attrs->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	return attrs->dirfd;
+}
+
+static int
+sysfs_attrs_open (SysfsAttrs *attrs, const char *attribute)
+{
+	int dirfd;
+	int fd;
+
+	dirfd = sysfs_attrs_get_dirfd (attrs);
+	if (dirfd < 0)
+		return -1;
+	fd = openat (dirfd, attribute, O_RDONLY | O_CLOEXEC);
+
+	/* missing attributes are not remembered, as they can appear later */
+	if (fd >= 0)
+		g_hash_table_insert (attrs->fds, g_strdup (attribute), GINT_TO_POINTER (fd));
+	return fd;
+}
+
+static void
+sysfs_attrs_forget (SysfsAttrs *attrs, const char *attribute, int fd)
+{
+	close (fd);
+	g_hash_table_remove (attrs->fds, attribute);
+
+	/* the directory went away with it */
+	if (attrs->dirfd >= 0) {
+		close (attrs->dirfd);
+		attrs->dirfd = -1;
+	}
+}
+
+/* read the attribute into buffer, returning FALSE if it does not exist */
+gboolean
+sysfs_attrs_read (SysfsAttrs *attrs, const char *attribute, char *buffer, gsize size)
+{
+	gpointer value;
+	int fd;
+
+	if (g_hash_table_lookup_extended (attrs->fds, attribute, NULL, &value)) {
+		fd = GPOINTER_TO_INT (value);
+		if (sysfs_read_fd (fd, buffer, size))
+			return TRUE;
+		if (errno != ENODEV)
+			return FALSE;
+
+		/* the device was removed under us, so try it by name once more */
+		sysfs_attrs_forget (attrs, attribute, fd);
+	}
+
+	fd = sysfs_attrs_open (attrs, attribute);
+	if (fd < 0)
+		return FALSE;
+	if (sysfs_read_fd (fd, buffer, size))
+		return TRUE;
+	if (errno == ENODEV)
+		sysfs_attrs_forget (attrs, attribute, fd);
+	return FALSE;
+}
@@ -35,4 +35,19 @@ char     *sysfs_resolve_link  (const char *dir, const char *attribute);
 
 char *_dupv8 (const char *s);
 
+gboolean  sysfs_parse_double  (const char *text, double *value);
+gboolean  sysfs_parse_int     (const char *text, int *value);
+gboolean  sysfs_parse_uint64  (const char *text, guint base, guint64 *value);
+
+/* sysfs never returns more than a page for an attribute */
+#define SYSFS_ATTRS_BUFFER_SIZE 4096
+
+typedef struct SysfsAttrs SysfsAttrs;
+
+SysfsAttrs *sysfs_attrs_new         (const char *dir);
+void        sysfs_attrs_free        (SysfsAttrs *attrs);
+void        sysfs_attrs_close       (SysfsAttrs *attrs);
+const char *sysfs_attrs_get_dir     (SysfsAttrs *attrs);
+gboolean    sysfs_attrs_read        (SysfsAttrs *attrs, const char *attribute, char *buffer, gsize size);
+
 #endif /* __SYSFS_UTILS_H__ */
@@ -208,12 +208,8 @@ up_device_csr_coldplug (UpDevice *device)
 		goto out;
 
 	/* set up a poll */
-	csr->priv->poll_timer_id = g_timeout_add_seconds (UP_DEVICE_CSR_REFRESH_TIMEOUT,
-							  (GSourceFunc) up_device_csr_poll_cb, csr);
-
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (csr->priv->poll_timer_id, "[UpDeviceCsr] poll");
-#endif
+	csr->priv->poll_timer_id = up_device_poll_add (UP_DEVICE (csr), UP_DEVICE_CSR_REFRESH_TIMEOUT,
+						       (GSourceFunc) up_device_csr_poll_cb, "[UpDeviceCsr] poll");
 out:
 	return ret;
 }
@@ -327,7 +323,7 @@ up_device_csr_finalize (GObject *object)
 
 	libusb_exit (csr->priv->ctx);
 	if (csr->priv->poll_timer_id > 0)
-		g_source_remove (csr->priv->poll_timer_id);
+		up_device_poll_remove (UP_DEVICE (csr), csr->priv->poll_timer_id);
 
 	G_OBJECT_CLASS (up_device_csr_parent_class)->finalize (object);
 }
@@ -365,6 +365,10 @@ up_device_hid_coldplug (UpDevice *device)
 
 	/* fix up device states */
 	up_device_hid_fixup_state (device);
+
+	/* set up a poll */
+	hid->priv->poll_timer_id = up_device_poll_add (UP_DEVICE (hid), UP_DEVICE_HID_REFRESH_TIMEOUT,
+						       (GSourceFunc) up_device_hid_poll, "[UpDeviceHid] poll");
 out:
 	return ret;
 }
@@ -428,11 +432,7 @@ up_device_hid_init (UpDeviceHid *hid)
 {
 	hid->priv = UP_DEVICE_HID_GET_PRIVATE (hid);
 	hid->priv->fd = -1;
-	hid->priv->poll_timer_id = g_timeout_add_seconds (UP_DEVICE_HID_REFRESH_TIMEOUT,
-							  (GSourceFunc) up_device_hid_poll, hid);
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (hid->priv->poll_timer_id, "[UpDeviceHid] poll");
-#endif
+	hid->priv->poll_timer_id = 0;
 }
 
 /**
@@ -452,7 +452,7 @@ up_device_hid_finalize (GObject *object)
 	if (hid->priv->fd > 0)
 		close (hid->priv->fd);
 	if (hid->priv->poll_timer_id > 0)
-		g_source_remove (hid->priv->poll_timer_id);
+		up_device_poll_remove (UP_DEVICE (hid), hid->priv->poll_timer_id);
 
 	G_OBJECT_CLASS (up_device_hid_parent_class)->finalize (object);
 }
@@ -152,12 +152,8 @@ up_device_idevice_coldplug (UpDevice *device)
 	idevice->priv->client = NULL;
 
 	/* set up a poll */
-	idevice->priv->poll_timer_id = g_timeout_add_seconds (poll_seconds,
-							      (GSourceFunc) up_device_idevice_poll_cb, idevice);
-
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (idevice->priv->poll_timer_id, "[UpDeviceIdevice] poll");
-#endif
+	idevice->priv->poll_timer_id = up_device_poll_add (UP_DEVICE (idevice), (guint) poll_seconds,
+							   (GSourceFunc) up_device_idevice_poll_cb, "[UpDeviceIdevice] poll");
 	return TRUE;
 
 out:
@@ -261,7 +257,7 @@ up_device_idevice_finalize (GObject *object)
 	g_return_if_fail (idevice->priv != NULL);
 
 	if (idevice->priv->poll_timer_id > 0)
-		g_source_remove (idevice->priv->poll_timer_id);
+		up_device_poll_remove (UP_DEVICE (idevice), idevice->priv->poll_timer_id);
 	if (idevice->priv->client != NULL)
 		lockdownd_client_free (idevice->priv->client);
 	idevice_free (idevice->priv->dev);
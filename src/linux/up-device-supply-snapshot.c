@@ -0,0 +1,192 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2008 David Zeuthen <davidz@redhat.com>
+ * Copyright (C) 2008 Richard Hughes <richard@hughsie.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "sysfs-utils.h"
+#include "egg-debug.h"
+
+#include "up-device-supply-snapshot.h"
+
+typedef enum {
+	UP_DEVICE_SUPPLY_KIND_BOOL,
+	UP_DEVICE_SUPPLY_KIND_NONZERO,
+	UP_DEVICE_SUPPLY_KIND_DOUBLE,
+	UP_DEVICE_SUPPLY_KIND_STRING
+} UpDeviceSupplyKind;
+
+typedef struct {
+	const gchar		*key;
+	const gchar		*attribute;
+	UpDeviceSupplyKind	 kind;
+	gsize			 offset;
+} UpDeviceSupplyFieldInfo;
+
+#define UP_DEVICE_SUPPLY_FIELD(key,attribute,kind,member) \
+	{ key, attribute, UP_DEVICE_SUPPLY_KIND_##kind, G_STRUCT_OFFSET (UpDeviceSupplySnapshot, member) }
+
+/* indexed by UpDeviceSupplyField; the key is the uevent name without POWER_SUPPLY_ */
+static const UpDeviceSupplyFieldInfo up_device_supply_fields[] = {
+	UP_DEVICE_SUPPLY_FIELD ("PRESENT", "present", BOOL, present),
+	UP_DEVICE_SUPPLY_FIELD ("ONLINE", "online", NONZERO, online),
+	UP_DEVICE_SUPPLY_FIELD ("STATUS", "status", STRING, status),
+	UP_DEVICE_SUPPLY_FIELD ("TYPE", "type", STRING, type),
+	UP_DEVICE_SUPPLY_FIELD ("TECHNOLOGY", "technology", STRING, technology),
+	UP_DEVICE_SUPPLY_FIELD ("MANUFACTURER", "manufacturer", STRING, manufacturer),
+	UP_DEVICE_SUPPLY_FIELD ("MODEL_NAME", "model_name", STRING, model_name),
+	UP_DEVICE_SUPPLY_FIELD ("SERIAL_NUMBER", "serial_number", STRING, serial_number),
+	UP_DEVICE_SUPPLY_FIELD ("ENERGY_NOW", "energy_now", DOUBLE, energy_now),
+	UP_DEVICE_SUPPLY_FIELD ("ENERGY_AVG", "energy_avg", DOUBLE, energy_avg),
+	UP_DEVICE_SUPPLY_FIELD ("ENERGY_FULL", "energy_full", DOUBLE, energy_full),
+	UP_DEVICE_SUPPLY_FIELD ("ENERGY_FULL_DESIGN", "energy_full_design", DOUBLE, energy_full_design),
+	UP_DEVICE_SUPPLY_FIELD ("CHARGE_NOW", "charge_now", DOUBLE, charge_now),
+	UP_DEVICE_SUPPLY_FIELD ("CHARGE_AVG", "charge_avg", DOUBLE, charge_avg),
+	UP_DEVICE_SUPPLY_FIELD ("CHARGE_FULL", "charge_full", DOUBLE, charge_full),
+	UP_DEVICE_SUPPLY_FIELD ("CHARGE_FULL_DESIGN", "charge_full_design", DOUBLE, charge_full_design),
+	UP_DEVICE_SUPPLY_FIELD ("POWER_NOW", "power_now", DOUBLE, power_now),
+	UP_DEVICE_SUPPLY_FIELD ("CURRENT_NOW", "current_now", DOUBLE, current_now),
+	UP_DEVICE_SUPPLY_FIELD ("VOLTAGE_NOW", "voltage_now", DOUBLE, voltage_now),
+	UP_DEVICE_SUPPLY_FIELD ("VOLTAGE_AVG", "voltage_avg", DOUBLE, voltage_avg),
+	UP_DEVICE_SUPPLY_FIELD ("VOLTAGE_MAX_DESIGN", "voltage_max_design", DOUBLE, voltage_max_design),
+	UP_DEVICE_SUPPLY_FIELD ("VOLTAGE_MIN_DESIGN", "voltage_min_design", DOUBLE, voltage_min_design),
+	UP_DEVICE_SUPPLY_FIELD ("VOLTAGE_PRESENT", "voltage_present", DOUBLE, voltage_present),
+};
+
+/**
+ * up_device_supply_snapshot_set:
+ *
+ * Parses one value in place, which must stay in the snapshot buffer.
+ * Numbers that do not parse are left out of the snapshot.
+ **/
+static void
+up_device_supply_snapshot_set (UpDeviceSupplySnapshot *snapshot, UpDeviceSupplyField field, gchar *value)
+{
+	const UpDeviceSupplyFieldInfo *info = &up_device_supply_fields[field];
+	gpointer member = G_STRUCT_MEMBER_P (snapshot, info->offset);
+	gint number;
+
+	switch (info->kind) {
+	case UP_DEVICE_SUPPLY_KIND_BOOL:
+		*((gboolean *) member) = (g_strcmp0 (g_strstrip (value), "1") == 0);
+		break;
+	case UP_DEVICE_SUPPLY_KIND_NONZERO:
+		/* some supplies report other values than 1 when online */
+		if (!sysfs_parse_int (value, &number)) {
+			egg_debug ("invalid %s value '%s'", info->attribute, value);
+			return;
+		}
+		*((gboolean *) member) = (number != 0);
+		break;
+	case UP_DEVICE_SUPPLY_KIND_DOUBLE:
+		/* treat garbage like a missing value rather than as zero */
+		if (!sysfs_parse_double (value, (gdouble *) member)) {
+			egg_debug ("invalid %s value '%s'", info->attribute, value);
+			return;
+		}
+		break;
+	case UP_DEVICE_SUPPLY_KIND_STRING:
+		*((const gchar **) member) = g_strstrip (value);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+	snapshot->has |= 1 << field;
+}
+
+/**
+ * up_device_supply_snapshot_parse_uevent:
+ *
+ * @snapshot: a cleared snapshot, with the uevent file in the buffer
+ *
+ * The uevent file holds every POWER_SUPPLY_ value as KEY=VALUE lines.
+ * Unknown keys are skipped.
+ **/
+void
+up_device_supply_snapshot_parse_uevent (UpDeviceSupplySnapshot *snapshot)
+{
+	gchar *line;
+	gchar *next;
+	gchar *value;
+	guint i;
+
+	for (line = snapshot->buffer; line != NULL && line[0] != '\0'; line = next) {
+		next = strchr (line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+		if (!g_str_has_prefix (line, "POWER_SUPPLY_"))
+			continue;
+		line += strlen ("POWER_SUPPLY_");
+		value = strchr (line, '=');
+		if (value == NULL)
+			continue;
+		*value++ = '\0';
+		for (i=0; i<UP_DEVICE_SUPPLY_FIELD_LAST; i++) {
+			if (strcmp (line, up_device_supply_fields[i].key) == 0) {
+				up_device_supply_snapshot_set (snapshot, i, value);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * up_device_supply_snapshot_read:
+ *
+ * Reads all the values of the device with one read of the uevent file, so
+ * they are consistent with each other. Drivers that fail one property fail
+ * the whole uevent read, so then fall back to reading each attribute.
+ **/
+void
+up_device_supply_snapshot_read (UpDeviceSupplySnapshot *snapshot, SysfsAttrs *attrs)
+{
+	const UpDeviceSupplyFieldInfo *info;
+	gsize used = 0;
+	guint i;
+
+	memset (snapshot, 0, G_STRUCT_OFFSET (UpDeviceSupplySnapshot, buffer));
+	if (sysfs_attrs_read (attrs, "uevent", snapshot->buffer, sizeof (snapshot->buffer))) {
+		up_device_supply_snapshot_parse_uevent (snapshot);
+		goto out;
+	}
+
+	egg_debug ("failed to read uevent of %s, reading attributes", sysfs_attrs_get_dir (attrs));
+	for (i=0; i<UP_DEVICE_SUPPLY_FIELD_LAST && used + 1 < sizeof (snapshot->buffer); i++) {
+		gchar *value = snapshot->buffer + used;
+		if (!sysfs_attrs_read (attrs, up_device_supply_fields[i].attribute,
+				       value, sizeof (snapshot->buffer) - used))
+			continue;
+		up_device_supply_snapshot_set (snapshot, i, value);
+		used += strlen (value) + 1;
+	}
+out:
+	/* missing strings read as empty, like missing numbers read as zero */
+	for (i=0; i<UP_DEVICE_SUPPLY_FIELD_LAST; i++) {
+		info = &up_device_supply_fields[i];
+		if (info->kind == UP_DEVICE_SUPPLY_KIND_STRING &&
+		    !UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, i))
+			*((const gchar **) G_STRUCT_MEMBER_P (snapshot, info->offset)) = "";
+	}
+}
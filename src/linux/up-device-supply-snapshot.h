@@ -0,0 +1,95 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2008 David Zeuthen <davidz@redhat.com>
+ * Copyright (C) 2008 Richard Hughes <richard@hughsie.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __UP_DEVICE_SUPPLY_SNAPSHOT_H__
+#define __UP_DEVICE_SUPPLY_SNAPSHOT_H__
+
+#include <glib.h>
+
+#include "sysfs-utils.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+	UP_DEVICE_SUPPLY_FIELD_PRESENT,
+	UP_DEVICE_SUPPLY_FIELD_ONLINE,
+	UP_DEVICE_SUPPLY_FIELD_STATUS,
+	UP_DEVICE_SUPPLY_FIELD_TYPE,
+	UP_DEVICE_SUPPLY_FIELD_TECHNOLOGY,
+	UP_DEVICE_SUPPLY_FIELD_MANUFACTURER,
+	UP_DEVICE_SUPPLY_FIELD_MODEL_NAME,
+	UP_DEVICE_SUPPLY_FIELD_SERIAL_NUMBER,
+	UP_DEVICE_SUPPLY_FIELD_ENERGY_NOW,
+	UP_DEVICE_SUPPLY_FIELD_ENERGY_AVG,
+	UP_DEVICE_SUPPLY_FIELD_ENERGY_FULL,
+	UP_DEVICE_SUPPLY_FIELD_ENERGY_FULL_DESIGN,
+	UP_DEVICE_SUPPLY_FIELD_CHARGE_NOW,
+	UP_DEVICE_SUPPLY_FIELD_CHARGE_AVG,
+	UP_DEVICE_SUPPLY_FIELD_CHARGE_FULL,
+	UP_DEVICE_SUPPLY_FIELD_CHARGE_FULL_DESIGN,
+	UP_DEVICE_SUPPLY_FIELD_POWER_NOW,
+	UP_DEVICE_SUPPLY_FIELD_CURRENT_NOW,
+	UP_DEVICE_SUPPLY_FIELD_VOLTAGE_NOW,
+	UP_DEVICE_SUPPLY_FIELD_VOLTAGE_AVG,
+	UP_DEVICE_SUPPLY_FIELD_VOLTAGE_MAX_DESIGN,
+	UP_DEVICE_SUPPLY_FIELD_VOLTAGE_MIN_DESIGN,
+	UP_DEVICE_SUPPLY_FIELD_VOLTAGE_PRESENT,
+	UP_DEVICE_SUPPLY_FIELD_LAST
+} UpDeviceSupplyField;
+
+/* every value of one refresh, as the kernel reported them at the same time */
+typedef struct {
+	guint32			 has;
+	gboolean		 present;
+	gboolean		 online;
+	const gchar		*status;
+	const gchar		*type;
+	const gchar		*technology;
+	const gchar		*manufacturer;
+	const gchar		*model_name;
+	const gchar		*serial_number;
+	gdouble			 energy_now;
+	gdouble			 energy_avg;
+	gdouble			 energy_full;
+	gdouble			 energy_full_design;
+	gdouble			 charge_now;
+	gdouble			 charge_avg;
+	gdouble			 charge_full;
+	gdouble			 charge_full_design;
+	gdouble			 power_now;
+	gdouble			 current_now;
+	gdouble			 voltage_now;
+	gdouble			 voltage_avg;
+	gdouble			 voltage_max_design;
+	gdouble			 voltage_min_design;
+	gdouble			 voltage_present;
+	gchar			 buffer[SYSFS_ATTRS_BUFFER_SIZE];
+} UpDeviceSupplySnapshot;
+
+#define UP_DEVICE_SUPPLY_SNAPSHOT_HAS(s,f)	(((s)->has & (1 << (f))) != 0)
+
+void		 up_device_supply_snapshot_parse_uevent	(UpDeviceSupplySnapshot	*snapshot);
+void		 up_device_supply_snapshot_read		(UpDeviceSupplySnapshot	*snapshot,
+							 SysfsAttrs		*attrs);
+
+G_END_DECLS
+
+#endif /* __UP_DEVICE_SUPPLY_SNAPSHOT_H__ */
@@ -38,8 +38,13 @@
 
 #include "up-types.h"
 #include "up-device-supply.h"
+#include "up-device-supply-snapshot.h"
 
 #define UP_DEVICE_SUPPLY_REFRESH_TIMEOUT	30	/* seconds */
+#define UP_DEVICE_SUPPLY_POLL_FAST_TIMEOUT	10	/* seconds */
+#define UP_DEVICE_SUPPLY_POLL_SLOW_TIMEOUT	240	/* seconds */
+#define UP_DEVICE_SUPPLY_POLL_LOW_PERCENTAGE	15.0f	/* % */
+#define UP_DEVICE_SUPPLY_POLL_VOLATILE_RATE	0.25f	/* fraction of the rate */
 #define UP_DEVICE_SUPPLY_UNKNOWN_TIMEOUT	2	/* seconds */
 #define UP_DEVICE_SUPPLY_UNKNOWN_RETRIES	30
 #define UP_DEVICE_SUPPLY_CHARGED_THRESHOLD	90.0f	/* % */
@@ -50,12 +55,20 @@
 struct UpDeviceSupplyPrivate
 {
 	guint			 poll_timer_id;
+	guint			 poll_timer_interval;
+	guint			 poll_interval;
+	gboolean		 polling;
+	gint64			 poll_last_refresh;	/* monotonic seconds */
+	gdouble			 poll_last_energy;
+	gdouble			 poll_last_energy_rate;
+	UpDeviceState		 poll_last_state;
 	gboolean		 has_coldplug_values;
 	gboolean		 coldplug_units;
 	gdouble			 energy_old;
 	GTimeVal		 energy_old_timespec;
 	guint			 unknown_retries;
 	gboolean		 enable_poll;
+	SysfsAttrs		*attrs;
 };
 
 G_DEFINE_TYPE (UpDeviceSupply, up_device_supply, UP_TYPE_DEVICE)
@@ -72,16 +85,14 @@ static gboolean
 up_device_supply_refresh_line_power (UpDeviceSupply *supply)
 {
 	UpDevice *device = UP_DEVICE (supply);
-	GUdevDevice *native;
-	const gchar *native_path;
+	UpDeviceSupplySnapshot snapshot;
 
 	/* force true */
 	g_object_set (device, "power-supply", TRUE, NULL);
 
 	/* get new AC value */
-	native = G_UDEV_DEVICE (up_device_get_native (device));
-	native_path = g_udev_device_get_sysfs_path (native);
-	g_object_set (device, "online", sysfs_get_int (native_path, "online"), NULL);
+	up_device_supply_snapshot_read (&snapshot, supply->priv->attrs);
+	g_object_set (device, "online", snapshot.online, NULL);
 
 	return TRUE;
 }
@@ -99,6 +110,10 @@ up_device_supply_reset_values (UpDeviceSupply *supply)
 	supply->priv->energy_old = 0;
 	supply->priv->energy_old_timespec.tv_sec = 0;
 
+	/* don't keep attributes open while there is nothing to read */
+	if (supply->priv->attrs != NULL)
+		sysfs_attrs_close (supply->priv->attrs);
+
 	/* reset to default */
 	g_object_set (device,
 		      "vendor", NULL,
@@ -280,62 +295,49 @@ up_device_supply_convert_device_technology (const gchar *type)
 }
 
 /**
- * up_device_supply_get_string:
+ * up_device_supply_dup_string:
  **/
 static gchar *
-up_device_supply_get_string (const gchar *native_path, const gchar *key)
+up_device_supply_dup_string (const gchar *value)
 {
-	gchar *value;
-
-	/* get value, and strip to remove spaces */
-	value = g_strstrip (sysfs_get_string (native_path, key));
-
-	/* no value */
-	if (value == NULL)
-		goto out;
-
-	/* empty value */
-	if (value[0] == '\0') {
-		g_free (value);
-		value = NULL;
-		goto out;
-	}
-out:
-	return value;
+	/* no or empty value */
+	if (value == NULL || value[0] == '\0')
+		return NULL;
+	return g_strdup (value);
 }
 
 /**
  * up_device_supply_get_design_voltage:
  **/
 static gdouble
-up_device_supply_get_design_voltage (const gchar *native_path)
+up_device_supply_get_design_voltage (const UpDeviceSupplySnapshot *snapshot)
 {
 	gdouble voltage;
 
 	/* design maximum */
-	voltage = sysfs_get_double (native_path, "voltage_max_design") / 1000000.0;
-	if (voltage > 1.00f) {
+	voltage = snapshot->voltage_max_design / 1000000.0;
+	if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_VOLTAGE_MAX_DESIGN) && voltage > 1.00f) {
 		egg_debug ("using max design voltage");
 		goto out;
 	}
 
 	/* design minimum */
-	voltage = sysfs_get_double (native_path, "voltage_min_design") / 1000000.0;
-	if (voltage > 1.00f) {
+	voltage = snapshot->voltage_min_design / 1000000.0;
+	if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_VOLTAGE_MIN_DESIGN) && voltage > 1.00f) {
 		egg_debug ("using min design voltage");
 		goto out;
 	}
 
 	/* current voltage */
-	voltage = sysfs_get_double (native_path, "voltage_present") / 1000000.0;
-	if (voltage > 1.00f) {
+	voltage = snapshot->voltage_present / 1000000.0;
+	if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_VOLTAGE_PRESENT) && voltage > 1.00f) {
 		egg_debug ("using present voltage");
 		goto out;
 	}
 
 	/* current voltage, alternate form */
-	voltage = sysfs_get_double (native_path, "voltage_now") / 1000000.0;
-	if (voltage > 1.00f) {
+	voltage = snapshot->voltage_now / 1000000.0;
+	if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_VOLTAGE_NOW) && voltage > 1.00f) {
 		egg_debug ("using present voltage (alternate)");
 		goto out;
 	}
@@ -377,15 +379,15 @@ up_device_supply_make_safe_string (gchar *text)
 }
 
 static gboolean
-up_device_supply_units_changed (UpDeviceSupply *supply, const gchar *native_path)
+up_device_supply_units_changed (UpDeviceSupply *supply, const UpDeviceSupplySnapshot *snapshot)
 {
 	if (supply->priv->coldplug_units == UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE)
-		if (sysfs_file_exists (native_path, "charge_now") ||
-		    sysfs_file_exists (native_path, "charge_avg"))
+		if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_CHARGE_NOW) ||
+		    UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_CHARGE_AVG))
 			return FALSE;
 	if (supply->priv->coldplug_units == UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY)
-		if (sysfs_file_exists (native_path, "energy_now") ||
-		    sysfs_file_exists (native_path, "energy_avg"))
+		if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_ENERGY_NOW) ||
+		    UP_DEVICE_SUPPLY_SNAPSHOT_HAS (snapshot, UP_DEVICE_SUPPLY_FIELD_ENERGY_AVG))
 			return FALSE;
 	return TRUE;
 }
@@ -398,14 +400,14 @@ up_device_supply_units_changed (UpDeviceSupply *supply, const gchar *native_path
 static gboolean
 up_device_supply_refresh_battery (UpDeviceSupply *supply)
 {
-	gchar *status = NULL;
+	const gchar *status;
 	gchar *technology_native = NULL;
 	gboolean ret = TRUE;
 	gdouble voltage_design;
 	UpDeviceState old_state;
 	UpDeviceState state;
 	UpDevice *device = UP_DEVICE (supply);
-	const gchar *native_path;
+	UpDeviceSupplySnapshot snapshot;
 	GUdevDevice *native;
 	gboolean is_present;
 	gdouble energy;
@@ -428,10 +430,12 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 	guint battery_count;
 
 	native = G_UDEV_DEVICE (up_device_get_native (device));
-	native_path = g_udev_device_get_sysfs_path (native);
+
+	/* every value comes from the same read */
+	up_device_supply_snapshot_read (&snapshot, supply->priv->attrs);
 
 	/* have we just been removed? */
-	is_present = sysfs_get_bool (native_path, "present");
+	is_present = snapshot.present;
 	g_object_set (device, "is-present", is_present, NULL);
 	if (!is_present) {
 		up_device_supply_reset_values (supply);
@@ -439,28 +443,28 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 	}
 
 	/* get the currect charge */
-	energy = sysfs_get_double (native_path, "energy_now") / 1000000.0;
+	energy = snapshot.energy_now / 1000000.0;
 	if (energy == 0)
-		energy = sysfs_get_double (native_path, "energy_avg") / 1000000.0;
+		energy = snapshot.energy_avg / 1000000.0;
 
 	/* used to convert A to W later */
-	voltage_design = up_device_supply_get_design_voltage (native_path);
+	voltage_design = up_device_supply_get_design_voltage (&snapshot);
 
 	/* initial values */
 	if (!supply->priv->has_coldplug_values ||
-	    up_device_supply_units_changed (supply, native_path)) {
+	    up_device_supply_units_changed (supply, &snapshot)) {
 
 		/* when we add via sysfs power_supply class then we know this is true */
 		g_object_set (device, "power-supply", TRUE, NULL);
 
 		/* the ACPI spec is bad at defining battery type constants */
-		technology_native = up_device_supply_get_string (native_path, "technology");
+		technology_native = up_device_supply_dup_string (snapshot.technology);
 		g_object_set (device, "technology", up_device_supply_convert_device_technology (technology_native), NULL);
 
 		/* get values which may be blank */
-		manufacturer = up_device_supply_get_string (native_path, "manufacturer");
-		model_name = up_device_supply_get_string (native_path, "model_name");
-		serial_number = up_device_supply_get_string (native_path, "serial_number");
+		manufacturer = up_device_supply_dup_string (snapshot.manufacturer);
+		model_name = up_device_supply_dup_string (snapshot.model_name);
+		serial_number = up_device_supply_dup_string (snapshot.serial_number);
 
 		/* some vendors fill this with binary garbage */
 		up_device_supply_make_safe_string (manufacturer);
@@ -487,13 +491,13 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 			      NULL);
 
 		/* these don't change at runtime */
-		energy_full = sysfs_get_double (native_path, "energy_full") / 1000000.0;
-		energy_full_design = sysfs_get_double (native_path, "energy_full_design") / 1000000.0;
+		energy_full = snapshot.energy_full / 1000000.0;
+		energy_full_design = snapshot.energy_full_design / 1000000.0;
 
 		/* convert charge to energy */
 		if (energy == 0) {
-			energy_full = sysfs_get_double (native_path, "charge_full") / 1000000.0;
-			energy_full_design = sysfs_get_double (native_path, "charge_full_design") / 1000000.0;
+			energy_full = snapshot.charge_full / 1000000.0;
+			energy_full_design = snapshot.charge_full_design / 1000000.0;
 			energy_full *= voltage_design;
 			energy_full_design *= voltage_design;
 			supply->priv->coldplug_units = UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE;
@@ -531,7 +535,7 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 			      NULL);
 	}
 
-	status = g_strstrip (sysfs_get_string (native_path, "status"));
+	status = snapshot.status;
 	if (g_ascii_strcasecmp (status, "charging") == 0)
 		state = UP_DEVICE_STATE_CHARGING;
 	else if (g_ascii_strcasecmp (status, "discharging") == 0)
@@ -558,26 +562,26 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 	}
 
 	/* this is the new value in uW */
-	energy_rate = fabs (sysfs_get_double (native_path, "power_now") / 1000000.0);
+	energy_rate = fabs (snapshot.power_now / 1000000.0);
 	if (energy_rate == 0) {
 		gdouble charge_full;
 
 		/* convert charge to energy */
 		if (energy == 0) {
-			energy = sysfs_get_double (native_path, "charge_now") / 1000000.0;
+			energy = snapshot.charge_now / 1000000.0;
 			if (energy == 0)
-				energy = sysfs_get_double (native_path, "charge_avg") / 1000000.0;
+				energy = snapshot.charge_avg / 1000000.0;
 			energy *= voltage_design;
 		}
 
-                charge_full = sysfs_get_double (native_path, "charge_full") / 1000000.0;
+                charge_full = snapshot.charge_full / 1000000.0;
                 if (charge_full == 0)
-                        charge_full = sysfs_get_double (native_path, "charge_full_design") / 1000000.0;
+                        charge_full = snapshot.charge_full_design / 1000000.0;
 
                 /* If charge_full exists, then current_now is always reported in uA.
                  * In the legacy case, where energy only units exist, and power_now isn't present
                  * current_now is power in uW. */
-		energy_rate = fabs (sysfs_get_double (native_path, "current_now") / 1000000.0);
+		energy_rate = fabs (snapshot.current_now / 1000000.0);
 		if (charge_full != 0)
 			energy_rate *= voltage_design;
 	}
@@ -589,9 +593,9 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 	}
 
 	/* present voltage */
-	voltage = sysfs_get_double (native_path, "voltage_now") / 1000000.0;
+	voltage = snapshot.voltage_now / 1000000.0;
 	if (voltage == 0)
-		voltage = sysfs_get_double (native_path, "voltage_avg") / 1000000.0;
+		voltage = snapshot.voltage_avg / 1000000.0;
 
 	/* ACPI gives out the special 'Ones' value for rate when it's unable
 	 * to calculate the true rate. We should set the rate zero, and wait
@@ -667,7 +671,7 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply)
 
 	/* if empty, and BIOS does not know what to do */
 	if (state == UP_DEVICE_STATE_UNKNOWN && energy < 0.01) {
-		egg_warning ("Setting %s state empty as unknown and very low", native_path);
+		egg_warning ("Setting %s state empty as unknown and very low", sysfs_attrs_get_dir (supply->priv->attrs));
 		state = UP_DEVICE_STATE_EMPTY;
 	}
 
@@ -719,10 +723,26 @@ out:
 	g_free (manufacturer);
 	g_free (model_name);
 	g_free (serial_number);
-	g_free (status);
 	return ret;
 }
 
+/**
+ * up_device_supply_get_time_now:
+ *
+ * Returns: seconds that are not affected by the wall clock being set
+ **/
+static gint64
+up_device_supply_get_time_now (void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return g_get_monotonic_time () / G_USEC_PER_SEC;
+#else
+	GTimeVal timeval;
+	g_get_current_time (&timeval);
+	return timeval.tv_sec;
+#endif
+}
+
 /**
  * up_device_supply_poll_battery:
  **/
@@ -730,13 +750,25 @@ static gboolean
 up_device_supply_poll_battery (UpDeviceSupply *supply)
 {
 	UpDevice *device = UP_DEVICE (supply);
+	gint64 age;
+	guint timer_id;
+
+	/* a uevent refreshed the device since the last poll */
+	age = up_device_supply_get_time_now () - supply->priv->poll_last_refresh;
+	if (age >= 0 && age < supply->priv->poll_timer_interval / 2) {
+		egg_debug ("supply %s refreshed %lis ago, skipping poll", up_device_get_object_path (device),
+			   (glong) age);
+		return TRUE;
+	}
 
-	egg_debug ("No updates on supply %s for %i seconds; forcing update", up_device_get_object_path (device), UP_DEVICE_SUPPLY_REFRESH_TIMEOUT);
-	supply->priv->poll_timer_id = 0;
+	egg_debug ("No updates on supply %s for %i seconds; forcing update", up_device_get_object_path (device), supply->priv->poll_timer_interval);
+	timer_id = supply->priv->poll_timer_id;
+	supply->priv->polling = TRUE;
 	up_device_supply_refresh (device);
+	supply->priv->polling = FALSE;
 
-	/* never repeat */
-	return FALSE;
+	/* keep going unless the refresh replaced or removed us */
+	return (supply->priv->poll_timer_id == timer_id);
 }
 
 /**
@@ -753,6 +785,7 @@ up_device_supply_coldplug (UpDevice *device)
 	const gchar *native_path;
 	gchar *device_type = NULL;
 	UpDeviceKind type = UP_DEVICE_KIND_UNKNOWN;
+	UpDeviceSupplySnapshot snapshot;
 
 	up_device_supply_reset_values (supply);
 
@@ -764,8 +797,13 @@ up_device_supply_coldplug (UpDevice *device)
 		goto out;
 	}
 
+	/* keep the attributes open for refresh */
+	if (supply->priv->attrs == NULL)
+		supply->priv->attrs = sysfs_attrs_new (native_path);
+
 	/* try to detect using the device type */
-	device_type = up_device_supply_get_string (native_path, "type");
+	up_device_supply_snapshot_read (&snapshot, supply->priv->attrs);
+	device_type = up_device_supply_dup_string (snapshot.type);
 	if (device_type != NULL) {
 		if (g_ascii_strcasecmp (device_type, "mains") == 0) {
 			type = UP_DEVICE_KIND_LINE_POWER;
@@ -778,7 +816,7 @@ up_device_supply_coldplug (UpDevice *device)
 
 	/* if reading the device type did not work, use the previous method */
 	if (type == UP_DEVICE_KIND_UNKNOWN) {
-		if (sysfs_file_exists (native_path, "online")) {
+		if (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (&snapshot, UP_DEVICE_SUPPLY_FIELD_ONLINE)) {
 			type = UP_DEVICE_KIND_LINE_POWER;
 		} else {
 			/* this is a good guess as UPS and CSR are not in the kernel */
@@ -796,6 +834,76 @@ out:
 	return ret;
 }
 
+/**
+ * up_device_supply_get_poll_interval:
+ *
+ * A poll that finds nothing new means the kernel tells us about changes,
+ * so the interval is doubled, and a poll that finds changes sets it back.
+ * A rate that jumps around halves it, and it is kept short when nearly
+ * empty so the low battery warning is not late.
+ **/
+static guint
+up_device_supply_get_poll_interval (UpDeviceSupply *supply, UpDeviceState state,
+				    gdouble energy, gdouble energy_rate, gdouble percentage)
+{
+	UpDeviceSupplyPrivate *priv = supply->priv;
+	guint interval = priv->poll_interval;
+	gboolean changed;
+	gboolean volatile_rate;
+
+	changed = (state != priv->poll_last_state ||
+		   energy != priv->poll_last_energy ||
+		   energy_rate != priv->poll_last_energy_rate);
+	volatile_rate = (priv->poll_last_energy_rate > 0 &&
+			 fabs (energy_rate - priv->poll_last_energy_rate) >
+			 priv->poll_last_energy_rate * UP_DEVICE_SUPPLY_POLL_VOLATILE_RATE);
+
+	/* refreshes from uevents keep the interval */
+	if (priv->polling) {
+		if (volatile_rate)
+			interval /= 2;
+		else if (changed)
+			interval = UP_DEVICE_SUPPLY_REFRESH_TIMEOUT;
+		else
+			interval *= 2;
+	}
+	interval = CLAMP (interval, UP_DEVICE_SUPPLY_POLL_FAST_TIMEOUT, UP_DEVICE_SUPPLY_POLL_SLOW_TIMEOUT);
+	priv->poll_interval = interval;
+
+	priv->poll_last_state = state;
+	priv->poll_last_energy = energy;
+	priv->poll_last_energy_rate = energy_rate;
+
+	if (state == UP_DEVICE_STATE_DISCHARGING &&
+	    percentage < UP_DEVICE_SUPPLY_POLL_LOW_PERCENTAGE)
+		interval = UP_DEVICE_SUPPLY_POLL_FAST_TIMEOUT;
+	return interval;
+}
+
+/**
+ * up_device_supply_schedule_poll:
+ *
+ * Keeps the running timer when the interval is unchanged.
+ **/
+static void
+up_device_supply_schedule_poll (UpDeviceSupply *supply, guint interval, const gchar *name)
+{
+	if (supply->priv->poll_timer_id != 0 &&
+	    supply->priv->poll_timer_interval == interval)
+		return;
+
+	if (supply->priv->poll_timer_id != 0)
+		up_device_poll_remove (UP_DEVICE (supply), supply->priv->poll_timer_id);
+	supply->priv->poll_timer_id = 0;
+	supply->priv->poll_timer_interval = interval;
+	if (interval == 0)
+		return;
+
+	egg_debug ("polling %s every %i seconds", up_device_get_object_path (UP_DEVICE (supply)), interval);
+	supply->priv->poll_timer_id =
+		up_device_poll_add (UP_DEVICE (supply), interval, (GSourceFunc) up_device_supply_poll_battery, name);
+}
+
 /**
  * up_device_supply_setup_poll:
  **/
@@ -804,34 +912,38 @@ up_device_supply_setup_poll (UpDevice *device)
 {
 	UpDeviceState state;
 	UpDeviceSupply *supply = UP_DEVICE_SUPPLY (device);
+	gdouble energy;
+	gdouble energy_rate;
+	gdouble percentage;
+	guint interval;
 
-	g_object_get (device, "state", &state, NULL);
+	g_object_get (device,
+		      "state", &state,
+		      "energy", &energy,
+		      "energy-rate", &energy_rate,
+		      "percentage", &percentage,
+		      NULL);
+	supply->priv->poll_last_refresh = up_device_supply_get_time_now ();
 
 	/* don't setup the poll only if we're sure */
-	if (!supply->priv->enable_poll)
+	if (!supply->priv->enable_poll) {
+		up_device_supply_schedule_poll (supply, 0, NULL);
 		goto out;
+	}
 
 	/* if it's unknown, poll faster than we would normally */
 	if (state == UP_DEVICE_STATE_UNKNOWN &&
 	    supply->priv->unknown_retries < UP_DEVICE_SUPPLY_UNKNOWN_RETRIES) {
-		supply->priv->poll_timer_id =
-			g_timeout_add_seconds (UP_DEVICE_SUPPLY_UNKNOWN_TIMEOUT,
-					       (GSourceFunc) up_device_supply_poll_battery, supply);
-#if GLIB_CHECK_VERSION(2,25,8)
-		g_source_set_name_by_id (supply->priv->poll_timer_id, "[UpDeviceSupply] unknown poll");
-#endif
+		up_device_supply_schedule_poll (supply, UP_DEVICE_SUPPLY_UNKNOWN_TIMEOUT,
+						"[UpDeviceSupply] unknown poll");
 		/* increase count, we don't want to poll at 0.5Hz forever */
 		supply->priv->unknown_retries++;
 		goto out;
 	}
 
-	/* any other state just fall back */
-	supply->priv->poll_timer_id =
-		g_timeout_add_seconds (UP_DEVICE_SUPPLY_REFRESH_TIMEOUT,
-				       (GSourceFunc) up_device_supply_poll_battery, supply);
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (supply->priv->poll_timer_id, "[UpDeviceSupply] normal poll");
-#endif
+	/* any other state adapts to how the device behaves */
+	interval = up_device_supply_get_poll_interval (supply, state, energy, energy_rate, percentage);
+	up_device_supply_schedule_poll (supply, interval, "[UpDeviceSupply] normal poll");
 out:
 	return (supply->priv->poll_timer_id != 0);
 }
@@ -849,11 +961,6 @@ up_device_supply_refresh (UpDevice *device)
 	UpDeviceSupply *supply = UP_DEVICE_SUPPLY (device);
 	UpDeviceKind type;
 
-	if (supply->priv->poll_timer_id > 0) {
-		g_source_remove (supply->priv->poll_timer_id);
-		supply->priv->poll_timer_id = 0;
-	}
-
 	g_object_get (device, "type", &type, NULL);
 	switch (type) {
 	case UP_DEVICE_KIND_LINE_POWER:
@@ -863,7 +970,8 @@ up_device_supply_refresh (UpDevice *device)
 		ret = up_device_supply_refresh_battery (supply);
 
 		/* Seems that we don't get change uevents from the
-		 * kernel on some BIOS types */
+		 * kernel on some BIOS types, so poll, less often
+		 * when they do arrive */
 		up_device_supply_setup_poll (device);
 		break;
 	default:
@@ -889,7 +997,10 @@ up_device_supply_init (UpDeviceSupply *supply)
 	supply->priv = UP_DEVICE_SUPPLY_GET_PRIVATE (supply);
 	supply->priv->unknown_retries = 0;
 	supply->priv->poll_timer_id = 0;
+	supply->priv->poll_interval = UP_DEVICE_SUPPLY_REFRESH_TIMEOUT;
+	supply->priv->poll_last_state = UP_DEVICE_STATE_UNKNOWN;
 	supply->priv->enable_poll = TRUE;
+	supply->priv->attrs = NULL;
 }
 
 /**
@@ -907,7 +1018,8 @@ up_device_supply_finalize (GObject *object)
 	g_return_if_fail (supply->priv != NULL);
 
 	if (supply->priv->poll_timer_id > 0)
-		g_source_remove (supply->priv->poll_timer_id);
+		up_device_poll_remove (UP_DEVICE (supply), supply->priv->poll_timer_id);
+	sysfs_attrs_free (supply->priv->attrs);
 
 	G_OBJECT_CLASS (up_device_supply_parent_class)->finalize (object);
 }
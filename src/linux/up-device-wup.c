@@ -381,6 +381,10 @@ up_device_wup_coldplug (UpDevice *device)
 	/* hardcode true, as we'll retry later if busy */
 	ret = TRUE;
 
+	/* set up a poll */
+	wup->priv->poll_timer_id = up_device_poll_add (UP_DEVICE (wup), UP_DEVICE_WUP_REFRESH_TIMEOUT,
+						       (GSourceFunc) up_device_wup_poll_cb, "[UpDeviceWup] poll");
+
 out:
 	return ret;
 }
@@ -430,11 +434,7 @@ up_device_wup_init (UpDeviceWup *wup)
 {
 	wup->priv = UP_DEVICE_WUP_GET_PRIVATE (wup);
 	wup->priv->fd = -1;
-	wup->priv->poll_timer_id = g_timeout_add_seconds (UP_DEVICE_WUP_REFRESH_TIMEOUT,
-							  (GSourceFunc) up_device_wup_poll_cb, wup);
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (wup->priv->poll_timer_id, "[UpDeviceWup] poll");
-#endif
+	wup->priv->poll_timer_id = 0;
 }
 
 /**
@@ -454,7 +454,7 @@ up_device_wup_finalize (GObject *object)
 	if (wup->priv->fd > 0)
 		close (wup->priv->fd);
 	if (wup->priv->poll_timer_id > 0)
-		g_source_remove (wup->priv->poll_timer_id);
+		up_device_poll_remove (UP_DEVICE (wup), wup->priv->poll_timer_id);
 
 	G_OBJECT_CLASS (up_device_wup_parent_class)->finalize (object);
 }
@@ -38,6 +38,7 @@
 #include "up-device-list.h"
 #include "up-device.h"
 #include "up-backend.h"
+#include "up-history.h"
 #include "up-daemon.h"
 
 #include "up-daemon-glue.h"
@@ -85,12 +86,19 @@ struct UpDaemonPrivate
 	gboolean		 hibernate_has_encrypted_swap;
 	gboolean		 during_coldplug;
 	gboolean		 sent_sleeping_signal;
+	UpPoll			*poll;
 	guint			 battery_poll_id;
 	guint			 battery_poll_count;
 	GTimer			*about_to_sleep_timer;
 	guint			 about_to_sleep_id;
 	guint			 conf_sleep_timeout;
 	gboolean		 conf_allow_hibernate_encrypted_swap;
+	guint			 conf_history_raw_age;
+	guint			 conf_history_minute_age;
+	guint			 conf_history_hour_age;
+	guint			 conf_history_capacity_age;
+	guint			 conf_history_journal_interval;
+	guint			 conf_history_memory_budget;
 };
 
 static void	up_daemon_finalize		(GObject	*object);
@@ -733,6 +741,32 @@ out:
 	return ret;
 }
 
+/**
+ * up_daemon_get_history_retention:
+ *
+ * Gets how long device history is kept in each tier, in seconds.
+ **/
+void
+up_daemon_get_history_retention (UpDaemon *daemon, guint *raw_age, guint *minute_age,
+				 guint *hour_age, guint *capacity_age)
+{
+	*raw_age = daemon->priv->conf_history_raw_age;
+	*minute_age = daemon->priv->conf_history_minute_age;
+	*hour_age = daemon->priv->conf_history_hour_age;
+	*capacity_age = daemon->priv->conf_history_capacity_age;
+}
+
+/**
+ * up_daemon_get_history_journal_interval:
+ *
+ * Gets how often the device history journal is synced, in seconds.
+ **/
+guint
+up_daemon_get_history_journal_interval (UpDaemon *daemon)
+{
+	return daemon->priv->conf_history_journal_interval;
+}
+
 /**
  * up_daemon_get_device_list:
  **/
@@ -742,6 +776,17 @@ up_daemon_get_device_list (UpDaemon *daemon)
 	return g_object_ref (daemon->priv->power_devices);
 }
 
+/**
+ * up_daemon_get_poll:
+ *
+ * Returns the scheduler all the device polls share.
+ **/
+UpPoll *
+up_daemon_get_poll (UpDaemon *daemon)
+{
+	return g_object_ref (daemon->priv->poll);
+}
+
 /**
  * up_daemon_set_lid_is_closed:
  **/
@@ -825,11 +870,9 @@ up_daemon_poll_battery_devices_for_a_little_bit (UpDaemon *daemon)
 	if (priv->battery_poll_id != 0)
 		return;
 	priv->battery_poll_id =
-		g_timeout_add_seconds (UP_DAEMON_ON_BATTERY_REFRESH_DEVICES_DELAY,
-				       (GSourceFunc) up_daemon_refresh_battery_devices_cb, daemon);
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (priv->battery_poll_id, "[UpDaemon] poll batteries for AC event");
-#endif
+		up_poll_add (priv->poll, UP_DAEMON_ON_BATTERY_REFRESH_DEVICES_DELAY, 0,
+			     (GSourceFunc) up_daemon_refresh_battery_devices_cb, daemon,
+			     "[UpDaemon] poll batteries for AC event");
 }
 
 /**
@@ -998,6 +1041,7 @@ up_daemon_init (UpDaemon *daemon)
 	daemon->priv->kernel_can_hibernate = FALSE;
 	daemon->priv->hibernate_has_encrypted_swap = FALSE;
 	daemon->priv->power_devices = up_device_list_new ();
+	daemon->priv->poll = up_poll_new ();
 	daemon->priv->on_battery = FALSE;
 	daemon->priv->on_low_battery = FALSE;
 	daemon->priv->during_coldplug = FALSE;
@@ -1007,6 +1051,12 @@ up_daemon_init (UpDaemon *daemon)
 	daemon->priv->about_to_sleep_id = 0;
 	daemon->priv->conf_sleep_timeout = 1000;
 	daemon->priv->conf_allow_hibernate_encrypted_swap = FALSE;
+	daemon->priv->conf_history_raw_age = UP_HISTORY_RAW_AGE_DEFAULT;
+	daemon->priv->conf_history_minute_age = UP_HISTORY_MINUTE_AGE_DEFAULT;
+	daemon->priv->conf_history_hour_age = UP_HISTORY_HOUR_AGE_DEFAULT;
+	daemon->priv->conf_history_capacity_age = UP_HISTORY_CAPACITY_AGE_DEFAULT;
+	daemon->priv->conf_history_journal_interval = UP_HISTORY_JOURNAL_INTERVAL_DEFAULT;
+	daemon->priv->conf_history_memory_budget = UP_HISTORY_MEMORY_BUDGET_DEFAULT;
 
 	/* load some values from the config file */
 	file = g_key_file_new ();
@@ -1016,12 +1066,33 @@ up_daemon_init (UpDaemon *daemon)
 			g_key_file_get_integer (file, "UPower", "SleepTimeout", NULL);
 		daemon->priv->conf_allow_hibernate_encrypted_swap =
 			g_key_file_get_boolean (file, "UPower", "AllowHibernateEncryptedSwap", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryRawRetention", NULL))
+			daemon->priv->conf_history_raw_age =
+				g_key_file_get_integer (file, "UPower", "HistoryRawRetention", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryMinuteRetention", NULL))
+			daemon->priv->conf_history_minute_age =
+				g_key_file_get_integer (file, "UPower", "HistoryMinuteRetention", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryHourRetention", NULL))
+			daemon->priv->conf_history_hour_age =
+				g_key_file_get_integer (file, "UPower", "HistoryHourRetention", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryCapacityRetention", NULL))
+			daemon->priv->conf_history_capacity_age =
+				g_key_file_get_integer (file, "UPower", "HistoryCapacityRetention", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryJournalInterval", NULL))
+			daemon->priv->conf_history_journal_interval =
+				g_key_file_get_integer (file, "UPower", "HistoryJournalInterval", NULL);
+		if (g_key_file_has_key (file, "UPower", "HistoryMemoryBudget", NULL))
+			daemon->priv->conf_history_memory_budget =
+				g_key_file_get_integer (file, "UPower", "HistoryMemoryBudget", NULL);
 	} else {
 		egg_warning ("failed to load config file: %s", error->message);
 		g_error_free (error);
 	}
 	g_key_file_free (file);
 
+	/* the history of all the devices shares this */
+	up_history_set_memory_budget (daemon->priv->conf_history_memory_budget);
+
 	daemon->priv->backend = up_backend_new ();
 	g_signal_connect (daemon->priv->backend, "device-added",
 			  G_CALLBACK (up_daemon_device_added_cb), daemon);
@@ -1270,7 +1341,8 @@ up_daemon_finalize (GObject *object)
 	UpDaemonPrivate *priv = daemon->priv;
 
 	if (priv->battery_poll_id != 0)
-		g_source_remove (priv->battery_poll_id);
+		up_poll_remove (priv->poll, priv->battery_poll_id);
+	g_object_unref (priv->poll);
 
 	if (priv->proxy != NULL)
 		g_object_unref (priv->proxy);
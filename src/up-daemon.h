@@ -27,6 +27,7 @@
 
 #include "up-types.h"
 #include "up-device-list.h"
+#include "up-poll.h"
 
 G_BEGIN_DECLS
 
@@ -72,6 +73,13 @@ void		 up_daemon_test		(gpointer	 user_data);
 guint		 up_daemon_get_number_devices_of_type (UpDaemon	*daemon,
 						 UpDeviceKind		 type);
 UpDeviceList	*up_daemon_get_device_list	(UpDaemon		*daemon);
+UpPoll		*up_daemon_get_poll		(UpDaemon		*daemon);
+void		 up_daemon_get_history_retention (UpDaemon		*daemon,
+						 guint			*raw_age,
+						 guint			*minute_age,
+						 guint			*hour_age,
+						 guint			*capacity_age);
+guint		 up_daemon_get_history_journal_interval (UpDaemon	*daemon);
 gboolean	 up_daemon_startup		(UpDaemon		*daemon);
 void		 up_daemon_set_lid_is_closed	(UpDaemon		*daemon,
 						 gboolean		 lid_is_closed);
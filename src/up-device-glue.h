@@ -103,6 +103,102 @@ dbus_glib_marshal_up_device_VOID__STRING_UINT_UINT_POINTER (GClosure     *closur
 }
 #define dbus_glib_marshal_up_device_NONE__STRING_UINT_UINT_POINTER	dbus_glib_marshal_up_device_VOID__STRING_UINT_UINT_POINTER
 
+/* NONE:STRING,UINT,UINT,STRING,POINTER */
+extern void dbus_glib_marshal_up_device_VOID__STRING_UINT_UINT_STRING_POINTER (GClosure     *closure,
+                                                                               GValue       *return_value,
+                                                                               guint         n_param_values,
+                                                                               const GValue *param_values,
+                                                                               gpointer      invocation_hint,
+                                                                               gpointer      marshal_data);
+void
+dbus_glib_marshal_up_device_VOID__STRING_UINT_UINT_STRING_POINTER (GClosure     *closure,
+                                                                   GValue       *return_value G_GNUC_UNUSED,
+                                                                   guint         n_param_values,
+                                                                   const GValue *param_values,
+                                                                   gpointer      invocation_hint G_GNUC_UNUSED,
+                                                                   gpointer      marshal_data)
+{
+  typedef void (*GMarshalFunc_VOID__STRING_UINT_UINT_STRING_POINTER) (gpointer     data1,
+                                                                      gpointer     arg_1,
+                                                                      guint        arg_2,
+                                                                      guint        arg_3,
+                                                                      gpointer     arg_4,
+                                                                      gpointer     arg_5,
+                                                                      gpointer     data2);
+  register GMarshalFunc_VOID__STRING_UINT_UINT_STRING_POINTER callback;
+  register GCClosure *cc = (GCClosure*) closure;
+  register gpointer data1, data2;
+
+  g_return_if_fail (n_param_values == 6);
+
+  if (G_CCLOSURE_SWAP_DATA (closure))
+    {
+      data1 = closure->data;
+      data2 = g_value_peek_pointer (param_values + 0);
+    }
+  else
+    {
+      data1 = g_value_peek_pointer (param_values + 0);
+      data2 = closure->data;
+    }
+  callback = (GMarshalFunc_VOID__STRING_UINT_UINT_STRING_POINTER) (marshal_data ? marshal_data : cc->callback);
+
+  callback (data1,
+            g_marshal_value_peek_string (param_values + 1),
+            g_marshal_value_peek_uint (param_values + 2),
+            g_marshal_value_peek_uint (param_values + 3),
+            g_marshal_value_peek_string (param_values + 4),
+            g_marshal_value_peek_pointer (param_values + 5),
+            data2);
+}
+#define dbus_glib_marshal_up_device_NONE__STRING_UINT_UINT_STRING_POINTER	dbus_glib_marshal_up_device_VOID__STRING_UINT_UINT_STRING_POINTER
+
+/* NONE:STRING,UINT,POINTER */
+extern void dbus_glib_marshal_up_device_VOID__STRING_UINT_POINTER (GClosure     *closure,
+                                                                   GValue       *return_value,
+                                                                   guint         n_param_values,
+                                                                   const GValue *param_values,
+                                                                   gpointer      invocation_hint,
+                                                                   gpointer      marshal_data);
+void
+dbus_glib_marshal_up_device_VOID__STRING_UINT_POINTER (GClosure     *closure,
+                                                       GValue       *return_value G_GNUC_UNUSED,
+                                                       guint         n_param_values,
+                                                       const GValue *param_values,
+                                                       gpointer      invocation_hint G_GNUC_UNUSED,
+                                                       gpointer      marshal_data)
+{
+  typedef void (*GMarshalFunc_VOID__STRING_UINT_POINTER) (gpointer     data1,
+                                                          gpointer     arg_1,
+                                                          guint        arg_2,
+                                                          gpointer     arg_3,
+                                                          gpointer     data2);
+  register GMarshalFunc_VOID__STRING_UINT_POINTER callback;
+  register GCClosure *cc = (GCClosure*) closure;
+  register gpointer data1, data2;
+
+  g_return_if_fail (n_param_values == 4);
+
+  if (G_CCLOSURE_SWAP_DATA (closure))
+    {
+      data1 = closure->data;
+      data2 = g_value_peek_pointer (param_values + 0);
+    }
+  else
+    {
+      data1 = g_value_peek_pointer (param_values + 0);
+      data2 = closure->data;
+    }
+  callback = (GMarshalFunc_VOID__STRING_UINT_POINTER) (marshal_data ? marshal_data : cc->callback);
+
+  callback (data1,
+            g_marshal_value_peek_string (param_values + 1),
+            g_marshal_value_peek_uint (param_values + 2),
+            g_marshal_value_peek_pointer (param_values + 3),
+            data2);
+}
+#define dbus_glib_marshal_up_device_NONE__STRING_UINT_POINTER	dbus_glib_marshal_up_device_VOID__STRING_UINT_POINTER
+
 /* NONE:STRING,POINTER */
 extern void dbus_glib_marshal_up_device_VOID__STRING_POINTER (GClosure     *closure,
                                                               GValue       *return_value,
@@ -147,6 +243,10 @@ dbus_glib_marshal_up_device_VOID__STRING_POINTER (GClosure     *closure,
 }
 #define dbus_glib_marshal_up_device_NONE__STRING_POINTER	dbus_glib_marshal_up_device_VOID__STRING_POINTER
 
+/* NONE:UINT,POINTER */
+#define dbus_glib_marshal_up_device_VOID__UINT_POINTER	g_cclosure_marshal_VOID__UINT_POINTER
+#define dbus_glib_marshal_up_device_NONE__UINT_POINTER	dbus_glib_marshal_up_device_VOID__UINT_POINTER
+
 /* NONE:POINTER */
 #define dbus_glib_marshal_up_device_VOID__POINTER	g_cclosure_marshal_VOID__POINTER
 #define dbus_glib_marshal_up_device_NONE__POINTER	dbus_glib_marshal_up_device_VOID__POINTER
@@ -159,15 +259,19 @@ G_END_DECLS
 static const DBusGMethodInfo dbus_glib_up_device_methods[] = {
   { (GCallback) up_device_refresh, dbus_glib_marshal_up_device_NONE__POINTER, 0 },
   { (GCallback) up_device_get_history, dbus_glib_marshal_up_device_NONE__STRING_UINT_UINT_POINTER, 41 },
-  { (GCallback) up_device_get_statistics, dbus_glib_marshal_up_device_NONE__STRING_POINTER, 140 },
+  { (GCallback) up_device_get_history_downsampled, dbus_glib_marshal_up_device_NONE__STRING_UINT_UINT_STRING_POINTER, 140 },
+  { (GCallback) up_device_get_history_since, dbus_glib_marshal_up_device_NONE__STRING_UINT_POINTER, 261 },
+  { (GCallback) up_device_get_cycles, dbus_glib_marshal_up_device_NONE__UINT_POINTER, 370 },
+  { (GCallback) up_device_get_statistics, dbus_glib_marshal_up_device_NONE__STRING_POINTER, 447 },
+  { (GCallback) up_device_get_statistics_binned, dbus_glib_marshal_up_device_NONE__STRING_UINT_UINT_POINTER, 520 },
 };
 
 const DBusGObjectInfo dbus_glib_up_device_object_info = {
   0,
   dbus_glib_up_device_methods,
-  3,
-"org.freedesktop.UPower.Device\0Refresh\0A\0\0org.freedesktop.UPower.Device\0GetHistory\0A\0type\0I\0s\0timespan\0I\0u\0resolution\0I\0u\0data\0O\0F\0N\0a(udu)\0\0org.freedesktop.UPower.Device\0GetStatistics\0A\0type\0I\0s\0data\0O\0F\0N\0a(dd)\0\0\0",
+  7,
+"org.freedesktop.UPower.Device\0Refresh\0A\0\0org.freedesktop.UPower.Device\0GetHistory\0A\0type\0I\0s\0timespan\0I\0u\0resolution\0I\0u\0data\0O\0F\0N\0a(udu)\0\0org.freedesktop.UPower.Device\0GetHistoryDownsampled\0A\0type\0I\0s\0timespan\0I\0u\0resolution\0I\0u\0method\0I\0s\0data\0O\0F\0N\0a(udu)\0\0org.freedesktop.UPower.Device\0GetHistorySince\0A\0type\0I\0s\0timestamp\0I\0u\0generation\0O\0F\0N\0u\0data\0O\0F\0N\0a(udu)\0\0org.freedesktop.UPower.Device\0GetCycles\0A\0timespan\0I\0u\0data\0O\0F\0N\0a(uuuddd)\0\0org.freedesktop.UPower.Device\0GetStatistics\0A\0type\0I\0s\0data\0O\0F\0N\0a(dd)\0\0org.freedesktop.UPower.Device\0GetStatisticsBinned\0A\0type\0I\0s\0bins\0I\0u\0timespan\0I\0u\0value\0O\0F\0N\0ad\0accuracy\0O\0F\0N\0ad\0\0\0",
 "org.freedesktop.UPower.Device\0Changed\0\0",
-"org.freedesktop.UPower.Device\0NativePath\0org.freedesktop.UPower.Device\0Vendor\0org.freedesktop.UPower.Device\0Model\0org.freedesktop.UPower.Device\0Serial\0org.freedesktop.UPower.Device\0UpdateTime\0org.freedesktop.UPower.Device\0Type\0org.freedesktop.UPower.Device\0PowerSupply\0org.freedesktop.UPower.Device\0HasHistory\0org.freedesktop.UPower.Device\0HasStatistics\0org.freedesktop.UPower.Device\0Online\0org.freedesktop.UPower.Device\0Energy\0org.freedesktop.UPower.Device\0EnergyEmpty\0org.freedesktop.UPower.Device\0EnergyFull\0org.freedesktop.UPower.Device\0EnergyFullDesign\0org.freedesktop.UPower.Device\0EnergyRate\0org.freedesktop.UPower.Device\0Voltage\0org.freedesktop.UPower.Device\0TimeToEmpty\0org.freedesktop.UPower.Device\0TimeToFull\0org.freedesktop.UPower.Device\0Percentage\0org.freedesktop.UPower.Device\0IsPresent\0org.freedesktop.UPower.Device\0State\0org.freedesktop.UPower.Device\0IsRechargeable\0org.freedesktop.UPower.Device\0Capacity\0org.freedesktop.UPower.Device\0Technology\0org.freedesktop.UPower.Device\0RecallNotice\0org.freedesktop.UPower.Device\0RecallVendor\0org.freedesktop.UPower.Device\0RecallUrl\0\0"
+"org.freedesktop.UPower.Device\0NativePath\0org.freedesktop.UPower.Device\0Vendor\0org.freedesktop.UPower.Device\0Model\0org.freedesktop.UPower.Device\0Serial\0org.freedesktop.UPower.Device\0UpdateTime\0org.freedesktop.UPower.Device\0Type\0org.freedesktop.UPower.Device\0PowerSupply\0org.freedesktop.UPower.Device\0HasHistory\0org.freedesktop.UPower.Device\0HasStatistics\0org.freedesktop.UPower.Device\0Online\0org.freedesktop.UPower.Device\0Energy\0org.freedesktop.UPower.Device\0EnergyEmpty\0org.freedesktop.UPower.Device\0EnergyFull\0org.freedesktop.UPower.Device\0EnergyFullDesign\0org.freedesktop.UPower.Device\0EnergyRate\0org.freedesktop.UPower.Device\0Voltage\0org.freedesktop.UPower.Device\0TimeToEmpty\0org.freedesktop.UPower.Device\0TimeToFull\0org.freedesktop.UPower.Device\0Percentage\0org.freedesktop.UPower.Device\0IsPresent\0org.freedesktop.UPower.Device\0State\0org.freedesktop.UPower.Device\0IsRechargeable\0org.freedesktop.UPower.Device\0Capacity\0org.freedesktop.UPower.Device\0Technology\0org.freedesktop.UPower.Device\0RecallNotice\0org.freedesktop.UPower.Device\0RecallVendor\0org.freedesktop.UPower.Device\0RecallUrl\0org.freedesktop.UPower.Device\0HistoryMemory\0\0"
 };
 
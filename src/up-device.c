@@ -42,6 +42,26 @@
 #include "up-marshal.h"
 #include "up-device-glue.h"
 
+/* the methods that have to wait for the history to be loaded */
+typedef enum {
+	UP_DEVICE_HISTORY_CALL_HISTORY,
+	UP_DEVICE_HISTORY_CALL_HISTORY_DOWNSAMPLED,
+	UP_DEVICE_HISTORY_CALL_HISTORY_SINCE,
+	UP_DEVICE_HISTORY_CALL_CYCLES,
+	UP_DEVICE_HISTORY_CALL_STATISTICS,
+	UP_DEVICE_HISTORY_CALL_STATISTICS_BINNED
+} UpDeviceHistoryCallKind;
+
+/* a method call that is answered once the history is loaded */
+typedef struct {
+	UpDeviceHistoryCallKind	 kind;
+	gchar			*type;
+	guint			 timespan;	/* or the timestamp for GetHistorySince */
+	guint			 resolution;
+	gchar			*method;
+	DBusGMethodInvocation	*context;
+} UpDeviceHistoryCall;
+
 struct UpDevicePrivate
 {
 	gchar			*object_path;
@@ -49,6 +69,7 @@ struct UpDevicePrivate
 	DBusGProxy		*system_bus_proxy;
 	UpDaemon		*daemon;
 	UpHistory		*history;
+	GPtrArray		*history_calls;	/* of UpDeviceHistoryCall */
 	GObject			*native;
 	gboolean		 has_ever_refresh;
 	gboolean		 during_coldplug;
@@ -114,6 +135,7 @@ enum {
 	PROP_RECALL_NOTICE,
 	PROP_RECALL_VENDOR,
 	PROP_RECALL_URL,
+	PROP_HISTORY_MEMORY,
 	PROP_LAST
 };
 
@@ -130,6 +152,8 @@ G_DEFINE_TYPE (UpDevice, up_device, G_TYPE_OBJECT)
 	G_TYPE_UINT, G_TYPE_DOUBLE, G_TYPE_UINT, G_TYPE_INVALID))
 #define UP_DBUS_STRUCT_DOUBLE_DOUBLE (dbus_g_type_get_struct ("GValueArray", \
 	G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_INVALID))
+#define UP_DBUS_STRUCT_UINT_UINT_UINT_DOUBLE_DOUBLE_DOUBLE (dbus_g_type_get_struct ("GValueArray", \
+	G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_INVALID))
 
 /**
  * up_device_error_quark:
@@ -258,6 +282,9 @@ up_device_get_property (GObject *object, guint prop_id, GValue *value, GParamSpe
 	case PROP_RECALL_URL:
 		g_value_set_string (value, device->priv->recall_url);
 		break;
+	case PROP_HISTORY_MEMORY:
+		g_value_set_uint64 (value, up_history_get_memory_usage (device->priv->history));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -519,6 +546,46 @@ up_device_get_daemon (UpDevice *device)
 	return g_object_ref (device->priv->daemon);
 }
 
+/**
+ * up_device_poll_add:
+ *
+ * Polls the device with @func every @interval seconds, using the wakeups
+ * of the daemon that are shared with all the other devices. The poll may
+ * run up to a quarter of the interval late to share one.
+ *
+ * Return value: an id for up_device_poll_remove()
+ **/
+guint
+up_device_poll_add (UpDevice *device, guint interval, GSourceFunc func, const gchar *name)
+{
+	UpPoll *poll;
+	guint id;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), 0);
+	g_return_val_if_fail (device->priv->daemon != NULL, 0);
+
+	poll = up_daemon_get_poll (device->priv->daemon);
+	id = up_poll_add (poll, interval, interval / 4, func, device, name);
+	g_object_unref (poll);
+	return id;
+}
+
+/**
+ * up_device_poll_remove:
+ **/
+void
+up_device_poll_remove (UpDevice *device, guint id)
+{
+	UpPoll *poll;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->daemon != NULL);
+
+	poll = up_daemon_get_poll (device->priv->daemon);
+	up_poll_remove (poll, id);
+	g_object_unref (poll);
+}
+
 /**
  * up_device_coldplug:
  *
@@ -531,6 +598,10 @@ up_device_coldplug (UpDevice *device, UpDaemon *daemon, GObject *native)
 	const gchar *native_path;
 	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (device);
 	gchar *id = NULL;
+	guint raw_age;
+	guint minute_age;
+	guint hour_age;
+	guint capacity_age;
 
 	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
 
@@ -572,10 +643,17 @@ up_device_coldplug (UpDevice *device, UpDaemon *daemon, GObject *native)
 		goto out;
 	}
 
-	/* get the id so we can load the old history */
+	/* get the id so we can load the old history, which is done in the
+	 * background so the other devices don't have to wait for it */
 	id = up_device_get_id (device);
-	if (id != NULL)
+	if (id != NULL) {
+		up_daemon_get_history_retention (daemon, &raw_age, &minute_age, &hour_age, &capacity_age);
+		up_history_set_retention (device->priv->history, raw_age, minute_age, hour_age, capacity_age);
+		up_history_set_journal_interval (device->priv->history,
+						 up_daemon_get_history_journal_interval (daemon));
 		up_history_set_id (device->priv->history, id);
+		up_history_set_capacity_data (device->priv->history, device->priv->capacity);
+	}
 
 out:
 	/* start signals and callbacks */
@@ -585,6 +663,75 @@ out:
 	return ret;
 }
 
+/**
+ * up_device_history_call_free:
+ **/
+static void
+up_device_history_call_free (UpDeviceHistoryCall *call)
+{
+	g_free (call->type);
+	g_free (call->method);
+	g_free (call);
+}
+
+/**
+ * up_device_history_call_queue:
+ *
+ * Holds on to a method call until the history has been read from disk.
+ **/
+static void
+up_device_history_call_queue (UpDevice *device, UpDeviceHistoryCallKind kind, const gchar *type,
+			      guint timespan, guint resolution, const gchar *method,
+			      DBusGMethodInvocation *context)
+{
+	UpDeviceHistoryCall *call;
+
+	egg_debug ("history of %s is still loading, deferring", device->priv->native_path);
+	call = g_new0 (UpDeviceHistoryCall, 1);
+	call->kind = kind;
+	call->type = g_strdup (type);
+	call->timespan = timespan;
+	call->resolution = resolution;
+	call->method = g_strdup (method);
+	call->context = context;
+	g_ptr_array_add (device->priv->history_calls, call);
+}
+
+/**
+ * up_device_history_loaded_cb:
+ **/
+static void
+up_device_history_loaded_cb (UpHistory *history, UpDevice *device)
+{
+	guint i;
+	GPtrArray *calls;
+	UpDeviceHistoryCall *call;
+
+	/* answer the calls that came in while loading */
+	calls = device->priv->history_calls;
+	device->priv->history_calls = g_ptr_array_new ();
+	for (i=0; i<calls->len; i++) {
+		call = g_ptr_array_index (calls, i);
+		if (call->kind == UP_DEVICE_HISTORY_CALL_HISTORY)
+			up_device_get_history (device, call->type, call->timespan,
+					       call->resolution, call->context);
+		else if (call->kind == UP_DEVICE_HISTORY_CALL_HISTORY_DOWNSAMPLED)
+			up_device_get_history_downsampled (device, call->type, call->timespan,
+							   call->resolution, call->method, call->context);
+		else if (call->kind == UP_DEVICE_HISTORY_CALL_HISTORY_SINCE)
+			up_device_get_history_since (device, call->type, call->timespan, call->context);
+		else if (call->kind == UP_DEVICE_HISTORY_CALL_CYCLES)
+			up_device_get_cycles (device, call->timespan, call->context);
+		else if (call->kind == UP_DEVICE_HISTORY_CALL_STATISTICS_BINNED)
+			up_device_get_statistics_binned (device, call->type, call->resolution,
+							 call->timespan, call->context);
+		else
+			up_device_get_statistics (device, call->type, call->context);
+		up_device_history_call_free (call);
+	}
+	g_ptr_array_free (calls, TRUE);
+}
+
 /**
  * up_device_get_statistics:
  **/
@@ -608,6 +755,13 @@ up_device_get_statistics (UpDevice *device, const gchar *type, DBusGMethodInvoca
 		goto out;
 	}
 
+	/* the profile is saved with the history */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_STATISTICS, type,
+					      0, 0, NULL, context);
+		goto out;
+	}
+
 	/* get the correct data */
 	if (g_strcmp0 (type, "charging") == 0)
 		array = up_history_get_profile_data (device->priv->history, TRUE);
@@ -649,6 +803,82 @@ out:
 	return TRUE;
 }
 
+/**
+ * up_device_get_statistics_binned:
+ **/
+gboolean
+up_device_get_statistics_binned (UpDevice *device, const gchar *type, guint bins, guint timespan,
+				 DBusGMethodInvocation *context)
+{
+	GError *error;
+	GArray *values = NULL;
+	GArray *accuracies = NULL;
+	gboolean charging;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type != NULL, FALSE);
+
+	/* doesn't even try to support this */
+	if (!device->priv->has_statistics) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting stats");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* worked out from the history */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_STATISTICS_BINNED, type,
+					      timespan, bins, NULL, context);
+		goto out;
+	}
+
+	if (g_strcmp0 (type, "charging") == 0) {
+		charging = TRUE;
+	} else if (g_strcmp0 (type, "discharging") == 0) {
+		charging = FALSE;
+	} else {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "type '%s' not recognised", type);
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* the bins are checked too */
+	if (!up_history_get_statistics (device->priv->history, charging, bins, timespan,
+					&values, &accuracies)) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "statistics invalid for %i bins", bins);
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* the arrays are sent as they are */
+	dbus_g_method_return (context, values, accuracies);
+out:
+	if (values != NULL)
+		g_array_unref (values);
+	if (accuracies != NULL)
+		g_array_unref (accuracies);
+	return TRUE;
+}
+
+/**
+ * up_device_history_type_from_string:
+ **/
+static UpHistoryType
+up_device_history_type_from_string (const gchar *type)
+{
+	if (g_strcmp0 (type, "rate") == 0)
+		return UP_HISTORY_TYPE_RATE;
+	if (g_strcmp0 (type, "charge") == 0)
+		return UP_HISTORY_TYPE_CHARGE;
+	if (g_strcmp0 (type, "time-full") == 0)
+		return UP_HISTORY_TYPE_TIME_FULL;
+	if (g_strcmp0 (type, "time-empty") == 0)
+		return UP_HISTORY_TYPE_TIME_EMPTY;
+	if (g_strcmp0 (type, "capacity") == 0)
+		return UP_HISTORY_TYPE_CAPACITY;
+	return UP_HISTORY_TYPE_UNKNOWN;
+}
+
 /**
  * up_device_get_history:
  **/
@@ -661,7 +891,9 @@ up_device_get_history (UpDevice *device, const gchar *type_string, guint timespa
 	UpHistoryItem *item;
 	GValue *value;
 	guint i;
-	UpHistoryType type = UP_HISTORY_TYPE_UNKNOWN;
+	guint hits;
+	guint misses;
+	UpHistoryType type;
 
 	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
 	g_return_val_if_fail (type_string != NULL, FALSE);
@@ -673,19 +905,22 @@ up_device_get_history (UpDevice *device, const gchar *type_string, guint timespa
 		goto out;
 	}
 
+	/* answer once the history has been read from disk */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_HISTORY, type_string,
+					      timespan, resolution, NULL, context);
+		goto out;
+	}
+
 	/* get the correct data */
-	if (g_strcmp0 (type_string, "rate") == 0)
-		type = UP_HISTORY_TYPE_RATE;
-	else if (g_strcmp0 (type_string, "charge") == 0)
-		type = UP_HISTORY_TYPE_CHARGE;
-	else if (g_strcmp0 (type_string, "time-full") == 0)
-		type = UP_HISTORY_TYPE_TIME_FULL;
-	else if (g_strcmp0 (type_string, "time-empty") == 0)
-		type = UP_HISTORY_TYPE_TIME_EMPTY;
+	type = up_device_history_type_from_string (type_string);
 
 	/* something recognised */
-	if (type != UP_HISTORY_TYPE_UNKNOWN)
+	if (type != UP_HISTORY_TYPE_UNKNOWN) {
 		array = up_history_get_data (device->priv->history, type, timespan, resolution);
+		up_history_get_cache_stats (device->priv->history, &hits, &misses);
+		egg_debug ("history cache has had %i hits and %i misses", hits, misses);
+	}
 
 	/* maybe the device doesn't have any history */
 	if (array == NULL) {
@@ -716,6 +951,221 @@ out:
 	return TRUE;
 }
 
+/**
+ * up_device_get_history_downsampled:
+ **/
+gboolean
+up_device_get_history_downsampled (UpDevice *device, const gchar *type_string, guint timespan,
+				   guint resolution, const gchar *method_string, DBusGMethodInvocation *context)
+{
+	GError *error;
+	GArray *points = NULL;
+	GPtrArray *complex;
+	const UpHistoryPoint *point;
+	GValue *value;
+	guint i;
+	UpHistoryType type;
+	UpHistoryDownsample method = UP_HISTORY_DOWNSAMPLE_UNKNOWN;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type_string != NULL, FALSE);
+	g_return_val_if_fail (method_string != NULL, FALSE);
+
+	/* doesn't even try to support this */
+	if (!device->priv->has_history) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* answer once the history has been read from disk */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_HISTORY_DOWNSAMPLED, type_string,
+					      timespan, resolution, method_string, context);
+		goto out;
+	}
+
+	if (g_strcmp0 (method_string, "average") == 0)
+		method = UP_HISTORY_DOWNSAMPLE_AVERAGE;
+	else if (g_strcmp0 (method_string, "lttb") == 0)
+		method = UP_HISTORY_DOWNSAMPLE_LTTB;
+	else if (g_strcmp0 (method_string, "minmax") == 0)
+		method = UP_HISTORY_DOWNSAMPLE_MINMAX;
+	if (method == UP_HISTORY_DOWNSAMPLE_UNKNOWN) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "method '%s' not recognised", method_string);
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* get the correct data */
+	type = up_device_history_type_from_string (type_string);
+	if (type != UP_HISTORY_TYPE_UNKNOWN)
+		points = up_history_get_data_downsampled (device->priv->history, type, timespan, resolution, method);
+
+	/* maybe the device doesn't have any history */
+	if (points == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device has no history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* copy data to dbus struct */
+	complex = g_ptr_array_sized_new (points->len);
+	for (i=0; i<points->len; i++) {
+		point = &g_array_index (points, UpHistoryPoint, i);
+		value = g_new0 (GValue, 1);
+		g_value_init (value, UP_DBUS_STRUCT_UINT_DOUBLE_UINT);
+		g_value_take_boxed (value, dbus_g_type_specialized_construct (UP_DBUS_STRUCT_UINT_DOUBLE_UINT));
+		dbus_g_type_struct_set (value,
+					0, point->time,
+					1, point->value,
+					2, point->state, -1);
+		g_ptr_array_add (complex, g_value_get_boxed (value));
+		g_free (value);
+	}
+
+	dbus_g_method_return (context, complex);
+	g_ptr_array_foreach (complex, (GFunc) g_value_array_free, NULL);
+	g_ptr_array_free (complex, TRUE);
+out:
+	if (points != NULL)
+		g_array_unref (points);
+	return TRUE;
+}
+
+/**
+ * up_device_get_history_since:
+ **/
+gboolean
+up_device_get_history_since (UpDevice *device, const gchar *type_string, guint timestamp,
+			     DBusGMethodInvocation *context)
+{
+	GError *error;
+	GArray *points = NULL;
+	GPtrArray *complex;
+	const UpHistoryPoint *point;
+	GValue *value;
+	guint i;
+	guint generation = 0;
+	UpHistoryType type;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type_string != NULL, FALSE);
+
+	/* doesn't even try to support this */
+	if (!device->priv->has_history) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* answer once the history has been read from disk */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_HISTORY_SINCE, type_string,
+					      timestamp, 0, NULL, context);
+		goto out;
+	}
+
+	/* get the correct data */
+	type = up_device_history_type_from_string (type_string);
+	if (type != UP_HISTORY_TYPE_UNKNOWN)
+		points = up_history_get_data_since (device->priv->history, type, timestamp, &generation);
+
+	/* maybe the device doesn't have any history */
+	if (points == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device has no history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* copy data to dbus struct */
+	complex = g_ptr_array_sized_new (points->len);
+	for (i=0; i<points->len; i++) {
+		point = &g_array_index (points, UpHistoryPoint, i);
+		value = g_new0 (GValue, 1);
+		g_value_init (value, UP_DBUS_STRUCT_UINT_DOUBLE_UINT);
+		g_value_take_boxed (value, dbus_g_type_specialized_construct (UP_DBUS_STRUCT_UINT_DOUBLE_UINT));
+		dbus_g_type_struct_set (value,
+					0, point->time,
+					1, point->value,
+					2, point->state, -1);
+		g_ptr_array_add (complex, g_value_get_boxed (value));
+		g_free (value);
+	}
+
+	dbus_g_method_return (context, generation, complex);
+	g_ptr_array_foreach (complex, (GFunc) g_value_array_free, NULL);
+	g_ptr_array_free (complex, TRUE);
+out:
+	if (points != NULL)
+		g_array_unref (points);
+	return TRUE;
+}
+
+/**
+ * up_device_get_cycles:
+ **/
+gboolean
+up_device_get_cycles (UpDevice *device, guint timespan, DBusGMethodInvocation *context)
+{
+	GError *error;
+	GArray *cycles = NULL;
+	GPtrArray *complex;
+	const UpHistoryCycle *cycle;
+	GValue *value;
+	guint i;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+
+	/* doesn't even try to support this */
+	if (!device->priv->has_history) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* the cycles are saved with the history */
+	if (up_history_is_loading (device->priv->history)) {
+		up_device_history_call_queue (device, UP_DEVICE_HISTORY_CALL_CYCLES, NULL,
+					      timespan, 0, NULL, context);
+		goto out;
+	}
+
+	/* maybe the device doesn't have any history */
+	cycles = up_history_get_cycles (device->priv->history, timespan);
+	if (cycles == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device has no history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* copy data to dbus struct */
+	complex = g_ptr_array_sized_new (cycles->len);
+	for (i=0; i<cycles->len; i++) {
+		cycle = &g_array_index (cycles, UpHistoryCycle, i);
+		value = g_new0 (GValue, 1);
+		g_value_init (value, UP_DBUS_STRUCT_UINT_UINT_UINT_DOUBLE_DOUBLE_DOUBLE);
+		g_value_take_boxed (value, dbus_g_type_specialized_construct (UP_DBUS_STRUCT_UINT_UINT_UINT_DOUBLE_DOUBLE_DOUBLE));
+		dbus_g_type_struct_set (value,
+					0, cycle->time_start,
+					1, cycle->time_end,
+					2, cycle->state,
+					3, cycle->percentage_start,
+					4, cycle->percentage_end,
+					5, cycle->energy, -1);
+		g_ptr_array_add (complex, g_value_get_boxed (value));
+		g_free (value);
+	}
+
+	dbus_g_method_return (context, complex);
+	g_ptr_array_foreach (complex, (GFunc) g_value_array_free, NULL);
+	g_ptr_array_free (complex, TRUE);
+out:
+	if (cycles != NULL)
+		g_array_unref (cycles);
+	return TRUE;
+}
+
 /**
  * up_device_refresh_internal:
  *
@@ -858,6 +1308,7 @@ up_device_perhaps_changed_cb (GObject *object, GParamSpec *pspec, UpDevice *devi
 	up_history_set_rate_data (device->priv->history, device->priv->energy_rate);
 	up_history_set_time_full_data (device->priv->history, device->priv->time_to_full);
 	up_history_set_time_empty_data (device->priv->history, device->priv->time_to_empty);
+	up_history_set_capacity_data (device->priv->history, device->priv->capacity);
 
 	/*  The order here matters; we want Device::Changed() before
 	 *  the DeviceChanged() signal on the main object */
@@ -882,6 +1333,8 @@ up_device_init (UpDevice *device)
 	device->priv->has_ever_refresh = FALSE;
 	device->priv->during_coldplug = FALSE;
 	device->priv->history = up_history_new ();
+	device->priv->history_calls = g_ptr_array_new ();
+	g_signal_connect (device->priv->history, "loaded", G_CALLBACK (up_device_history_loaded_cb), device);
 
 	device->priv->system_bus_connection = dbus_g_bus_get (DBUS_BUS_SYSTEM, &error);
 	if (device->priv->system_bus_connection == NULL) {
@@ -898,6 +1351,9 @@ static void
 up_device_finalize (GObject *object)
 {
 	UpDevice *device;
+	UpDeviceHistoryCall *call;
+	GError *error;
+	guint i;
 
 	g_return_if_fail (object != NULL);
 	g_return_if_fail (UP_IS_DEVICE (object));
@@ -908,6 +1364,17 @@ up_device_finalize (GObject *object)
 		g_object_unref (device->priv->native);
 	if (device->priv->daemon != NULL)
 		g_object_unref (device->priv->daemon);
+
+	/* don't leave callers waiting for history that will never load */
+	for (i=0; i<device->priv->history_calls->len; i++) {
+		call = g_ptr_array_index (device->priv->history_calls, i);
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device was removed");
+		dbus_g_method_return_error (call->context, error);
+		g_error_free (error);
+		up_device_history_call_free (call);
+	}
+	g_ptr_array_free (device->priv->history_calls, TRUE);
+	g_signal_handlers_disconnect_by_func (device->priv->history, G_CALLBACK (up_device_history_loaded_cb), device);
 	g_object_unref (device->priv->history);
 	g_free (device->priv->object_path);
 	g_free (device->priv->vendor);
@@ -1182,6 +1649,15 @@ up_device_class_init (UpDeviceClass *klass)
 							      NULL, NULL,
 							      NULL,
 							      G_PARAM_READWRITE));
+	/**
+	 * UpDevice:history-memory:
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_HISTORY_MEMORY,
+					 g_param_spec_uint64 ("history-memory",
+							      NULL, NULL,
+							      0, G_MAXUINT64, 0,
+							      G_PARAM_READABLE));
 
 	dbus_g_error_domain_register (UP_DEVICE_ERROR, NULL, UP_DEVICE_TYPE_ERROR);
 }
@@ -89,6 +89,12 @@ gboolean	 up_device_get_low_battery	(UpDevice	*device,
 gboolean	 up_device_get_online		(UpDevice	*device,
 						 gboolean	*online);
 gboolean	 up_device_refresh_internal	(UpDevice	*device);
+guint		 up_device_poll_add		(UpDevice	*device,
+						 guint		 interval,
+						 GSourceFunc	 func,
+						 const gchar	*name);
+void		 up_device_poll_remove		(UpDevice	*device,
+						 guint		 id);
 
 /* exported methods */
 gboolean	 up_device_refresh		(UpDevice		*device,
@@ -98,9 +104,27 @@ gboolean	 up_device_get_history		(UpDevice		*device,
 						 guint			 timespan,
 						 guint			 resolution,
 						 DBusGMethodInvocation	*context);
+gboolean	 up_device_get_history_downsampled (UpDevice		*device,
+						 const gchar		*type,
+						 guint			 timespan,
+						 guint			 resolution,
+						 const gchar		*method,
+						 DBusGMethodInvocation	*context);
+gboolean	 up_device_get_history_since	(UpDevice		*device,
+						 const gchar		*type,
+						 guint			 timestamp,
+						 DBusGMethodInvocation	*context);
+gboolean	 up_device_get_cycles		(UpDevice		*device,
+						 guint			 timespan,
+						 DBusGMethodInvocation	*context);
 gboolean	 up_device_get_statistics	(UpDevice		*device,
 						 const gchar		*type,
 						 DBusGMethodInvocation	*context);
+gboolean	 up_device_get_statistics_binned (UpDevice		*device,
+						 const gchar		*type,
+						 guint			 bins,
+						 guint			 timespan,
+						 DBusGMethodInvocation	*context);
 
 G_END_DECLS
 
@@ -23,8 +23,13 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
 #include "egg-debug.h"
@@ -37,638 +42,5334 @@ static void	up_history_finalize	(GObject		*object);
 #define UP_HISTORY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_HISTORY, UpHistoryPrivate))
 
 #define UP_HISTORY_SAVE_INTERVAL	10*60 /* seconds */
+#define UP_HISTORY_SAVE_INTERVAL_JOURNAL	60*60 /* seconds, when the samples are also journalled */
+#define UP_HISTORY_COMPACT_INTERVAL	144 /* appends, about a day of saves */
+#define UP_HISTORY_STORE_MIN_SIZE	64 /* samples */
+#define UP_HISTORY_EXPIRE_SLACK		8 /* expire in batches of 1/8 of the window */
+#define UP_HISTORY_WRITER_QUEUE_MAX	64 /* jobs */
+#define UP_HISTORY_CACHE_SIZE		8 /* results of up_history_get_data() */
+#define UP_HISTORY_LOAD_THREADS		4 /* devices loaded at the same time */
+#define UP_HISTORY_EVICT_FRACTION	4 /* evict 1/4 of the time range of a tier at a time */
+#define UP_HISTORY_CLOCK_SLACK		2 /* seconds the clocks can drift apart before the wall clock is followed */
+
+/* the on-disk format is a fixed header followed by blocks of compressed
+ * samples:
+ *
+ *  header:    magic[8] | version (u32) | record size (u32)
+ *  block:     payload size (u32) | samples (u32) | checksum (u32) | payload
+ *
+ * All fields are little endian, and the checksum covers the rest of the
+ * block so that a torn or corrupted tail can be dropped on load. The record
+ * size is only used to tell raw and aggregate files apart, and version 1
+ * files, where the blocks are replaced by fixed-size records, can still be
+ * read:
+ *
+ *  raw:       time (u32) | state (u32) | value (f64) | checksum (u32)
+ *  aggregate: time (u32) | state (u32) | mean (f64) | min (f64) | max (f64) |
+ *             count (u32) | checksum (u32)
+ *
+ * The payload is a bit stream, most significant bit first, in the style of
+ * the Gorilla time series encoding:
+ *
+ *  - the states as a varint number of runs, then each run as the state
+ *    (8 bits) and a varint length
+ *  - then for each sample the time and the metrics it has, and for each of
+ *    those the value, and for aggregates the min, max and count, each coded
+ *    against the previous sample with that metric, or zero for the first one
+ *  - the time as the change from the previous interval: '0' for none,
+ *    '10', '110' and '1110' with 7, 9 and 12 bits, or '1111' and the
+ *    time itself in 32 bits
+ *  - the metrics as '0' if they are the same, or '1' and a bit for each
+ *    history type
+ *  - doubles XORed with the previous one: '0' if it is the same, '10' and
+ *    the meaningful bits if they fit in the previous window, or '11', 5 bits
+ *    of leading zeros, 6 bits of length and the meaningful bits
+ *  - the count as '0' if it is the same, or '1' and 32 bits
+ *
+ * Regular samples of a slowly changing value take a few bits each. Version
+ * 3 files are from before the capacity, and have one bit less for the
+ * metrics. Version 2 files, which have one history type per file and so no
+ * metric bits, are merged into the shared samples when they are loaded. */
+#define UP_HISTORY_FILE_MAGIC		"UPHISTRY"
+#define UP_HISTORY_FILE_VERSION		4
+#define UP_HISTORY_FILE_VERSION_SHARED	3
+#define UP_HISTORY_FILE_VERSION_BLOCKS	2
+#define UP_HISTORY_FILE_VERSION_RECORDS	1
+#define UP_HISTORY_FILE_HEADER_SIZE	16
+#define UP_HISTORY_FILE_BLOCK_SIZE	12
+#define UP_HISTORY_FILE_RECORD_SIZE	20
+#define UP_HISTORY_FILE_AGGREGATE_SIZE	40
+#define UP_HISTORY_SEGMENT_SIZE		512 /* samples in each block */
+
+/* the profile is saved separately, as a header with the number of bins,
+ * then the sums (f64) and counts (u32) of each bin for discharging and
+ * charging, then the scan state and a checksum of everything before it */
+#define UP_HISTORY_PROFILE_MAGIC	"UPPROFIL"
+#define UP_HISTORY_PROFILE_VERSION	1
+#define UP_HISTORY_PROFILE_BINS		101 /* one for each percent */
+#define UP_HISTORY_STATISTICS_BINS_MAX	10000 /* for up_history_get_statistics() */
+#define UP_HISTORY_PROFILE_SIZE		(UP_HISTORY_FILE_HEADER_SIZE + \
+					 2 * UP_HISTORY_PROFILE_BINS * 12 + 32)
+
+/* the cycles are saved separately too, as a header with the number of
+ * cycles, then the times and state (u32) and the percentages and energy
+ * (f64) of each, then the scan state and a checksum of everything before it */
+#define UP_HISTORY_CYCLES_MAGIC		"UPCYCLES"
+#define UP_HISTORY_CYCLES_VERSION	1
+#define UP_HISTORY_CYCLES_RECORD_SIZE	36
+#define UP_HISTORY_CYCLES_TRAILER_SIZE	32
+
+/* a block of samples in the compressed encoding, which never changes once
+ * created and so can be shared with the writer thread */
+typedef struct {
+	gint			 ref_count;
+	guint8			*data;
+	gsize			 length;
+	guint			 count;
+	guint32			 time_first;
+	guint32			 time_last;
+} UpHistorySegment;
+
+/* one column of values for each UpHistoryType */
+#define UP_HISTORY_METRICS		UP_HISTORY_TYPE_UNKNOWN
+
+/* the capacity only changes as the battery wears, so it is sampled once a
+ * day into its own store rather than with the other history types */
+#define UP_HISTORY_CAPACITY_INTERVAL	(24 * 60 * 60)
+
+/* samples are kept as contiguous columns rather than as an array of
+ * UpHistoryItem objects, which are only created when returning data.
+ * Each sample has a time and state shared by all the history types, and
+ * a bit in present for each type that has a value, so the values that
+ * arrive together only take one timestamp. Aggregate stores also keep the
+ * range and number of samples that were rolled up into each entry, and
+ * value is then the mean. The columns of a history type are only
+ * allocated once the store has a value for it.
+ *
+ * The aggregate tiers keep months of data, so their older samples are
+ * frozen into compressed segments, and the columns only hold the samples
+ * after the first cold_len. */
+typedef struct {
+	guint32			*time;
+	guint8			*state;
+	guint8			*present;	/* a bit for each UpHistoryType */
+	gdouble			*value[UP_HISTORY_METRICS];
+	gdouble			*min[UP_HISTORY_METRICS];
+	gdouble			*max[UP_HISTORY_METRICS];
+	guint32			*count[UP_HISTORY_METRICS];
+	gboolean		 aggregate;
+	guint			 len;
+	guint			 size;
+	GPtrArray		*segments;	/* of UpHistorySegment, oldest first */
+	guint			 cold_len;	/* samples in the segments */
+	gsize			 memory;	/* see up_history_store_get_memory() */
+} UpHistoryStore;
+
+/* raw samples are rolled up into per-minute and then per-hour aggregates
+ * as they age out of each tier */
+typedef enum {
+	UP_HISTORY_TIER_RAW,
+	UP_HISTORY_TIER_MINUTE,
+	UP_HISTORY_TIER_HOUR,
+	UP_HISTORY_TIER_LAST
+} UpHistoryTier;
+
+static const gchar *up_history_tier_names[] = { NULL, "minute", "hour" };
+static const guint up_history_tier_buckets[] = { 0, 60, 60*60 };
+
+/* the files each history type was kept in before they shared samples */
+static const gchar *up_history_type_names[] = { "charge", "rate", "time-full", "time-empty" };
+#define UP_HISTORY_LEGACY_METRICS	G_N_ELEMENTS (up_history_type_names)
+
+/* the samples added since the last save are also appended to a journal,
+ * which is synced in batches and replayed on load, so that a crash only
+ * loses the samples of the last journal interval:
+ *
+ *  header:    magic[8] | version (u32) | record size (u32)
+ *  record:    time (u32) | state (u32) | metric (u32) | value (f64) | checksum (u32)
+ *
+ * The journal is emptied after each save, and the records that are already
+ * in the files are skipped on replay. */
+#define UP_HISTORY_JOURNAL_MAGIC	"UPJOURNL"
+#define UP_HISTORY_JOURNAL_VERSION	1
+#define UP_HISTORY_JOURNAL_RECORD_SIZE	24
+
+/* a range of samples in a store, which is only valid until the store changes */
+typedef struct {
+	const UpHistoryStore	*store;
+	UpHistoryType		 metric;
+	guint			 start;
+	guint			 end;
+	guint32			 expires;	/* when the first sample leaves the window */
+} UpHistoryView;
+
+/* how much of a store is already on disk */
+typedef struct {
+	guint			 saved;		/* items written to the file */
+	guint			 appends;	/* appends since the last rewrite */
+	gboolean		 compact;	/* the file must be rewritten in full */
+} UpHistoryFileState;
+
+/* a copy of the samples to be written by the writer thread, or the
+ * contents of a small file when there is no snapshot */
+typedef struct {
+	gchar			*filename;
+	UpHistoryStore		*snapshot;
+	gboolean		 rewrite;
+	gboolean		 sync;		/* the file has to be on disk when done */
+	guint8			*data;
+	gsize			 length;
+} UpHistoryWriterJob;
+
+/* files are encoded and written by a single thread so that slow storage
+ * does not hold up the main loop, and the queue is bounded so that a
+ * stalled disk cannot use unbounded memory */
+typedef struct {
+	GThread			*thread;
+	GMutex			*mutex;
+	GCond			*cond;		/* the queue or pending count changed */
+	GQueue			*queue;
+	guint			 pending;	/* jobs queued or being written */
+	GHashTable		*failed;	/* files that may now be torn */
+} UpHistoryWriter;
+
+static UpHistoryWriter *up_history_writer = NULL;
+
+/* all the tiers of the history */
+typedef struct {
+	UpHistoryStore		*tier[UP_HISTORY_TIER_LAST];
+	UpHistoryFileState	 file[UP_HISTORY_TIER_LAST];
+	UpHistoryStore		*capacity;	/* only has UP_HISTORY_TYPE_CAPACITY */
+	UpHistoryFileState	 capacity_file;
+	guint			 generation[UP_HISTORY_METRICS];	/* changed when samples are added or removed */
+	guint			 rewrites;	/* changed when samples are removed or replaced */
+	guint32			 served;	/* when up_history_get_data_since() last answered */
+} UpHistorySeries;
+
+/* a downsampled result, which is valid until the series changes or the
+ * oldest sample falls out of the window */
+typedef struct {
+	gpointer		 result;	/* see up_history_get_result() */
+	UpHistoryType		 type;
+	guint			 timespan;
+	guint			 resolution;
+	UpHistoryDownsample	 method;
+	guint			 generation;
+	guint32			 expires;
+	guint			 used;		/* for finding the least recently used */
+} UpHistoryCacheEntry;
+
+/* the running totals behind the charge and discharge profiles, which are
+ * updated as each charge sample arrives rather than by scanning the
+ * history, along with how far the scan has got */
+typedef struct {
+	gdouble			 sum[2][UP_HISTORY_PROFILE_BINS];	/* seconds, by charging */
+	guint32			 count[2][UP_HISTORY_PROFILE_BINS];
+	gboolean		 has_last;
+	UpDeviceState		 last_state;
+	gboolean		 has_old;	/* the sample the time is measured from */
+	guint32			 old_time;
+	gdouble			 old_value;
+	guint			 oldbin;
+	gboolean		 dirty;		/* changed since it was saved */
+} UpHistoryProfile;
+
+/* the runs of samples in the same state, which are extended as each sample
+ * arrives so that the charge cycles are never found by scanning the history.
+ * The energy is integrated from the rate. */
+typedef struct {
+	GArray			*list;		/* of UpHistoryCycle, oldest first */
+	gboolean		 has_rate;
+	gdouble			 rate;
+	guint32			 rate_time;
+	gboolean		 has_percentage;
+	gdouble			 percentage;
+	gboolean		 dirty;		/* changed since it was saved */
+} UpHistoryCycles;
+
+/* the history of a device being read by the load pool, which the main
+ * thread only looks at once done is set */
+typedef struct {
+	UpHistory		*history;
+	UpHistorySeries		*series;
+	UpHistoryProfile	*profile;
+	UpHistoryCycles		*cycles;
+	gboolean		 replayed;	/* the journal had samples the files did not */
+	guint32			 now;		/* when the load started */
+	gboolean		 done;
+	GSource			*idle;		/* hands the result to the main loop */
+} UpHistoryLoad;
+
+/* the samples are stamped with the wall clock, but as that can be stepped
+ * by NTP, by hand or when the RTC is reset, the time is kept from the
+ * monotonic clock from where the wall clock was when it was last followed,
+ * which is only used from the main thread */
+typedef struct {
+	gboolean		 anchored;
+	gint64			 wall;		/* microseconds */
+	gint64			 monotonic;	/* microseconds */
+} UpHistoryClock;
+
+static UpHistoryClock up_history_clock = { FALSE, 0, 0 };
+static guint32 up_history_time_fixed = 0;	/* see up_history_set_time() */
+
+/* the history of all the devices shares one memory budget, which is only
+ * used from the main thread */
+static GPtrArray *up_history_instances = NULL;
+static gsize up_history_memory_budget = 0;	/* bytes, or 0 for no limit */
+
+/* the files of the devices are parsed in parallel at coldplug */
+static GThreadPool *up_history_load_pool = NULL;
+static GMutex *up_history_load_mutex = NULL;
+static GCond *up_history_load_cond = NULL;	/* a load is done */
 
 struct UpHistoryPrivate
 {
 	gchar			*id;
+	gchar			*dir;
 	gdouble			 rate_last;
 	gint64			 time_full_last;
 	gint64			 time_empty_last;
 	gdouble			 percentage_last;
+	guint32			 capacity_time_last;
 	UpDeviceState		 state;
-	GPtrArray		*data_rate;
-	GPtrArray		*data_charge;
-	GPtrArray		*data_time_full;
-	GPtrArray		*data_time_empty;
+	UpHistorySeries		*data;
+	UpHistoryProfile	*profile;
+	UpHistoryCycles		*cycles;
+	UpHistoryCacheEntry	 cache[UP_HISTORY_CACHE_SIZE];
+	guint			 cache_used;
+	guint			 cache_hits;
+	guint			 cache_misses;
+	guint			 max_age[UP_HISTORY_TIER_LAST];
+	guint			 capacity_age;
 	guint			 save_id;
+	GByteArray		*journal;	/* records not yet committed */
+	gboolean		 journal_new;	/* the file has to be replaced */
+	guint			 journal_interval;
+	guint			 journal_id;
+	UpHistoryLoad		*load;		/* not yet loaded if set */
+	gboolean		 read_only;	/* the files are not written again */
 };
 
 enum {
 	UP_HISTORY_PROGRESS,
+	UP_HISTORY_LOADED,
 	UP_HISTORY_LAST_SIGNAL
 };
 
+static guint signals[UP_HISTORY_LAST_SIGNAL] = { 0 };
+
 G_DEFINE_TYPE (UpHistory, up_history, G_TYPE_OBJECT)
-#define UP_HISTORY_FILE_HEADER	"PackageKit Profile"
 
 /**
- * up_history_array_copy_cb:
+ * up_history_segment_ref:
  **/
-static void
-up_history_array_copy_cb (UpHistoryItem *item, GPtrArray *dest)
+static UpHistorySegment *
+up_history_segment_ref (UpHistorySegment *segment)
 {
-	g_ptr_array_add (dest, g_object_ref (item));
+	g_atomic_int_inc (&segment->ref_count);
+	return segment;
 }
 
 /**
- * up_history_array_limit_resolution:
- * @array: The data we have for a specific graph
- * @max_num: The max desired points
- *
- * We need to reduce the number of data points else the graph will take a long
- * time to plot accuracy we don't need at the larger scales.
- * This will not reduce the scale or range of the data.
- *
- *  100  +     + |  +   |  +   | +     +
- *       |  A    |      |      |
- *   80  +     + |  +   |  +   | +     +
- *       |       | B  C |      |
- *   60  +     + |  +   |  +   | +     +
- *       |       |      |      |
- *   40  +     + |  +   |  +   | + E   +
- *       |       |      |      | D
- *   20  +     + |  +   |  +   | +   F +
- *       |       |      |      |
- *    0  +-----+-----+-----+-----+-----+
- *            20    40    60    80   100
- *
- * A = 15,90
- * B = 30,70
- * C = 52,70
- * D = 80,30
- * E = 85,40
- * F = 90,20
+ * up_history_segment_unref:
  *
- * 1 = 15,90
- * 2 = 41,70
- * 3 = 85,30
+ * The writer thread may drop the last reference.
  **/
-static GPtrArray *
-up_history_array_limit_resolution (GPtrArray *array, guint max_num)
+static void
+up_history_segment_unref (UpHistorySegment *segment)
 {
-	UpHistoryItem *item;
-	UpHistoryItem *item_new;
-	gfloat division;
-	guint length;
-	gint i;
-	guint last;
-	guint first;
-	GPtrArray *new;
-	UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
-	guint64 time_s = 0;
-	gdouble value = 0;
-	guint64 count = 0;
-	guint step = 1;
-	gfloat preset;
-
-	new = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	egg_debug ("length of array (before) %i", array->len);
-
-	/* check length */
-	length = array->len;
-	if (length == 0)
-		goto out;
-	if (length < max_num) {
-		/* need to copy array */
-		g_ptr_array_foreach (array, (GFunc) up_history_array_copy_cb, new);
-		goto out;
-	}
-
-	/* last element */
-	item = (UpHistoryItem *) g_ptr_array_index (array, length-1);
-	last = up_history_item_get_time (item);
-	item = (UpHistoryItem *) g_ptr_array_index (array, 0);
-	first = up_history_item_get_time (item);
-
-	division = (first - last) / (gfloat) max_num;
-	egg_debug ("Using a x division of %f (first=%i,last=%i)", division, first, last);
-
-	/* Reduces the number of points to a pre-set level using a time
-	 * division algorithm so we don't keep diluting the previous
-	 * data with a conventional 1-in-x type algorithm. */
-	for (i=length-1; i>=0; i--) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		preset = last + (division * (gfloat) step);
-
-		/* if state changed or we went over the preset do a new point */
-		if (count > 0 &&
-		    (up_history_item_get_time (item) > preset ||
-		     up_history_item_get_state (item) != state)) {
-			item_new = up_history_item_new ();
-			up_history_item_set_time (item_new, time_s / count);
-			up_history_item_set_value (item_new, value / count);
-			up_history_item_set_state (item_new, state);
-			g_ptr_array_add (new, item_new);
+	if (!g_atomic_int_dec_and_test (&segment->ref_count))
+		return;
+	g_free (segment->data);
+	g_free (segment);
+}
 
-			step++;
-			time_s = up_history_item_get_time (item);
-			value = up_history_item_get_value (item);
-			state = up_history_item_get_state (item);
-			count = 1;
-		} else {
-			count++;
-			time_s += up_history_item_get_time (item);
-			value += up_history_item_get_value (item);
-		}
-	}
+/**
+ * up_history_segment_get_memory:
+ **/
+static gsize
+up_history_segment_get_memory (const UpHistorySegment *segment)
+{
+	return sizeof (UpHistorySegment) + segment->length;
+}
 
-	/* only add if nonzero */
-	if (count > 0) {
-		item_new = up_history_item_new ();
-		up_history_item_set_time (item_new, time_s / count);
-		up_history_item_set_value (item_new, value / count);
-		up_history_item_set_state (item_new, state);
-		g_ptr_array_add (new, item_new);
-	}
+/**
+ * up_history_store_new:
+ **/
+static UpHistoryStore *
+up_history_store_new (gboolean aggregate)
+{
+	UpHistoryStore *store;
 
-	/* check length */
-	egg_debug ("length of array (after) %i", new->len);
-out:
-	return new;
+	store = g_new0 (UpHistoryStore, 1);
+	store->aggregate = aggregate;
+	store->segments = g_ptr_array_new_with_free_func ((GDestroyNotify) up_history_segment_unref);
+	store->memory = sizeof (UpHistoryStore);
+	return store;
 }
 
 /**
- * up_history_copy_array_timespan:
+ * up_history_store_free:
  **/
-static GPtrArray *
-up_history_copy_array_timespan (const GPtrArray *array, guint timespan)
+static void
+up_history_store_free (UpHistoryStore *store)
 {
 	guint i;
-	UpHistoryItem *item;
-	GPtrArray *array_new;
-	GTimeVal timeval;
-
-	/* no data */
-	if (array->len == 0)
-		return NULL;
-
-	/* new data */
-	array_new = g_ptr_array_new ();
-	g_get_current_time (&timeval);
-	egg_debug ("limiting data to last %i seconds", timespan);
 
-	/* treat the timespan like a range, and search backwards */
-	timespan *= 0.95f;
-	for (i=array->len-1; i>0; i--) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		if (timeval.tv_sec - up_history_item_get_time (item) < timespan)
-			g_ptr_array_add (array_new, g_object_ref (item));
+	g_free (store->time);
+	g_free (store->state);
+	g_free (store->present);
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		g_free (store->value[i]);
+		g_free (store->min[i]);
+		g_free (store->max[i]);
+		g_free (store->count[i]);
 	}
+	g_ptr_array_free (store->segments, TRUE);
+	g_free (store);
+}
 
-	return array_new;
+/**
+ * up_history_store_has:
+ *
+ * Return value: %TRUE if the hot sample @i has a value for @metric
+ **/
+static gboolean
+up_history_store_has (const UpHistoryStore *store, guint i, UpHistoryType metric)
+{
+	return (store->present[i] & (1 << metric)) != 0;
 }
 
 /**
- * up_history_get_data:
+ * up_history_store_get_total:
+ *
+ * Return value: the number of samples, including the cold ones
  **/
-GPtrArray *
-up_history_get_data (UpHistory *history, UpHistoryType type, guint timespan, guint resolution)
+static guint
+up_history_store_get_total (const UpHistoryStore *store)
 {
-	GPtrArray *array;
-	GPtrArray *array_resolution;
-	const GPtrArray *array_data = NULL;
+	return store->cold_len + store->len;
+}
 
-	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+/**
+ * up_history_store_get_time_first:
+ **/
+static guint32
+up_history_store_get_time_first (const UpHistoryStore *store)
+{
+	const UpHistorySegment *segment;
 
-	if (history->priv->id == NULL)
-		return NULL;
+	if (store->segments->len > 0) {
+		segment = g_ptr_array_index (store->segments, 0);
+		return segment->time_first;
+	}
+	return store->time[0];
+}
 
-	if (type == UP_HISTORY_TYPE_CHARGE)
-		array_data = history->priv->data_charge;
-	else if (type == UP_HISTORY_TYPE_RATE)
-		array_data = history->priv->data_rate;
-	else if (type == UP_HISTORY_TYPE_TIME_FULL)
-		array_data = history->priv->data_time_full;
-	else if (type == UP_HISTORY_TYPE_TIME_EMPTY)
-		array_data = history->priv->data_time_empty;
+/**
+ * up_history_store_get_column_size:
+ *
+ * Return value: the bytes a sample takes in the columns of one history type
+ **/
+static gsize
+up_history_store_get_column_size (const UpHistoryStore *store)
+{
+	if (store->aggregate)
+		return 3 * sizeof (gdouble) + sizeof (guint32);
+	return sizeof (gdouble);
+}
 
-	/* not recognised */
-	if (array_data == NULL)
-		return NULL;
+/**
+ * up_history_store_get_row_size:
+ *
+ * Return value: the bytes a sample takes in all the allocated columns
+ **/
+static gsize
+up_history_store_get_row_size (const UpHistoryStore *store)
+{
+	guint i;
+	gsize size;
 
-	/* only return a certain time */
-	array = up_history_copy_array_timespan (array_data, timespan);
-	if (array == NULL)
-		return NULL;
+	size = sizeof (guint32) + 2 * sizeof (guint8);
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		if (store->value[i] != NULL)
+			size += up_history_store_get_column_size (store);
+	}
+	return size;
+}
 
-	/* only add a certain number of points */
-	array_resolution = up_history_array_limit_resolution (array, resolution);
-	g_ptr_array_unref (array);
+/**
+ * up_history_store_resize:
+ **/
+static void
+up_history_store_resize (UpHistoryStore *store, guint size)
+{
+	guint i;
+	gsize row;
 
-	return array_resolution;
+	row = up_history_store_get_row_size (store);
+	store->memory -= (gsize) store->size * row;
+	store->memory += (gsize) size * row;
+	store->size = size;
+	store->time = g_renew (guint32, store->time, store->size);
+	store->state = g_renew (guint8, store->state, store->size);
+	store->present = g_renew (guint8, store->present, store->size);
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		if (store->value[i] == NULL)
+			continue;
+		store->value[i] = g_renew (gdouble, store->value[i], store->size);
+		if (!store->aggregate)
+			continue;
+		store->min[i] = g_renew (gdouble, store->min[i], store->size);
+		store->max[i] = g_renew (gdouble, store->max[i], store->size);
+		store->count[i] = g_renew (guint32, store->count[i], store->size);
+	}
 }
 
 /**
- * up_history_get_profile_data:
+ * up_history_store_append:
+ *
+ * Adds a sample with no values. The columns grow geometrically, so adding
+ * a sample is amortized O(1).
+ *
+ * Return value: the index of the new sample
  **/
-GPtrArray *
-up_history_get_profile_data (UpHistory *history, gboolean charging)
+static guint
+up_history_store_append (UpHistoryStore *store, guint32 time_s, UpDeviceState state)
 {
 	guint i;
-	guint non_zero_accuracy = 0;
-	gfloat average = 0.0f;
-	guint bin;
-	guint oldbin = 999;
-	UpHistoryItem *item_last = NULL;
-	UpHistoryItem *item;
-	UpHistoryItem *item_old = NULL;
-	UpStatsItem *stats;
-	GPtrArray *array;
-	GPtrArray *data;
-	guint time_s;
-	gdouble value;
-	gdouble total_value = 0.0f;
 
-	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
-
-	/* create 100 item list and set to zero */
-	data = g_ptr_array_new ();
-	for (i=0; i<101; i++) {
-		stats = up_stats_item_new ();
-		g_ptr_array_add (data, stats);
+	if (store->len == store->size)
+		up_history_store_resize (store, MAX (store->size * 2, UP_HISTORY_STORE_MIN_SIZE));
+	store->time[store->len] = time_s;
+	store->state[store->len] = state;
+	store->present[store->len] = 0;
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		if (store->value[i] == NULL)
+			continue;
+		store->value[i][store->len] = 0.0f;
+		if (!store->aggregate)
+			continue;
+		store->min[i][store->len] = 0.0f;
+		store->max[i][store->len] = 0.0f;
+		store->count[i][store->len] = 0;
 	}
+	return store->len++;
+}
 
-	array = history->priv->data_charge;
-	for (i=0; i<array->len; i++) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		if (item_last == NULL ||
-		    up_history_item_get_state (item) != up_history_item_get_state (item_last)) {
-			item_old = NULL;
-			goto cont;
-		}
-
-		/* round to the nearest int */
-		bin = rint (up_history_item_get_value (item));
-
-		/* ensure bin is in range */
-		if (bin >= data->len)
-			bin = data->len - 1;
-
-		/* different */
-		if (oldbin != bin) {
-			oldbin = bin;
-			if (item_old != NULL) {
-				/* not enough or too much difference */
-				value = fabs (up_history_item_get_value (item) - up_history_item_get_value (item_old));
-				if (value < 0.01f) {
-					item_old = NULL;
-					goto cont;
-				}
-				if (value > 3.0f) {
-					item_old = NULL;
-					goto cont;
-				}
-
-				time_s = up_history_item_get_time (item) - up_history_item_get_time (item_old);
-				/* use the accuracy field as a counter for now */
-				if ((charging && up_history_item_get_state (item) == UP_DEVICE_STATE_CHARGING) ||
-				    (!charging && up_history_item_get_state (item) == UP_DEVICE_STATE_DISCHARGING)) {
-					stats = (UpStatsItem *) g_ptr_array_index (data, bin);
-					up_stats_item_set_value (stats, up_stats_item_get_value (stats) + time_s);
-					up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) + 1);
-				}
-			}
-			item_old = item;
-		}
-cont:
-		item_last = item;
-	}
+/**
+ * up_history_store_find_time:
+ *
+ * Samples are kept in time order, so the store can be bisected.
+ *
+ * Return value: the index of the first sample newer than @time_s
+ **/
+static guint
+up_history_store_find_time (const UpHistoryStore *store, guint32 time_s)
+{
+	guint low = 0;
+	guint high = store->len;
+	guint mid;
 
-	/* divide the value by the number of samples to make the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) != 0)
-			up_stats_item_set_value (stats, up_stats_item_get_value (stats) / up_stats_item_get_accuracy (stats));
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (store->time[mid] > time_s)
+			high = mid;
+		else
+			low = mid + 1;
 	}
+	return low;
+}
 
-	/* find non-zero accuracy values for the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0) {
-			total_value += up_stats_item_get_value (stats);
-			non_zero_accuracy++;
+/**
+ * up_history_store_set:
+ *
+ * Sets the value of @metric in the hot sample @i. A raw store only keeps
+ * the mean.
+ **/
+static void
+up_history_store_set (UpHistoryStore *store, guint i, UpHistoryType metric,
+		      gdouble mean, gdouble min, gdouble max, guint32 count)
+{
+	if (store->value[metric] == NULL) {
+		store->memory += (gsize) store->size * up_history_store_get_column_size (store);
+		store->value[metric] = g_new0 (gdouble, store->size);
+		if (store->aggregate) {
+			store->min[metric] = g_new0 (gdouble, store->size);
+			store->max[metric] = g_new0 (gdouble, store->size);
+			store->count[metric] = g_new0 (guint32, store->size);
 		}
 	}
+	store->present[i] |= 1 << metric;
+	store->value[metric][i] = mean;
+	if (!store->aggregate)
+		return;
+	store->min[metric][i] = min;
+	store->max[metric][i] = max;
+	store->count[metric][i] = count;
+}
 
-	/* average */
-	if (non_zero_accuracy != 0)
-		average = total_value / non_zero_accuracy;
-	egg_debug ("average is %f", average);
+/**
+ * up_history_store_insert:
+ *
+ * Adds a sample with no values before the hot sample @i.
+ *
+ * Return value: the index of the new sample
+ **/
+static guint
+up_history_store_insert (UpHistoryStore *store, guint i, guint32 time_s, UpDeviceState state)
+{
+	guint len;
+	guint j;
 
-	/* make the values a factor of 0, so that 1.0 is twice the
-	 * average, and -1.0 is half the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0)
-			up_stats_item_set_value (stats, (up_stats_item_get_value (stats) - average) / average);
-		else
-			up_stats_item_set_value (stats, 0.0f);
+	len = up_history_store_append (store, time_s, state) - i;
+	g_memmove (store->time + i + 1, store->time + i, len * sizeof (guint32));
+	g_memmove (store->state + i + 1, store->state + i, len * sizeof (guint8));
+	g_memmove (store->present + i + 1, store->present + i, len * sizeof (guint8));
+	for (j=0; j<UP_HISTORY_METRICS; j++) {
+		if (store->value[j] == NULL)
+			continue;
+		g_memmove (store->value[j] + i + 1, store->value[j] + i, len * sizeof (gdouble));
+		if (!store->aggregate)
+			continue;
+		g_memmove (store->min[j] + i + 1, store->min[j] + i, len * sizeof (gdouble));
+		g_memmove (store->max[j] + i + 1, store->max[j] + i, len * sizeof (gdouble));
+		g_memmove (store->count[j] + i + 1, store->count[j] + i, len * sizeof (guint32));
 	}
+	store->time[i] = time_s;
+	store->state[i] = state;
+	store->present[i] = 0;
+	return i;
+}
+
+/**
+ * up_history_store_add_aggregate:
+ *
+ * Values that arrive at the same time and in the same state share a
+ * sample, unless it already has a value for @metric. Values stamped before
+ * the newest sample, as happens when the wall clock is stepped back, are
+ * put in time order so that the store can still be bisected, or at the
+ * start of the hot samples if they are older than that.
+ *
+ * Return value: the index of the sample the value was added to
+ **/
+static guint
+up_history_store_add_aggregate (UpHistoryStore *store, guint32 time_s, UpHistoryType metric, gdouble mean,
+				gdouble min, gdouble max, guint32 count, UpDeviceState state)
+{
+	guint row;
 
-	/* accuracy is a percentage scale, where each cycle = 20% */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) * 20.0f);
+	row = store->len;
+	if (store->len > 0 && time_s < store->time[store->len - 1]) {
+		if (store->cold_len > 0)
+			time_s = MAX (time_s, store->time[0]);
+		row = up_history_store_find_time (store, time_s);
 	}
 
-	return data;
+	if (row > 0 &&
+	    store->time[row-1] == time_s &&
+	    store->state[row-1] == state &&
+	    !up_history_store_has (store, row-1, metric))
+		row--;
+	else if (row == store->len)
+		row = up_history_store_append (store, time_s, state);
+	else
+		row = up_history_store_insert (store, row, time_s, state);
+	up_history_store_set (store, row, metric, mean, min, max, count);
+	return row;
 }
 
 /**
- * up_history_get_filename:
+ * up_history_store_add:
  **/
-static gchar *
-up_history_get_filename (UpHistory *history, const gchar *type)
+static guint
+up_history_store_add (UpHistoryStore *store, guint32 time_s, UpHistoryType metric,
+		      gdouble value, UpDeviceState state)
 {
-	gchar *path;
-	gchar *filename;
-
-	filename = g_strdup_printf ("history-%s-%s.dat", type, history->priv->id);
-	path = g_build_filename (PACKAGE_LOCALSTATE_DIR, "lib", "upower", filename, NULL);
-	g_free (filename);
-	return path;
+	return up_history_store_add_aggregate (store, time_s, metric, value, value, value, 1, state);
 }
 
 /**
- * up_history_array_to_file:
- * @list: a valid #GPtrArray instance
- * @filename: a filename
+ * up_history_store_add_sample:
  *
- * Saves a copy of the list to a file
+ * Appends a copy of the hot sample @i of @src, with all its values.
  **/
-static gboolean
-up_history_array_to_file (GPtrArray *list, const gchar *filename)
+static void
+up_history_store_add_sample (UpHistoryStore *store, const UpHistoryStore *src, guint i)
 {
-	guint i;
-	UpHistoryItem *item;
-	gchar *part;
-	GString *string;
-	gboolean ret = TRUE;
-	GError *error = NULL;
+	guint j;
+	guint row;
 
-	/* generate data */
-	string = g_string_new ("");
-	for (i=0; i<list->len; i++) {
-		item = g_ptr_array_index (list, i);
-		part = up_history_item_to_string (item);
-		if (part == NULL) {
-			ret = FALSE;
-			break;
-		}
-		g_string_append_printf (string, "%s\n", part);
-		g_free (part);
+	row = up_history_store_append (store, src->time[i], src->state[i]);
+	for (j=0; j<UP_HISTORY_METRICS; j++) {
+		if (!up_history_store_has (src, i, j))
+			continue;
+		if (src->aggregate)
+			up_history_store_set (store, row, j, src->value[j][i],
+					      src->min[j][i], src->max[j][i], src->count[j][i]);
+		else
+			up_history_store_set (store, row, j, src->value[j][i],
+					      src->value[j][i], src->value[j][i], 1);
 	}
-	part = g_string_free (string, FALSE);
+}
 
-	/* we failed to convert to string */
-	if (!ret) {
-		egg_warning ("failed to convert");
-		goto out;
-	}
+/**
+ * up_history_store_take:
+ *
+ * Replaces the samples of @store with those of @src, which is freed. Both
+ * must only have hot samples.
+ **/
+static void
+up_history_store_take (UpHistoryStore *store, UpHistoryStore *src)
+{
+	UpHistoryStore tmp;
+
+	g_return_if_fail (store->cold_len == 0 && src->cold_len == 0);
+
+	tmp = *store;
+	*store = *src;
+	*src = tmp;
+	up_history_store_free (src);
+}
+
+/**
+ * up_history_store_sort_cb:
+ **/
+static gint
+up_history_store_sort_cb (const guint *a, const guint *b, const UpHistoryStore *store)
+{
+	if (store->time[*a] != store->time[*b])
+		return store->time[*a] < store->time[*b] ? -1 : 1;
+	return *a < *b ? -1 : (*a > *b ? 1 : 0);
+}
+
+/**
+ * up_history_store_sort:
+ *
+ * Puts the hot samples back in time order, keeping the order of samples
+ * from the same time. Files written before the samples were kept sorted
+ * can be out of order where the wall clock was stepped back.
+ *
+ * Return value: %TRUE if the samples had to be sorted
+ **/
+static gboolean
+up_history_store_sort (UpHistoryStore *store)
+{
+	guint i;
+	guint *order;
+	UpHistoryStore *sorted;
+
+	for (i=1; i<store->len; i++) {
+		if (store->time[i] < store->time[i-1])
+			break;
+	}
+	if (i >= store->len)
+		return FALSE;
+
+	order = g_new (guint, store->len);
+	for (i=0; i<store->len; i++)
+		order[i] = i;
+	g_qsort_with_data (order, store->len, sizeof (guint),
+			   (GCompareDataFunc) up_history_store_sort_cb, store);
+	sorted = up_history_store_new (store->aggregate);
+	for (i=0; i<store->len; i++)
+		up_history_store_add_sample (sorted, store, order[i]);
+	egg_debug ("put %i samples back in time order", store->len);
+	up_history_store_take (store, sorted);
+	g_free (order);
+	return TRUE;
+}
+
+/**
+ * up_history_store_merge_sorted:
+ *
+ * Adds the hot samples of @src in time order, which is a plain append when
+ * they are all newer than those of @store.
+ *
+ * Return value: %TRUE if samples of @src went before those of @store
+ **/
+static gboolean
+up_history_store_merge_sorted (UpHistoryStore *store, const UpHistoryStore *src)
+{
+	guint i = 0;
+	guint j = 0;
+	UpHistoryStore *merged;
+
+	if (src->len == 0)
+		return FALSE;
+	if (store->len == 0 || src->time[0] >= store->time[store->len - 1]) {
+		for (j=0; j<src->len; j++)
+			up_history_store_add_sample (store, src, j);
+		return FALSE;
+	}
+
+	merged = up_history_store_new (store->aggregate);
+	while (i < store->len || j < src->len) {
+		if (j == src->len || (i < store->len && store->time[i] <= src->time[j]))
+			up_history_store_add_sample (merged, store, i++);
+		else
+			up_history_store_add_sample (merged, src, j++);
+	}
+	up_history_store_take (store, merged);
+	return TRUE;
+}
+
+/**
+ * up_history_store_has_value:
+ *
+ * Return value: %TRUE if a hot sample at @time_s in @state has a value for
+ * @metric
+ **/
+static gboolean
+up_history_store_has_value (const UpHistoryStore *store, guint32 time_s,
+			    UpDeviceState state, UpHistoryType metric)
+{
+	guint i;
+
+	for (i=up_history_store_find_time (store, time_s); i>0 && store->time[i-1] == time_s; i--) {
+		if (store->state[i-1] == state && up_history_store_has (store, i-1, metric))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * up_history_store_remove_head:
+ *
+ * Removes the oldest @count samples.
+ **/
+static void
+up_history_store_remove_head (UpHistoryStore *store, guint count)
+{
+	guint len;
+	guint i;
+
+	count = MIN (count, store->len);
+	len = store->len - count;
+	g_memmove (store->time, store->time + count, len * sizeof (guint32));
+	g_memmove (store->state, store->state + count, len * sizeof (guint8));
+	g_memmove (store->present, store->present + count, len * sizeof (guint8));
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		if (store->value[i] == NULL)
+			continue;
+		g_memmove (store->value[i], store->value[i] + count, len * sizeof (gdouble));
+		if (!store->aggregate)
+			continue;
+		g_memmove (store->min[i], store->min[i] + count, len * sizeof (gdouble));
+		g_memmove (store->max[i], store->max[i] + count, len * sizeof (gdouble));
+		g_memmove (store->count[i], store->count[i] + count, len * sizeof (guint32));
+	}
+	store->len = len;
+}
+
+/**
+ * up_history_store_shrink:
+ *
+ * Gives back the memory of the columns once most of it is unused, leaving
+ * room to grow so that adding a sample is still amortized O(1).
+ **/
+static void
+up_history_store_shrink (UpHistoryStore *store)
+{
+	if (store->size <= UP_HISTORY_STORE_MIN_SIZE || store->len > store->size / 4)
+		return;
+	up_history_store_resize (store, MAX (store->len * 2, UP_HISTORY_STORE_MIN_SIZE));
+}
+
+/**
+ * up_history_store_get_memory:
+ *
+ * The total is kept up to date as the columns are resized and segments
+ * are added or removed, as it is checked after every sample.
+ *
+ * Return value: the bytes used by the columns and the cold segments
+ **/
+static gsize
+up_history_store_get_memory (const UpHistoryStore *store)
+{
+	return store->memory;
+}
+
+/* bits are written most significant first into a growing buffer */
+typedef struct {
+	guint8			*data;
+	gsize			 length;	/* bytes, including the last partial one */
+	gsize			 size;
+	guint			 free;		/* unused bits in the last byte */
+} UpHistoryBitWriter;
+
+typedef struct {
+	const guint8		*data;
+	gsize			 length;
+	gsize			 pos;		/* in bits */
+	gboolean		 overflow;	/* read past the end of the data */
+} UpHistoryBitReader;
+
+/* the previous double and the window of its meaningful XOR bits */
+typedef struct {
+	guint64			 prev;
+	guint			 leading;	/* 64 if there is no window yet */
+	guint			 trailing;
+} UpHistoryXor;
+
+/**
+ * up_history_bit_writer_put:
+ **/
+static void
+up_history_bit_writer_put (UpHistoryBitWriter *writer, guint64 value, guint bits)
+{
+	guint n;
+
+	while (bits > 0) {
+		if (writer->free == 0) {
+			if (writer->length == writer->size) {
+				writer->size = MAX (writer->size * 2, UP_HISTORY_STORE_MIN_SIZE);
+				writer->data = g_realloc (writer->data, writer->size);
+			}
+			writer->data[writer->length++] = 0;
+			writer->free = 8;
+		}
+		n = MIN (bits, writer->free);
+		writer->data[writer->length-1] |= ((value >> (bits - n)) & ((1 << n) - 1)) << (writer->free - n);
+		writer->free -= n;
+		bits -= n;
+	}
+}
+
+/**
+ * up_history_bit_writer_put_varint:
+ **/
+static void
+up_history_bit_writer_put_varint (UpHistoryBitWriter *writer, guint32 value)
+{
+	while (value >= 0x80) {
+		up_history_bit_writer_put (writer, 0x80 | (value & 0x7f), 8);
+		value >>= 7;
+	}
+	up_history_bit_writer_put (writer, value, 8);
+}
+
+/**
+ * up_history_bit_reader_get:
+ **/
+static guint64
+up_history_bit_reader_get (UpHistoryBitReader *reader, guint bits)
+{
+	guint64 value = 0;
+	guint avail;
+	guint n;
+
+	if (reader->overflow || reader->pos + bits > reader->length * 8) {
+		reader->overflow = TRUE;
+		return 0;
+	}
+	while (bits > 0) {
+		avail = 8 - reader->pos % 8;
+		n = MIN (bits, avail);
+		value = (value << n) | ((reader->data[reader->pos / 8] >> (avail - n)) & ((1 << n) - 1));
+		reader->pos += n;
+		bits -= n;
+	}
+	return value;
+}
+
+/**
+ * up_history_bit_reader_get_varint:
+ **/
+static guint32
+up_history_bit_reader_get_varint (UpHistoryBitReader *reader)
+{
+	guint32 value = 0;
+	guint shift;
+	guint8 byte;
+
+	for (shift=0; shift<35; shift+=7) {
+		byte = up_history_bit_reader_get (reader, 8);
+		value |= (guint32) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return value;
+	}
+	reader->overflow = TRUE;
+	return 0;
+}
+
+/**
+ * up_history_leading_zeros:
+ **/
+static guint
+up_history_leading_zeros (guint64 value)
+{
+	guint n = 0;
+
+	if (value == 0)
+		return 64;
+	if ((value >> 32) == 0) { n += 32; value <<= 32; }
+	if ((value >> 48) == 0) { n += 16; value <<= 16; }
+	if ((value >> 56) == 0) { n += 8; value <<= 8; }
+	if ((value >> 60) == 0) { n += 4; value <<= 4; }
+	if ((value >> 62) == 0) { n += 2; value <<= 2; }
+	if ((value >> 63) == 0) n += 1;
+	return n;
+}
+
+/**
+ * up_history_trailing_zeros:
+ **/
+static guint
+up_history_trailing_zeros (guint64 value)
+{
+	guint n = 0;
+
+	if (value == 0)
+		return 64;
+	if ((value & 0xffffffff) == 0) { n += 32; value >>= 32; }
+	if ((value & 0xffff) == 0) { n += 16; value >>= 16; }
+	if ((value & 0xff) == 0) { n += 8; value >>= 8; }
+	if ((value & 0xf) == 0) { n += 4; value >>= 4; }
+	if ((value & 0x3) == 0) { n += 2; value >>= 2; }
+	if ((value & 0x1) == 0) n += 1;
+	return n;
+}
+
+/**
+ * up_history_time_encode:
+ **/
+static void
+up_history_time_encode (UpHistoryBitWriter *writer, guint32 time_s, guint32 *prev, gint64 *delta)
+{
+	gint64 dod;
+
+	dod = ((gint64) time_s - *prev) - *delta;
+	*delta = (gint64) time_s - *prev;
+	*prev = time_s;
+
+	if (dod == 0) {
+		up_history_bit_writer_put (writer, 0x0, 1);
+	} else if (dod >= -63 && dod <= 64) {
+		up_history_bit_writer_put (writer, 0x2, 2);
+		up_history_bit_writer_put (writer, dod + 63, 7);
+	} else if (dod >= -255 && dod <= 256) {
+		up_history_bit_writer_put (writer, 0x6, 3);
+		up_history_bit_writer_put (writer, dod + 255, 9);
+	} else if (dod >= -2047 && dod <= 2048) {
+		up_history_bit_writer_put (writer, 0xe, 4);
+		up_history_bit_writer_put (writer, dod + 2047, 12);
+	} else {
+		up_history_bit_writer_put (writer, 0xf, 4);
+		up_history_bit_writer_put (writer, time_s, 32);
+	}
+}
+
+/**
+ * up_history_time_decode:
+ **/
+static guint32
+up_history_time_decode (UpHistoryBitReader *reader, guint32 *prev, gint64 *delta)
+{
+	gint64 dod;
+	guint32 time_s;
+
+	if (up_history_bit_reader_get (reader, 1) == 0) {
+		dod = 0;
+	} else if (up_history_bit_reader_get (reader, 1) == 0) {
+		dod = (gint64) up_history_bit_reader_get (reader, 7) - 63;
+	} else if (up_history_bit_reader_get (reader, 1) == 0) {
+		dod = (gint64) up_history_bit_reader_get (reader, 9) - 255;
+	} else if (up_history_bit_reader_get (reader, 1) == 0) {
+		dod = (gint64) up_history_bit_reader_get (reader, 12) - 2047;
+	} else {
+		time_s = up_history_bit_reader_get (reader, 32);
+		*delta = (gint64) time_s - *prev;
+		*prev = time_s;
+		return time_s;
+	}
+	*delta += dod;
+	*prev += *delta;
+	return *prev;
+}
+
+/**
+ * up_history_xor_encode:
+ **/
+static void
+up_history_xor_encode (UpHistoryBitWriter *writer, UpHistoryXor *xor, gdouble value)
+{
+	guint64 bits;
+	guint64 diff;
+	guint leading;
+	guint trailing;
+
+	memcpy (&bits, &value, sizeof (bits));
+	diff = bits ^ xor->prev;
+	xor->prev = bits;
+	if (diff == 0) {
+		up_history_bit_writer_put (writer, 0x0, 1);
+		return;
+	}
+
+	/* reuse the previous window if the bits fit inside it */
+	leading = MIN (up_history_leading_zeros (diff), 31);
+	trailing = up_history_trailing_zeros (diff);
+	if (xor->leading != 64 && leading >= xor->leading && trailing >= xor->trailing) {
+		up_history_bit_writer_put (writer, 0x2, 2);
+		up_history_bit_writer_put (writer, diff >> xor->trailing, 64 - xor->leading - xor->trailing);
+		return;
+	}
+	up_history_bit_writer_put (writer, 0x3, 2);
+	up_history_bit_writer_put (writer, leading, 5);
+	up_history_bit_writer_put (writer, 64 - leading - trailing - 1, 6);
+	up_history_bit_writer_put (writer, diff >> trailing, 64 - leading - trailing);
+	xor->leading = leading;
+	xor->trailing = trailing;
+}
+
+/**
+ * up_history_xor_decode:
+ **/
+static gdouble
+up_history_xor_decode (UpHistoryBitReader *reader, UpHistoryXor *xor)
+{
+	guint64 diff = 0;
+	guint length;
+	gdouble value;
+
+	if (up_history_bit_reader_get (reader, 1) == 0)
+		goto out;
+	if (up_history_bit_reader_get (reader, 1) == 0) {
+		if (xor->leading == 64) {
+			reader->overflow = TRUE;
+			goto out;
+		}
+		length = 64 - xor->leading - xor->trailing;
+		diff = up_history_bit_reader_get (reader, length) << xor->trailing;
+		goto out;
+	}
+	xor->leading = up_history_bit_reader_get (reader, 5);
+	length = up_history_bit_reader_get (reader, 6) + 1;
+	if (xor->leading + length > 64) {
+		reader->overflow = TRUE;
+		goto out;
+	}
+	xor->trailing = 64 - xor->leading - length;
+	diff = up_history_bit_reader_get (reader, length) << xor->trailing;
+out:
+	xor->prev ^= diff;
+	memcpy (&value, &xor->prev, sizeof (value));
+	return value;
+}
+
+/**
+ * up_history_store_compress:
+ * @store: the samples
+ * @start: the first sample to encode
+ * @end: the sample after the last one to encode
+ * @length: the returned size of the payload
+ *
+ * Encodes the hot samples between @start and @end.
+ *
+ * Return value: the payload of a block, free with g_free()
+ **/
+static guint8 *
+up_history_store_compress (const UpHistoryStore *store, guint start, guint end, gsize *length)
+{
+	UpHistoryBitWriter writer = { NULL, 0, 0, 0 };
+	UpHistoryXor xor_value[UP_HISTORY_METRICS];
+	UpHistoryXor xor_min[UP_HISTORY_METRICS];
+	UpHistoryXor xor_max[UP_HISTORY_METRICS];
+	guint32 count_prev[UP_HISTORY_METRICS];
+	guint32 time_prev = 0;
+	guint8 present_prev = 0;
+	gint64 delta = 0;
+	guint runs = 0;
+	guint i;
+	guint j;
+
+	for (j=0; j<UP_HISTORY_METRICS; j++) {
+		xor_value[j].prev = xor_min[j].prev = xor_max[j].prev = 0;
+		xor_value[j].leading = xor_min[j].leading = xor_max[j].leading = 64;
+		xor_value[j].trailing = xor_min[j].trailing = xor_max[j].trailing = 0;
+		count_prev[j] = 0;
+	}
+
+	/* the state rarely changes, so store it as runs */
+	for (i=start; i<end; i=j) {
+		for (j=i+1; j<end && store->state[j] == store->state[i]; j++);
+		runs++;
+	}
+	up_history_bit_writer_put_varint (&writer, runs);
+	for (i=start; i<end; i=j) {
+		for (j=i+1; j<end && store->state[j] == store->state[i]; j++);
+		up_history_bit_writer_put (&writer, store->state[i], 8);
+		up_history_bit_writer_put_varint (&writer, j - i);
+	}
+
+	for (i=start; i<end; i++) {
+		up_history_time_encode (&writer, store->time[i], &time_prev, &delta);
+		if (store->present[i] == present_prev) {
+			up_history_bit_writer_put (&writer, 0x0, 1);
+		} else {
+			up_history_bit_writer_put (&writer, 0x1, 1);
+			up_history_bit_writer_put (&writer, store->present[i], UP_HISTORY_METRICS);
+			present_prev = store->present[i];
+		}
+		for (j=0; j<UP_HISTORY_METRICS; j++) {
+			if (!up_history_store_has (store, i, j))
+				continue;
+			up_history_xor_encode (&writer, &xor_value[j], store->value[j][i]);
+			if (!store->aggregate)
+				continue;
+			up_history_xor_encode (&writer, &xor_min[j], store->min[j][i]);
+			up_history_xor_encode (&writer, &xor_max[j], store->max[j][i]);
+			if (store->count[j][i] == count_prev[j]) {
+				up_history_bit_writer_put (&writer, 0x0, 1);
+			} else {
+				up_history_bit_writer_put (&writer, 0x1, 1);
+				up_history_bit_writer_put (&writer, store->count[j][i], 32);
+				count_prev[j] = store->count[j][i];
+			}
+		}
+	}
+	*length = writer.length;
+	return writer.data;
+}
+
+/**
+ * up_history_store_decompress:
+ * @store: the samples
+ * @aggregate: if the payload has aggregate samples
+ * @version: the file version the payload is from
+ * @metric: the history type of a version 2 payload
+ * @data: the payload of a block
+ * @length: the size of @data
+ * @count: the number of samples in the block
+ *
+ * Appends the samples of a block to @store. Aggregate samples can be added
+ * to a raw store, which only keeps the mean.
+ *
+ * Return value: %FALSE if the payload is invalid, when nothing is added
+ **/
+static gboolean
+up_history_store_decompress (UpHistoryStore *store, gboolean aggregate, guint32 version,
+			     UpHistoryType metric, const guint8 *data, gsize length, guint count)
+{
+	UpHistoryBitReader reader = { data, length, 0, FALSE };
+	UpHistoryXor xor_value[UP_HISTORY_METRICS];
+	UpHistoryXor xor_min[UP_HISTORY_METRICS];
+	UpHistoryXor xor_max[UP_HISTORY_METRICS];
+	guint32 count_prev[UP_HISTORY_METRICS];
+	guint32 time_prev = 0;
+	guint8 present = 0;
+	guint present_bits = UP_HISTORY_METRICS;
+	gint64 delta = 0;
+	guint8 *states = NULL;
+	guint8 state;
+	guint len;
+	guint runs;
+	guint run;
+	guint filled = 0;
+	guint row;
+	guint i;
+	guint j;
+	guint32 time_s;
+	gdouble value;
+	gdouble min = 0;
+	gdouble max = 0;
+	gboolean ret = FALSE;
+
+	for (j=0; j<UP_HISTORY_METRICS; j++) {
+		xor_value[j].prev = xor_min[j].prev = xor_max[j].prev = 0;
+		xor_value[j].leading = xor_min[j].leading = xor_max[j].leading = 64;
+		xor_value[j].trailing = xor_min[j].trailing = xor_max[j].trailing = 0;
+		count_prev[j] = 0;
+	}
+
+	/* every sample takes at least two bits */
+	len = store->len;
+	if (count > length * 4)
+		goto out;
+
+	/* the old format has a single history type */
+	if (version == UP_HISTORY_FILE_VERSION_BLOCKS)
+		present = 1 << metric;
+	else if (version == UP_HISTORY_FILE_VERSION_SHARED)
+		present_bits = UP_HISTORY_TYPE_CAPACITY;
+
+	states = g_new (guint8, count);
+	runs = up_history_bit_reader_get_varint (&reader);
+	for (i=0; i<runs && !reader.overflow; i++) {
+		state = up_history_bit_reader_get (&reader, 8);
+		run = up_history_bit_reader_get_varint (&reader);
+		if (run > count - filled)
+			goto out;
+		memset (states + filled, state, run);
+		filled += run;
+	}
+	if (reader.overflow || filled != count)
+		goto out;
+
+	for (i=0; i<count; i++) {
+		time_s = up_history_time_decode (&reader, &time_prev, &delta);
+		if (version != UP_HISTORY_FILE_VERSION_BLOCKS &&
+		    up_history_bit_reader_get (&reader, 1) == 1)
+			present = up_history_bit_reader_get (&reader, present_bits);
+		row = up_history_store_append (store, time_s, states[i]);
+		for (j=0; j<UP_HISTORY_METRICS; j++) {
+			if ((present & (1 << j)) == 0)
+				continue;
+			value = up_history_xor_decode (&reader, &xor_value[j]);
+			if (aggregate) {
+				min = up_history_xor_decode (&reader, &xor_min[j]);
+				max = up_history_xor_decode (&reader, &xor_max[j]);
+				if (up_history_bit_reader_get (&reader, 1) == 1)
+					count_prev[j] = up_history_bit_reader_get (&reader, 32);
+				up_history_store_set (store, row, j, value, min, max, count_prev[j]);
+			} else {
+				up_history_store_set (store, row, j, value, value, value, 1);
+			}
+		}
+		if (reader.overflow)
+			goto out;
+	}
+	ret = TRUE;
+out:
+	/* don't leave half a block behind */
+	if (!ret)
+		store->len = len;
+	g_free (states);
+	return ret;
+}
+
+/**
+ * up_history_segment_new:
+ *
+ * Return value: a segment with the hot samples of @store between @start and @end
+ **/
+static UpHistorySegment *
+up_history_segment_new (const UpHistoryStore *store, guint start, guint end)
+{
+	UpHistorySegment *segment;
+
+	segment = g_new0 (UpHistorySegment, 1);
+	segment->ref_count = 1;
+	segment->data = up_history_store_compress (store, start, end, &segment->length);
+	segment->count = end - start;
+	segment->time_first = store->time[start];
+	segment->time_last = store->time[end-1];
+	return segment;
+}
+
+/**
+ * up_history_store_freeze:
+ * @store: the samples
+ * @saved: the number of samples that are on disk
+ *
+ * Moves whole segments of samples that are already on disk out of the
+ * columns. The newest sample is always kept, as it may still be extended
+ * by a rollup.
+ **/
+static void
+up_history_store_freeze (UpHistoryStore *store, guint saved)
+{
+	UpHistorySegment *segment;
+
+	while (store->len > UP_HISTORY_SEGMENT_SIZE &&
+	       store->cold_len + UP_HISTORY_SEGMENT_SIZE <= saved) {
+		segment = up_history_segment_new (store, 0, UP_HISTORY_SEGMENT_SIZE);
+		g_ptr_array_add (store->segments, segment);
+		up_history_store_remove_head (store, UP_HISTORY_SEGMENT_SIZE);
+		store->cold_len += UP_HISTORY_SEGMENT_SIZE;
+		store->memory += up_history_segment_get_memory (segment);
+	}
+}
+
+/**
+ * up_history_store_copy:
+ *
+ * The cold segments are shared rather than copied, and can only be copied
+ * as a whole.
+ *
+ * Return value: a new store with the samples of @store from @start
+ **/
+static UpHistoryStore *
+up_history_store_copy (const UpHistoryStore *store, guint start)
+{
+	UpHistoryStore *store_new;
+	UpHistorySegment *segment;
+	guint len;
+	guint i;
+
+	g_return_val_if_fail (start == 0 || start >= store->cold_len, NULL);
+
+	store_new = up_history_store_new (store->aggregate);
+	if (start == 0) {
+		for (i=0; i<store->segments->len; i++) {
+			segment = g_ptr_array_index (store->segments, i);
+			g_ptr_array_add (store_new->segments, up_history_segment_ref (segment));
+			store_new->memory += up_history_segment_get_memory (segment);
+		}
+		store_new->cold_len = store->cold_len;
+	} else {
+		start -= store->cold_len;
+	}
+
+	len = store->len - start;
+	store_new->len = len;
+	store_new->size = len;
+	store_new->time = g_memdup (store->time + start, len * sizeof (guint32));
+	store_new->state = g_memdup (store->state + start, len * sizeof (guint8));
+	store_new->present = g_memdup (store->present + start, len * sizeof (guint8));
+	for (i=0; i<UP_HISTORY_METRICS; i++) {
+		if (store->value[i] == NULL)
+			continue;
+		store_new->value[i] = g_memdup (store->value[i] + start, len * sizeof (gdouble));
+		if (!store->aggregate)
+			continue;
+		store_new->min[i] = g_memdup (store->min[i] + start, len * sizeof (gdouble));
+		store_new->max[i] = g_memdup (store->max[i] + start, len * sizeof (gdouble));
+		store_new->count[i] = g_memdup (store->count[i] + start, len * sizeof (guint32));
+	}
+	store_new->memory += (gsize) len * up_history_store_get_row_size (store_new);
+	return store_new;
+}
+
+/**
+ * up_history_store_rollup:
+ * @src: the finer tier
+ * @dest: the coarser tier
+ * @dest_file: what is known about the file of @dest
+ * @cutoff: samples older than this are rolled up
+ * @bucket: the width of the aggregates in seconds
+ *
+ * Folds the samples at the start of @src that are older than @cutoff into
+ * aggregates, one for each bucket and state, which each history type is
+ * rolled up into separately.
+ *
+ * Return value: the number of samples that can be removed from @src
+ **/
+static guint
+up_history_store_rollup (const UpHistoryStore *src, UpHistoryStore *dest,
+			 UpHistoryFileState *dest_file, guint32 cutoff, guint bucket)
+{
+	guint i;
+	guint j;
+	guint last;
+	guint32 start;
+	guint32 count;
+	gdouble value;
+	gdouble min;
+	gdouble max;
+
+	for (i=0; i<src->len && src->time[i] < cutoff; i++) {
+		if (src->present[i] == 0)
+			continue;
+		start = src->time[i] - (src->time[i] % bucket);
+
+		/* extend the last aggregate if it is for the same bucket */
+		last = dest->len - 1;
+		if (dest->len > 0 &&
+		    dest->time[last] == start &&
+		    dest->state[last] == src->state[i]) {
+			/* the record on disk is now out of date */
+			if (dest->cold_len + last < dest_file->saved)
+				dest_file->compact = TRUE;
+		} else {
+			last = up_history_store_append (dest, start, src->state[i]);
+		}
+
+		for (j=0; j<UP_HISTORY_METRICS; j++) {
+			if (!up_history_store_has (src, i, j))
+				continue;
+			value = src->value[j][i];
+			min = src->aggregate ? src->min[j][i] : value;
+			max = src->aggregate ? src->max[j][i] : value;
+			count = src->aggregate ? src->count[j][i] : 1;
+			if (!up_history_store_has (dest, last, j)) {
+				up_history_store_set (dest, last, j, value, min, max, count);
+				continue;
+			}
+			dest->value[j][last] = (dest->value[j][last] * dest->count[j][last] + value * count) /
+					       (dest->count[j][last] + count);
+			dest->min[j][last] = MIN (dest->min[j][last], min);
+			dest->max[j][last] = MAX (dest->max[j][last], max);
+			dest->count[j][last] += count;
+		}
+	}
+	return i;
+}
+
+/**
+ * up_history_get_time_now:
+ *
+ * Small corrections of the wall clock are smoothed over, and the clock is
+ * only followed again once it is stepped, or after a suspend, which the
+ * monotonic clock does not count.
+ **/
+static guint32
+up_history_get_time_now (void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	gint64 wall;
+	gint64 monotonic;
+	gint64 now;
+	gint64 step;
+
+	if (up_history_time_fixed != 0)
+		return up_history_time_fixed;
+
+	wall = g_get_real_time ();
+	monotonic = g_get_monotonic_time ();
+	now = up_history_clock.wall + (monotonic - up_history_clock.monotonic);
+	step = wall - now;
+	if (!up_history_clock.anchored ||
+	    ABS (step) > UP_HISTORY_CLOCK_SLACK * G_USEC_PER_SEC) {
+		if (up_history_clock.anchored)
+			egg_debug ("wall clock moved by %" G_GINT64_FORMAT " seconds", step / G_USEC_PER_SEC);
+		up_history_clock.anchored = TRUE;
+		up_history_clock.wall = wall;
+		up_history_clock.monotonic = monotonic;
+		now = wall;
+	}
+	return now / G_USEC_PER_SEC;
+#else
+	GTimeVal timeval;
+
+	if (up_history_time_fixed != 0)
+		return up_history_time_fixed;
+	g_get_current_time (&timeval);
+	return timeval.tv_sec;
+#endif
+}
+
+/**
+ * up_history_item_new_for_sample:
+ **/
+static UpHistoryItem *
+up_history_item_new_for_sample (guint32 time_s, gdouble value, UpDeviceState state)
+{
+	UpHistoryItem *item;
+
+	item = up_history_item_new ();
+	up_history_item_set_time (item, time_s);
+	up_history_item_set_value (item, value);
+	up_history_item_set_state (item, state);
+	return item;
+}
+
+/**
+ * up_history_series_new:
+ **/
+static UpHistorySeries *
+up_history_series_new (void)
+{
+	UpHistorySeries *series;
+	guint i;
+
+	series = g_new0 (UpHistorySeries, 1);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		series->tier[i] = up_history_store_new (i != UP_HISTORY_TIER_RAW);
+	series->capacity = up_history_store_new (FALSE);
+	return series;
+}
+
+/**
+ * up_history_series_free:
+ **/
+static void
+up_history_series_free (UpHistorySeries *series)
+{
+	guint i;
+
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		up_history_store_free (series->tier[i]);
+	up_history_store_free (series->capacity);
+	g_free (series);
+}
+
+/**
+ * up_history_series_expire_tier:
+ *
+ * Rolls the samples of @tier that are older than @cutoff into the next
+ * tier, or drops them from the last one. Only whole buckets of the next
+ * tier are rolled up, so @cutoff is rounded down to a bucket.
+ *
+ * Return value: the number of samples removed from @tier
+ **/
+static guint
+up_history_series_expire_tier (UpHistorySeries *series, UpHistoryTier tier, guint32 cutoff)
+{
+	guint j;
+	guint bucket = 0;
+	guint removed = 0;
+	guint hot = 0;
+	UpHistoryStore *store;
+	UpHistoryStore *thawed;
+	UpHistorySegment *segment;
+
+	store = series->tier[tier];
+	if (tier + 1 < UP_HISTORY_TIER_LAST) {
+		/* only roll up whole buckets */
+		bucket = up_history_tier_buckets[tier+1];
+		cutoff -= cutoff % bucket;
+	}
+
+	/* the cold segments are older than the columns, and are only
+	 * expired as a whole */
+	while (store->segments->len > 0) {
+		segment = g_ptr_array_index (store->segments, 0);
+		if (segment->time_last >= cutoff)
+			break;
+		if (tier + 1 < UP_HISTORY_TIER_LAST) {
+			thawed = up_history_store_new (store->aggregate);
+			up_history_store_decompress (thawed, store->aggregate, UP_HISTORY_FILE_VERSION,
+						     UP_HISTORY_TYPE_UNKNOWN, segment->data,
+						     segment->length, segment->count);
+			up_history_store_rollup (thawed, series->tier[tier+1], &series->file[tier+1],
+						 cutoff, bucket);
+			up_history_store_free (thawed);
+		}
+		removed += segment->count;
+		store->cold_len -= segment->count;
+		store->memory -= up_history_segment_get_memory (segment);
+		g_ptr_array_remove_index (store->segments, 0);
+	}
+
+	if (store->segments->len == 0) {
+		if (tier + 1 < UP_HISTORY_TIER_LAST) {
+			hot = up_history_store_rollup (store, series->tier[tier+1], &series->file[tier+1],
+						       cutoff, bucket);
+		} else {
+			for (hot=0; hot<store->len; hot++) {
+				if (store->time[hot] >= cutoff)
+					break;
+			}
+		}
+		up_history_store_remove_head (store, hot);
+	}
+	removed += hot;
+	if (removed == 0)
+		return 0;
+
+	egg_debug ("expired %i samples from tier %i", removed, tier);
+	for (j=0; j<UP_HISTORY_METRICS; j++)
+		series->generation[j]++;
+	series->rewrites++;
+
+	/* the start of the file is now out of date */
+	series->file[tier].compact = TRUE;
+	return removed;
+}
+
+/**
+ * up_history_series_expire:
+ *
+ * Rolls the samples that are older than the retention of each tier into
+ * the next tier, and drops them from the last one. The capacity has its
+ * own retention. A maximum age of zero keeps the samples forever.
+ *
+ * With @batch, a tier is only expired once it is well past its retention,
+ * so that the file is not rewritten on every save.
+ **/
+static void
+up_history_series_expire (UpHistory *history, UpHistorySeries *series, guint32 now, gboolean batch)
+{
+	guint i;
+	guint age;
+	guint slack;
+	guint removed;
+	UpHistoryStore *store;
+
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		store = series->tier[i];
+		age = history->priv->max_age[i];
+		if (age == 0 || age >= now || up_history_store_get_total (store) == 0)
+			continue;
+		slack = batch ? age / UP_HISTORY_EXPIRE_SLACK : 0;
+		if (up_history_store_get_time_first (store) + age + slack > now)
+			continue;
+		up_history_series_expire_tier (series, i, now - age);
+	}
+
+	/* the capacity is never rolled up, as there is so little of it */
+	store = series->capacity;
+	age = history->priv->capacity_age;
+	if (age == 0 || age >= now || store->len == 0)
+		return;
+	slack = batch ? age / UP_HISTORY_EXPIRE_SLACK : 0;
+	if (store->time[0] + age + slack > now)
+		return;
+	removed = up_history_store_find_time (store, now - age - 1);
+	up_history_store_remove_head (store, removed);
+	egg_debug ("expired %i capacity samples", removed);
+	series->generation[UP_HISTORY_TYPE_CAPACITY]++;
+	series->rewrites++;
+	series->capacity_file.compact = TRUE;
+}
+
+/**
+ * up_history_store_get_time_last:
+ **/
+static guint32
+up_history_store_get_time_last (const UpHistoryStore *store)
+{
+	const UpHistorySegment *segment;
+
+	if (store->len > 0)
+		return store->time[store->len - 1];
+	segment = g_ptr_array_index (store->segments, store->segments->len - 1);
+	return segment->time_last;
+}
+
+/**
+ * up_history_series_evict:
+ *
+ * Frees memory ahead of the retention, rolling the oldest part of the tier
+ * using the most memory into the next tier, or dropping it from the last
+ * tier, so that the oldest samples lose their detail first.
+ *
+ * Return value: %FALSE if nothing could be evicted
+ **/
+static gboolean
+up_history_series_evict (UpHistorySeries *series)
+{
+	guint i;
+	guint j;
+	guint best;
+	guint bucket;
+	gsize memory[UP_HISTORY_TIER_LAST];
+	guint32 first;
+	guint32 last;
+	guint32 cutoff;
+	UpHistoryStore *store;
+
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		memory[i] = up_history_store_get_memory (series->tier[i]);
+
+	/* a tier may be too short to roll up a whole bucket */
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		best = 0;
+		for (j=1; j<UP_HISTORY_TIER_LAST; j++) {
+			if (memory[j] > memory[best])
+				best = j;
+		}
+		if (memory[best] == 0)
+			break;
+		memory[best] = 0;
+
+		store = series->tier[best];
+		if (up_history_store_get_total (store) == 0)
+			continue;
+		first = up_history_store_get_time_first (store);
+		last = up_history_store_get_time_last (store);
+		cutoff = first + (last - first) / UP_HISTORY_EVICT_FRACTION + 1;
+
+		/* roll up at least the oldest bucket, but never the newest */
+		if (best + 1 < UP_HISTORY_TIER_LAST) {
+			bucket = up_history_tier_buckets[best+1];
+			cutoff = MAX (cutoff, first - first % bucket + bucket);
+			cutoff -= cutoff % bucket;
+			if (cutoff > last - last % bucket)
+				continue;
+		}
+		if (up_history_series_expire_tier (series, best, cutoff) == 0)
+			continue;
+
+		egg_debug ("evicted tier %i up to %i", best, cutoff);
+		up_history_store_shrink (store);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * up_history_series_flatten:
+ *
+ * Cold segments that overlap @start are decoded in full, so the result can
+ * start a little earlier. The result is an aggregate store so that the
+ * range of the older samples is kept.
+ *
+ * Return value: the samples of all the tiers newer than @start, oldest first
+ **/
+static UpHistoryStore *
+up_history_series_flatten (const UpHistorySeries *series, guint32 start)
+{
+	gint i;
+	guint j;
+	const UpHistoryStore *store;
+	const UpHistorySegment *segment;
+	UpHistoryStore *store_new;
+
+	store_new = up_history_store_new (TRUE);
+	for (i=UP_HISTORY_TIER_LAST-1; i>=0; i--) {
+		store = series->tier[i];
+		for (j=0; j<store->segments->len; j++) {
+			segment = g_ptr_array_index (store->segments, j);
+			if (segment->time_last < start)
+				continue;
+			if (!up_history_store_decompress (store_new, store->aggregate, UP_HISTORY_FILE_VERSION,
+							  UP_HISTORY_TYPE_UNKNOWN, segment->data,
+							  segment->length, segment->count))
+				egg_warning ("failed to decode cold segment");
+		}
+		for (j=up_history_store_find_time (store, start - 1); j<store->len; j++)
+			up_history_store_add_sample (store_new, store, j);
+	}
+	return store_new;
+}
+
+/**
+ * up_history_array_limit_resolution:
+ * @view: The data we have for a specific graph
+ * @max_num: The max desired points
+ *
+ * We need to reduce the number of data points else the graph will take a long
+ * time to plot accuracy we don't need at the larger scales.
+ * This will not reduce the scale or range of the data.
+ *
+ *  100  +     + |  +   |  +   | +     +
+ *       |  A    |      |      |
+ *   80  +     + |  +   |  +   | +     +
+ *       |       | B  C |      |
+ *   60  +     + |  +   |  +   | +     +
+ *       |       |      |      |
+ *   40  +     + |  +   |  +   | + E   +
+ *       |       |      |      | D
+ *   20  +     + |  +   |  +   | +   F +
+ *       |       |      |      |
+ *    0  +-----+-----+-----+-----+-----+
+ *            20    40    60    80   100
+ *
+ * A = 15,90
+ * B = 30,70
+ * C = 52,70
+ * D = 80,30
+ * E = 85,40
+ * F = 90,20
+ *
+ * 1 = 15,90
+ * 2 = 41,70
+ * 3 = 85,30
+ **/
+static GPtrArray *
+up_history_array_limit_resolution (const UpHistoryView *view, guint max_num)
+{
+	gfloat division;
+	guint length = 0;
+	guint i;
+	guint last = 0;
+	guint first = 0;
+	GPtrArray *new;
+	const UpHistoryStore *store = view->store;
+	const gdouble *values = store->value[view->metric];
+	UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
+	guint64 time_s = 0;
+	gdouble value = 0;
+	guint64 count = 0;
+	guint step = 1;
+	gfloat preset;
+
+	new = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+
+	/* only the samples with this history type count */
+	for (i=view->start; i<view->end; i++) {
+		if (!up_history_store_has (store, i, view->metric))
+			continue;
+		if (length++ == 0)
+			last = store->time[i];
+		first = store->time[i];
+	}
+	egg_debug ("length of array (before) %i", length);
+
+	/* check length */
+	if (length == 0)
+		goto out;
+	if (length < max_num) {
+		/* need to copy array, newest first */
+		for (i=view->end; i>view->start; i--) {
+			if (up_history_store_has (store, i-1, view->metric))
+				g_ptr_array_add (new, up_history_item_new_for_sample (store->time[i-1],
+										      values[i-1],
+										      store->state[i-1]));
+		}
+		goto out;
+	}
+
+	/* oldest and newest elements are last and first */
+	division = (first - last) / (gfloat) max_num;
+	egg_debug ("Using a x division of %f (first=%i,last=%i)", division, first, last);
+
+	/* Reduces the number of points to a pre-set level using a time
+	 * division algorithm so we don't keep diluting the previous
+	 * data with a conventional 1-in-x type algorithm. */
+	for (i=view->start; i<view->end; i++) {
+		if (!up_history_store_has (store, i, view->metric))
+			continue;
+		preset = last + (division * (gfloat) step);
+
+		/* if state changed or we went over the preset do a new point */
+		if (count > 0 &&
+		    (store->time[i] > preset ||
+		     store->state[i] != state)) {
+			g_ptr_array_add (new, up_history_item_new_for_sample (time_s / count,
+									      value / count,
+									      state));
+			step++;
+			time_s = store->time[i];
+			value = values[i];
+			state = store->state[i];
+			count = 1;
+		} else {
+			count++;
+			time_s += store->time[i];
+			value += values[i];
+		}
+	}
+
+	/* only add if nonzero */
+	if (count > 0)
+		g_ptr_array_add (new, up_history_item_new_for_sample (time_s / count,
+								      value / count,
+								      state));
+
+	/* check length */
+	egg_debug ("length of array (after) %i", new->len);
+out:
+	return new;
+}
+
+/**
+ * up_history_points_add:
+ **/
+static void
+up_history_points_add (GArray *points, const UpHistoryStore *store, guint i, gdouble value)
+{
+	UpHistoryPoint point;
+
+	point.time = store->time[i];
+	point.value = value;
+	point.state = store->state[i];
+	g_array_append_val (points, point);
+}
+
+/**
+ * up_history_view_get_samples:
+ *
+ * Return value: the indexes of the samples in @view with a value for its
+ * history type, oldest first
+ **/
+static GArray *
+up_history_view_get_samples (const UpHistoryView *view)
+{
+	GArray *samples;
+	guint i;
+
+	samples = g_array_sized_new (FALSE, FALSE, sizeof (guint), view->end - view->start);
+	for (i=view->start; i<view->end; i++) {
+		if (up_history_store_has (view->store, i, view->metric))
+			g_array_append_val (samples, i);
+	}
+	return samples;
+}
+
+/**
+ * up_history_downsample_lttb:
+ * @view: The data we have for a specific graph
+ * @max_num: The max desired points
+ *
+ * Largest-Triangle-Three-Buckets keeps the first and last points, and
+ * splits the rest into equal buckets. From each bucket it keeps the point
+ * that makes the largest triangle with the point kept before it and the
+ * average of the next bucket, so spikes survive where averaging would
+ * flatten them.
+ *
+ * Return value: a #GArray of #UpHistoryPoint, oldest first
+ **/
+static GArray *
+up_history_downsample_lttb (const UpHistoryView *view, guint max_num)
+{
+	GArray *points;
+	GArray *samples;
+	const UpHistoryStore *store = view->store;
+	const gdouble *values = store->value[view->metric];
+	const guint *idx;
+	guint length;
+	guint last;
+	guint start;
+	guint end;
+	guint next_end;
+	guint chosen;
+	guint i;
+	guint j;
+	gdouble every;
+	gdouble avg_time;
+	gdouble avg_value;
+	gdouble area;
+	gdouble area_max;
+	guint32 time_first;
+
+	samples = up_history_view_get_samples (view);
+	idx = (const guint *) samples->data;
+	length = samples->len;
+	points = g_array_sized_new (FALSE, FALSE, sizeof (UpHistoryPoint), MIN (length, max_num));
+
+	/* nothing to reduce */
+	if (length <= max_num) {
+		for (i=0; i<length; i++)
+			up_history_points_add (points, store, idx[i], values[idx[i]]);
+		goto out;
+	}
+
+	/* too few points for any triangles */
+	if (max_num < 3) {
+		if (max_num > 0)
+			up_history_points_add (points, store, idx[0], values[idx[0]]);
+		if (max_num > 1)
+			up_history_points_add (points, store, idx[length-1], values[idx[length-1]]);
+		goto out;
+	}
+
+	every = (gdouble) (length - 2) / (max_num - 2);
+	time_first = store->time[idx[0]];
+	last = idx[0];
+	up_history_points_add (points, store, last, values[last]);
+	for (i=0; i<max_num-2; i++) {
+		start = 1 + (guint) (i * every);
+		end = 1 + (guint) ((i + 1) * every);
+		next_end = MIN (1 + (guint) ((i + 2) * every), length);
+
+		/* the next bucket is just the last point at the end */
+		avg_time = 0.0f;
+		avg_value = 0.0f;
+		for (j=end; j<next_end; j++) {
+			avg_time += store->time[idx[j]] - time_first;
+			avg_value += values[idx[j]];
+		}
+		avg_time /= next_end - end;
+		avg_value /= next_end - end;
+
+		chosen = idx[start];
+		area_max = -1.0f;
+		for (j=start; j<end; j++) {
+			area = fabs (((gdouble) store->time[last] - time_first - avg_time) *
+				     (values[idx[j]] - values[last]) -
+				     ((gdouble) store->time[last] - store->time[idx[j]]) *
+				     (avg_value - values[last]));
+			if (area > area_max) {
+				area_max = area;
+				chosen = idx[j];
+			}
+		}
+		up_history_points_add (points, store, chosen, values[chosen]);
+		last = chosen;
+	}
+	up_history_points_add (points, store, idx[length-1], values[idx[length-1]]);
+out:
+	g_array_free (samples, TRUE);
+	return points;
+}
+
+/**
+ * up_history_downsample_minmax:
+ * @view: The data we have for a specific graph
+ * @max_num: The max desired points
+ *
+ * Splits the time range into @max_num / 2 equal divisions and keeps the
+ * lowest and highest point of each, using the range of aggregate samples.
+ *
+ * Return value: a #GArray of #UpHistoryPoint, oldest first
+ **/
+static GArray *
+up_history_downsample_minmax (const UpHistoryView *view, guint max_num)
+{
+	GArray *points;
+	GArray *samples;
+	const UpHistoryStore *store = view->store;
+	const gdouble *min;
+	const gdouble *max;
+	const guint *idx;
+	guint length;
+	guint divisions;
+	guint division = G_MAXUINT;
+	guint div;
+	guint low = 0;
+	guint high = 0;
+	guint i;
+	gdouble width;
+
+	samples = up_history_view_get_samples (view);
+	idx = (const guint *) samples->data;
+	length = samples->len;
+	points = g_array_sized_new (FALSE, FALSE, sizeof (UpHistoryPoint), MIN (length, max_num));
+
+	min = store->aggregate ? store->min[view->metric] : store->value[view->metric];
+	max = store->aggregate ? store->max[view->metric] : store->value[view->metric];
+
+	/* nothing to reduce */
+	if (length <= max_num) {
+		for (i=0; i<length; i++)
+			up_history_points_add (points, store, idx[i], store->value[view->metric][idx[i]]);
+		goto out;
+	}
+
+	/* an envelope needs at least two points */
+	divisions = max_num / 2;
+	if (divisions == 0)
+		goto out;
+	width = (store->time[idx[length-1]] - store->time[idx[0]] + 1) / (gdouble) divisions;
+	for (i=0; i<=length; i++) {
+		div = G_MAXUINT - 1;
+		if (i < length)
+			div = (store->time[idx[i]] - store->time[idx[0]]) / width;
+
+		/* still the same division */
+		if (div == division) {
+			if (min[idx[i]] < min[low])
+				low = idx[i];
+			if (max[idx[i]] > max[high])
+				high = idx[i];
+			continue;
+		}
+
+		/* keep the extremes of the last division in time order */
+		if (division != G_MAXUINT) {
+			if (low == high && min[low] == max[high]) {
+				up_history_points_add (points, store, low, min[low]);
+			} else if (low <= high) {
+				up_history_points_add (points, store, low, min[low]);
+				up_history_points_add (points, store, high, max[high]);
+			} else {
+				up_history_points_add (points, store, high, max[high]);
+				up_history_points_add (points, store, low, min[low]);
+			}
+		}
+		if (i == length)
+			break;
+		division = div;
+		low = idx[i];
+		high = idx[i];
+	}
+out:
+	g_array_free (samples, TRUE);
+	return points;
+}
+
+/**
+ * up_history_get_view_timespan:
+ *
+ * Finds the samples in the last @timespan seconds without copying them.
+ *
+ * Return value: %FALSE if there is no data
+ **/
+static gboolean
+up_history_get_view_timespan (const UpHistoryStore *store, UpHistoryType metric, guint timespan,
+			      guint32 now, UpHistoryView *view)
+{
+	/* no data */
+	if (store->len == 0)
+		return FALSE;
+
+	egg_debug ("limiting data to last %i seconds", timespan);
+
+	/* treat the timespan like a range */
+	timespan *= 0.95f;
+	view->store = store;
+	view->metric = metric;
+	view->start = 0;
+	view->expires = now;
+	if (now > timespan)
+		view->start = up_history_store_find_time (store, now - timespan);
+	view->end = store->len;
+
+	/* the window only changes when a sample leaves it */
+	if (view->start == view->end)
+		view->expires = G_MAXUINT32;
+	else if (now > timespan)
+		view->expires = MIN ((guint64) store->time[view->start] + timespan, G_MAXUINT32);
+	return TRUE;
+}
+
+/**
+ * up_history_result_ref:
+ **/
+static gpointer
+up_history_result_ref (gpointer result, UpHistoryDownsample method)
+{
+	if (method == UP_HISTORY_DOWNSAMPLE_AVERAGE)
+		return g_ptr_array_ref (result);
+	return g_array_ref (result);
+}
+
+/**
+ * up_history_result_unref:
+ **/
+static void
+up_history_result_unref (gpointer result, UpHistoryDownsample method)
+{
+	if (method == UP_HISTORY_DOWNSAMPLE_AVERAGE)
+		g_ptr_array_unref (result);
+	else
+		g_array_unref (result);
+}
+
+/**
+ * up_history_cache_lookup:
+ *
+ * Return value: a valid cached result, or %NULL
+ **/
+static UpHistoryCacheEntry *
+up_history_cache_lookup (UpHistory *history, UpHistoryType type, guint timespan, guint resolution,
+			 UpHistoryDownsample method, guint generation, guint32 now)
+{
+	guint i;
+	UpHistoryCacheEntry *entry;
+
+	for (i=0; i<UP_HISTORY_CACHE_SIZE; i++) {
+		entry = &history->priv->cache[i];
+		if (entry->result != NULL &&
+		    entry->type == type &&
+		    entry->timespan == timespan &&
+		    entry->resolution == resolution &&
+		    entry->method == method &&
+		    entry->generation == generation &&
+		    now < entry->expires) {
+			entry->used = ++history->priv->cache_used;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * up_history_cache_insert:
+ *
+ * Replaces the entry with the same key if there is one, and otherwise the
+ * least recently used entry.
+ **/
+static void
+up_history_cache_insert (UpHistory *history, UpHistoryType type, guint timespan, guint resolution,
+			 UpHistoryDownsample method, guint generation, guint32 expires, gpointer result)
+{
+	guint i;
+	UpHistoryCacheEntry *entry = NULL;
+	UpHistoryCacheEntry *tmp;
+
+	for (i=0; i<UP_HISTORY_CACHE_SIZE; i++) {
+		tmp = &history->priv->cache[i];
+		if (tmp->result != NULL &&
+		    tmp->type == type &&
+		    tmp->timespan == timespan &&
+		    tmp->resolution == resolution &&
+		    tmp->method == method) {
+			entry = tmp;
+			break;
+		}
+		if (entry == NULL || tmp->used < entry->used)
+			entry = tmp;
+	}
+
+	if (entry->result != NULL)
+		up_history_result_unref (entry->result, entry->method);
+	entry->result = up_history_result_ref (result, method);
+	entry->type = type;
+	entry->timespan = timespan;
+	entry->resolution = resolution;
+	entry->method = method;
+	entry->generation = generation;
+	entry->expires = expires;
+	entry->used = ++history->priv->cache_used;
+}
+
+/**
+ * up_history_cache_clear:
+ **/
+static void
+up_history_cache_clear (UpHistory *history)
+{
+	guint i;
+	UpHistoryCacheEntry *entry;
+
+	for (i=0; i<UP_HISTORY_CACHE_SIZE; i++) {
+		entry = &history->priv->cache[i];
+		if (entry->result != NULL)
+			up_history_result_unref (entry->result, entry->method);
+		entry->result = NULL;
+	}
+}
+
+/**
+ * up_history_get_cache_stats:
+ * @history: a #UpHistory
+ * @hits: the returned number of results served from the cache, or %NULL
+ * @misses: the returned number of results that had to be computed, or %NULL
+ **/
+void
+up_history_get_cache_stats (UpHistory *history, guint *hits, guint *misses)
+{
+	g_return_if_fail (UP_IS_HISTORY (history));
+
+	if (hits != NULL)
+		*hits = history->priv->cache_hits;
+	if (misses != NULL)
+		*misses = history->priv->cache_misses;
+}
+
+/**
+ * up_history_get_result:
+ *
+ * The result is shared with the cache, so it must not be modified.
+ *
+ * Return value: a #GPtrArray of #UpHistoryItem for the average method, and
+ * otherwise a #GArray of #UpHistoryPoint, or %NULL if there is no data
+ **/
+static gpointer
+up_history_get_result (UpHistory *history, UpHistoryType type, guint timespan,
+		       guint resolution, UpHistoryDownsample method)
+{
+	UpHistoryView view;
+	UpHistoryStore *store_flat = NULL;
+	UpHistoryCacheEntry *entry;
+	gpointer result = NULL;
+	const UpHistorySeries *array_data;
+	const UpHistoryStore *store_data;
+	guint32 now;
+	guint raw_age;
+
+	if (history->priv->id == NULL)
+		return NULL;
+
+	/* the old data is not there yet */
+	if (history->priv->load != NULL)
+		return NULL;
+
+	/* not recognised */
+	if (type >= UP_HISTORY_METRICS)
+		return NULL;
+	array_data = history->priv->data;
+
+	/* clients tend to poll with the same arguments */
+	now = up_history_get_time_now ();
+	entry = up_history_cache_lookup (history, type, timespan, resolution, method,
+					 array_data->generation[type], now);
+	if (entry != NULL) {
+		history->priv->cache_hits++;
+		return up_history_result_ref (entry->result, method);
+	}
+	history->priv->cache_misses++;
+
+	/* the older data is only in the coarser tiers */
+	store_data = array_data->tier[UP_HISTORY_TIER_RAW];
+	raw_age = history->priv->max_age[UP_HISTORY_TIER_RAW];
+	if (type == UP_HISTORY_TYPE_CAPACITY) {
+		store_data = array_data->capacity;
+	} else if (raw_age != 0 && timespan > raw_age && timespan < now) {
+		store_flat = up_history_series_flatten (array_data, now - timespan);
+		store_data = store_flat;
+	}
+
+	/* only return a certain time, and only add a certain number of points */
+	if (up_history_get_view_timespan (store_data, type, timespan, now, &view)) {
+		if (method == UP_HISTORY_DOWNSAMPLE_LTTB)
+			result = up_history_downsample_lttb (&view, resolution);
+		else if (method == UP_HISTORY_DOWNSAMPLE_MINMAX)
+			result = up_history_downsample_minmax (&view, resolution);
+		else
+			result = up_history_array_limit_resolution (&view, resolution);
+		up_history_cache_insert (history, type, timespan, resolution, method,
+					 array_data->generation[type], view.expires, result);
+	}
+	if (store_flat != NULL)
+		up_history_store_free (store_flat);
+
+	return result;
+}
+
+/**
+ * up_history_get_data:
+ *
+ * The result is shared with the cache, so it must not be modified.
+ **/
+GPtrArray *
+up_history_get_data (UpHistory *history, UpHistoryType type, guint timespan, guint resolution)
+{
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+	return up_history_get_result (history, type, timespan, resolution, UP_HISTORY_DOWNSAMPLE_AVERAGE);
+}
+
+/**
+ * up_history_get_data_downsampled:
+ * @history: a #UpHistory
+ * @type: the type of history
+ * @timespan: the amount of data to return in seconds
+ * @resolution: the maximum number of points
+ * @method: how to reduce the data to @resolution points
+ *
+ * Unlike up_history_get_data(), the points are returned oldest first for
+ * every method.
+ *
+ * Return value: a #GArray of #UpHistoryPoint, which must not be modified,
+ * or %NULL if there is no data
+ **/
+GArray *
+up_history_get_data_downsampled (UpHistory *history, UpHistoryType type, guint timespan,
+				 guint resolution, UpHistoryDownsample method)
+{
+	GPtrArray *array;
+	GArray *points;
+	UpHistoryItem *item;
+	UpHistoryPoint point;
+	gint i;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+	g_return_val_if_fail (method < UP_HISTORY_DOWNSAMPLE_UNKNOWN, NULL);
+
+	if (method != UP_HISTORY_DOWNSAMPLE_AVERAGE)
+		return up_history_get_result (history, type, timespan, resolution, method);
+
+	/* the averaging predates the points, and can be newest first */
+	array = up_history_get_data (history, type, timespan, resolution);
+	if (array == NULL)
+		return NULL;
+	points = g_array_sized_new (FALSE, FALSE, sizeof (UpHistoryPoint), array->len);
+	for (i=0; i<(gint) array->len; i++) {
+		item = g_ptr_array_index (array, i);
+		point.time = up_history_item_get_time (item);
+		point.value = up_history_item_get_value (item);
+		point.state = up_history_item_get_state (item);
+		g_array_append_val (points, point);
+	}
+	if (points->len > 1 &&
+	    g_array_index (points, UpHistoryPoint, 0).time > g_array_index (points, UpHistoryPoint, points->len - 1).time) {
+		for (i=0; i<(gint) points->len / 2; i++) {
+			point = g_array_index (points, UpHistoryPoint, i);
+			g_array_index (points, UpHistoryPoint, i) = g_array_index (points, UpHistoryPoint, points->len - 1 - i);
+			g_array_index (points, UpHistoryPoint, points->len - 1 - i) = point;
+		}
+	}
+	g_ptr_array_unref (array);
+	return points;
+}
+
+/**
+ * up_history_get_data_since:
+ * @history: a #UpHistory
+ * @type: the type of history
+ * @since: only samples newer than this are returned
+ * @generation: the location to store the rewrite generation, or %NULL
+ *
+ * Gets the samples that have arrived since a client last asked, at full
+ * resolution. Samples are only appended while @generation stays the same;
+ * when older samples are expired, rolled up or replaced by a load it
+ * changes, and the client should fetch the whole history again. As times
+ * are in whole seconds, it also changes when a sample is added in the
+ * second of an earlier call, which a @since of that second would miss.
+ *
+ * Return value: a new #GArray of #UpHistoryPoint, oldest first, or %NULL
+ * if the history is not available yet
+ **/
+GArray *
+up_history_get_data_since (UpHistory *history, UpHistoryType type, guint32 since, guint *generation)
+{
+	GArray *points;
+	UpHistoryStore *store_flat = NULL;
+	UpHistorySeries *series;
+	const UpHistoryStore *store;
+	guint i;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+
+	if (history->priv->id == NULL)
+		return NULL;
+
+	/* the old data is not there yet */
+	if (history->priv->load != NULL)
+		return NULL;
+
+	/* not recognised */
+	if (type >= UP_HISTORY_METRICS)
+		return NULL;
+	series = history->priv->data;
+	series->served = up_history_get_time_now ();
+	if (generation != NULL)
+		*generation = series->rewrites;
+
+	/* nothing can be newer */
+	points = g_array_new (FALSE, FALSE, sizeof (UpHistoryPoint));
+	if (since == G_MAXUINT32)
+		return points;
+
+	/* a client that is keeping up only needs the hot raw samples */
+	store = series->tier[UP_HISTORY_TIER_RAW];
+	if (type == UP_HISTORY_TYPE_CAPACITY) {
+		store = series->capacity;
+	} else if (store->segments->len > 0 || store->len == 0 || store->time[0] > since) {
+		store_flat = up_history_series_flatten (series, since + 1);
+		store = store_flat;
+	}
+	for (i=up_history_store_find_time (store, since); i<store->len; i++) {
+		if (up_history_store_has (store, i, type))
+			up_history_points_add (points, store, i, store->value[type][i]);
+	}
+	if (store_flat != NULL)
+		up_history_store_free (store_flat);
+	return points;
+}
+
+/**
+ * up_history_profile_new:
+ **/
+static UpHistoryProfile *
+up_history_profile_new (void)
+{
+	UpHistoryProfile *profile;
+
+	profile = g_new0 (UpHistoryProfile, 1);
+	profile->oldbin = 999;
+	return profile;
+}
+
+/**
+ * up_history_profile_add:
+ *
+ * Folds one charge sample into the profile, timing how long the charge
+ * takes to move between adjacent whole percentages in a single state.
+ **/
+static void
+up_history_profile_add (UpHistoryProfile *profile, guint32 time_s, gdouble value, UpDeviceState state)
+{
+	guint i;
+	guint bin;
+	gdouble diff;
+
+	if (!profile->has_last ||
+	    state != profile->last_state) {
+		profile->has_old = FALSE;
+		goto out;
+	}
+
+	/* round to the nearest int */
+	bin = rint (value);
+
+	/* ensure bin is in range */
+	if (bin >= UP_HISTORY_PROFILE_BINS)
+		bin = UP_HISTORY_PROFILE_BINS - 1;
+
+	/* same */
+	if (profile->oldbin == bin)
+		goto out;
+
+	profile->oldbin = bin;
+	if (profile->has_old) {
+		/* not enough or too much difference */
+		diff = fabs (value - profile->old_value);
+		if (diff < 0.01f || diff > 3.0f) {
+			profile->has_old = FALSE;
+			goto out;
+		}
+
+		if (state == UP_DEVICE_STATE_CHARGING || state == UP_DEVICE_STATE_DISCHARGING) {
+			i = state == UP_DEVICE_STATE_CHARGING ? 1 : 0;
+			profile->sum[i][bin] += time_s - profile->old_time;
+			profile->count[i][bin]++;
+		}
+	}
+	profile->has_old = TRUE;
+	profile->old_time = time_s;
+	profile->old_value = value;
+out:
+	profile->has_last = TRUE;
+	profile->last_state = state;
+	profile->dirty = TRUE;
+}
+
+/**
+ * up_history_get_profile_data:
+ **/
+GPtrArray *
+up_history_get_profile_data (UpHistory *history, gboolean charging)
+{
+	guint i;
+	guint j;
+	guint non_zero_accuracy = 0;
+	gfloat average = 0.0f;
+	UpStatsItem *stats;
+	const UpHistoryProfile *profile;
+	GPtrArray *data;
+	gdouble total_value = 0.0f;
+	gdouble value;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+
+	/* find non-zero accuracy values for the average */
+	profile = history->priv->profile;
+	j = charging ? 1 : 0;
+	for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
+		if (profile->count[j][i] > 0) {
+			total_value += profile->sum[j][i] / profile->count[j][i];
+			non_zero_accuracy++;
+		}
+	}
+
+	/* average */
+	if (non_zero_accuracy != 0)
+		average = total_value / non_zero_accuracy;
+	egg_debug ("average is %f", average);
+
+	data = g_ptr_array_new ();
+	for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
+		stats = up_stats_item_new ();
+
+		/* make the values a factor of 0, so that 1.0 is twice the
+		 * average, and -1.0 is half the average */
+		value = 0.0f;
+		if (profile->count[j][i] > 0)
+			value = (profile->sum[j][i] / profile->count[j][i] - average) / average;
+		up_stats_item_set_value (stats, value);
+
+		/* accuracy is a percentage scale, where each cycle = 20% */
+		up_stats_item_set_accuracy (stats, profile->count[j][i] * 20.0f);
+		g_ptr_array_add (data, stats);
+	}
+
+	return data;
+}
+
+/**
+ * up_history_statistics_weigh:
+ * @n: the number of points
+ * @time_s: the time of each point
+ * @value: the charge of each point
+ * @mask: 1.0 where the point is in the wanted state, and 0.0 elsewhere
+ * @limit: the largest change of charge between two points
+ * @weight: the returned time taken to get to each point, or 0.0
+ * @hit: the returned 1.0 if the time to get to the point is used, or 0.0
+ *
+ * Works on whole columns, with the tests turned into factors of 0.0 or 1.0
+ * rather than branches, so that the compiler can vectorize the loop.
+ **/
+static void
+up_history_statistics_weigh (guint n, const gdouble *time_s, const gdouble *value, const gdouble *mask,
+			     gdouble limit, gdouble *weight, gdouble *hit)
+{
+	guint i;
+	gdouble diff;
+	gdouble low;
+	gdouble high;
+	gdouble ok;
+
+	for (i=1; i<n; i++) {
+		diff = fabs (value[i] - value[i-1]);
+		low = diff >= 0.01f ? 1.0f : 0.0f;
+		high = diff <= limit ? 1.0f : 0.0f;
+		ok = mask[i] * mask[i-1] * low * high;
+		weight[i] = ok * (time_s[i] - time_s[i-1]);
+		hit[i] = ok;
+	}
+}
+
+/**
+ * up_history_get_statistics:
+ * @charging: %TRUE for the charge profile, %FALSE for the discharge profile
+ * @bins: the number of bins from 0% to 100%, at least 2
+ * @timespan: how far back to look, in seconds, or 0 for all the history
+ * @values: the returned time taken to cross each bin, as a factor of the average
+ * @accuracies: the returned accuracy of each bin, in percent
+ *
+ * Computes a profile like up_history_get_profile_data() over a range
+ * of the history, rather than using the running totals which are only kept
+ * for each percent of all the history. The points where the charge moves
+ * to another bin are first copied into contiguous columns, so that only
+ * adding up the bins is not vectorized.
+ *
+ * Return value: %FALSE if the history is still being read from disk, or
+ * @bins is out of range
+ **/
+gboolean
+up_history_get_statistics (UpHistory *history, gboolean charging, guint bins, guint timespan,
+			   GArray **values, GArray **accuracies)
+{
+	guint i;
+	guint n = 0;
+	guint bin;
+	guint32 now;
+	guint32 start = 1;
+	gdouble scale;
+	gdouble limit;
+	gdouble total = 0.0f;
+	gdouble non_zero = 0.0f;
+	gdouble average;
+	gdouble inverse;
+	gdouble *time_s;
+	gdouble *value;
+	gdouble *mask;
+	gdouble *weight;
+	gdouble *hit;
+	gdouble *sum;
+	gdouble *count;
+	gdouble *mean;
+	gdouble *out_value;
+	gdouble *out_accuracy;
+	guint *index;
+	guint8 *state;
+	UpDeviceState want;
+	UpHistoryStore *store;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+	g_return_val_if_fail (values != NULL, FALSE);
+	g_return_val_if_fail (accuracies != NULL, FALSE);
+
+	if (history->priv->load != NULL)
+		return FALSE;
+	if (bins < 2 || bins > UP_HISTORY_STATISTICS_BINS_MAX)
+		return FALSE;
+
+	now = up_history_get_time_now ();
+	if (timespan > 0 && timespan < now)
+		start = now - timespan;
+	store = up_history_series_flatten (history->priv->data, start);
+
+	/* bins are spread evenly, so 101 bins are one for each percent, and
+	 * the charge may move up to three bins between two points */
+	scale = (bins - 1) / 100.0f;
+	limit = 3.0f / scale;
+	want = charging ? UP_DEVICE_STATE_CHARGING : UP_DEVICE_STATE_DISCHARGING;
+
+	time_s = g_new (gdouble, store->len + 1);
+	value = g_new (gdouble, store->len + 1);
+	mask = g_new (gdouble, store->len + 1);
+	weight = g_new (gdouble, store->len + 1);
+	hit = g_new (gdouble, store->len + 1);
+	index = g_new (guint, store->len + 1);
+	state = g_new (guint8, store->len + 1);
+
+	/* only keep the points where the charge moves to another bin or the
+	 * state changes, as the time is measured from when it got there */
+	for (i=0; i<store->len; i++) {
+		if (!up_history_store_has (store, i, UP_HISTORY_TYPE_CHARGE))
+			continue;
+		bin = CLAMP (rint (store->value[UP_HISTORY_TYPE_CHARGE][i] * scale), 0, bins - 1);
+		if (n > 0 && index[n-1] == bin && state[n-1] == store->state[i])
+			continue;
+		time_s[n] = store->time[i];
+		value[n] = store->value[UP_HISTORY_TYPE_CHARGE][i];
+		mask[n] = (store->state[i] == want);
+		index[n] = bin;
+		state[n] = store->state[i];
+		n++;
+	}
+	up_history_store_free (store);
+
+	up_history_statistics_weigh (n, time_s, value, mask, limit, weight, hit);
+
+	/* the bins are written in no particular order */
+	sum = g_new0 (gdouble, bins);
+	count = g_new0 (gdouble, bins);
+	for (i=1; i<n; i++) {
+		sum[index[i]] += weight[i];
+		count[index[i]] += hit[i];
+	}
+
+	/* the average time over the bins that have any */
+	mean = g_new (gdouble, bins);
+	for (i=0; i<bins; i++) {
+		mean[i] = sum[i] / MAX (count[i], 1.0f);
+		total += mean[i];
+		non_zero += (count[i] > 0.0f);
+	}
+	average = total / MAX (non_zero, 1.0f);
+	egg_debug ("average over %i bins is %f", bins, average);
+	inverse = 0.0f;
+	if (average > 0.0f)
+		inverse = 1.0f / average;
+
+	/* make the values a factor of 0, so that 1.0 is twice the average,
+	 * and -1.0 is half the average, where each cycle is 20% accuracy */
+	*values = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), bins);
+	*accuracies = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), bins);
+	g_array_set_size (*values, bins);
+	g_array_set_size (*accuracies, bins);
+	out_value = (gdouble *) (*values)->data;
+	out_accuracy = (gdouble *) (*accuracies)->data;
+	for (i=0; i<bins; i++) {
+		out_value[i] = (count[i] > 0.0f) * (mean[i] - average) * inverse;
+		out_accuracy[i] = count[i] * 20.0f;
+	}
+
+	g_free (time_s);
+	g_free (value);
+	g_free (mask);
+	g_free (weight);
+	g_free (hit);
+	g_free (index);
+	g_free (state);
+	g_free (sum);
+	g_free (count);
+	g_free (mean);
+	return TRUE;
+}
+
+/**
+ * up_history_cycles_new:
+ **/
+static UpHistoryCycles *
+up_history_cycles_new (void)
+{
+	UpHistoryCycles *cycles;
+
+	cycles = g_new0 (UpHistoryCycles, 1);
+	cycles->list = g_array_new (FALSE, FALSE, sizeof (UpHistoryCycle));
+	return cycles;
+}
+
+/**
+ * up_history_cycles_free:
+ **/
+static void
+up_history_cycles_free (UpHistoryCycles *cycles)
+{
+	g_array_unref (cycles->list);
+	g_free (cycles);
+}
+
+/**
+ * up_history_cycles_add:
+ * @metric: the history type of @value, or %UP_HISTORY_TYPE_UNKNOWN if
+ *          only the state has changed
+ *
+ * Extends the newest cycle, or starts a new one where it left off if the
+ * state has changed.
+ **/
+static void
+up_history_cycles_add (UpHistoryCycles *cycles, guint32 time_s, UpHistoryType metric,
+		       gdouble value, UpDeviceState state)
+{
+	UpHistoryCycle *cycle = NULL;
+	UpHistoryCycle cycle_new;
+	gdouble energy;
+
+	/* the marker of a restart, after which the rate is not known */
+	if (state == UP_DEVICE_STATE_UNKNOWN) {
+		cycles->has_rate = FALSE;
+		return;
+	}
+
+	/* the energy since the last sample belongs to the cycle it was in */
+	if (cycles->list->len > 0)
+		cycle = &g_array_index (cycles->list, UpHistoryCycle, cycles->list->len - 1);
+	if (cycle != NULL && cycles->has_rate && time_s > cycles->rate_time) {
+		energy = cycles->rate * (time_s - cycles->rate_time) / 3600.0f;
+		if (cycle->state == UP_DEVICE_STATE_DISCHARGING)
+			energy = -energy;
+		cycle->energy += energy;
+	}
+	cycles->rate_time = time_s;
+
+	if (cycle == NULL || cycle->state != state) {
+		cycle_new.time_start = time_s;
+		cycle_new.time_end = time_s;
+		cycle_new.state = state;
+		cycle_new.percentage_start = cycles->percentage;
+		cycle_new.percentage_end = cycles->percentage;
+		cycle_new.energy = 0.0f;
+		g_array_append_val (cycles->list, cycle_new);
+		cycle = &g_array_index (cycles->list, UpHistoryCycle, cycles->list->len - 1);
+	}
+	cycle->time_end = time_s;
+
+	if (metric == UP_HISTORY_TYPE_CHARGE) {
+		if (!cycles->has_percentage)
+			cycle->percentage_start = value;
+		cycle->percentage_end = value;
+		cycles->percentage = value;
+		cycles->has_percentage = TRUE;
+	} else if (metric == UP_HISTORY_TYPE_RATE) {
+		cycles->rate = value;
+		cycles->has_rate = TRUE;
+	}
+	cycles->dirty = TRUE;
+}
+
+/**
+ * up_history_cycles_add_sample:
+ *
+ * Adds the charge and rate of the hot sample @i of @store.
+ **/
+static void
+up_history_cycles_add_sample (UpHistoryCycles *cycles, const UpHistoryStore *store, guint i)
+{
+	if (up_history_store_has (store, i, UP_HISTORY_TYPE_CHARGE))
+		up_history_cycles_add (cycles, store->time[i], UP_HISTORY_TYPE_CHARGE,
+				       store->value[UP_HISTORY_TYPE_CHARGE][i], store->state[i]);
+	if (up_history_store_has (store, i, UP_HISTORY_TYPE_RATE))
+		up_history_cycles_add (cycles, store->time[i], UP_HISTORY_TYPE_RATE,
+				       store->value[UP_HISTORY_TYPE_RATE][i], store->state[i]);
+}
+
+/**
+ * up_history_cycles_find_time:
+ *
+ * The cycles follow on from each other, so they can be bisected.
+ *
+ * Return value: the index of the first cycle that ends at or after @time_s
+ **/
+static guint
+up_history_cycles_find_time (const UpHistoryCycles *cycles, guint32 time_s)
+{
+	guint low = 0;
+	guint high = cycles->list->len;
+	guint mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (g_array_index (cycles->list, UpHistoryCycle, mid).time_end >= time_s)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return low;
+}
+
+/**
+ * up_history_cycles_expire:
+ *
+ * Removes the cycles that ended before @time_s.
+ **/
+static void
+up_history_cycles_expire (UpHistoryCycles *cycles, guint32 time_s)
+{
+	guint count;
+
+	count = up_history_cycles_find_time (cycles, time_s);
+	if (count == 0)
+		return;
+	egg_debug ("expired %i cycles", count);
+	g_array_remove_range (cycles->list, 0, count);
+	cycles->dirty = TRUE;
+}
+
+/**
+ * up_history_get_cycles:
+ * @history: a #UpHistory
+ * @timespan: only the cycles that ended in this many seconds are returned,
+ *            or 0 for all of them
+ *
+ * Gets the runs of samples in the same state, such as each charge and
+ * discharge, without going through the samples.
+ *
+ * Return value: a new #GArray of #UpHistoryCycle, oldest first, or %NULL
+ * if the history is not available yet
+ **/
+GArray *
+up_history_get_cycles (UpHistory *history, guint timespan)
+{
+	GArray *array;
+	const UpHistoryCycles *cycles;
+	guint32 now;
+	guint start = 0;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+
+	if (history->priv->id == NULL)
+		return NULL;
+
+	/* the old cycles are not there yet */
+	if (history->priv->load != NULL)
+		return NULL;
+
+	cycles = history->priv->cycles;
+	now = up_history_get_time_now ();
+	if (timespan != 0 && timespan < now)
+		start = up_history_cycles_find_time (cycles, now - timespan);
+	array = g_array_sized_new (FALSE, FALSE, sizeof (UpHistoryCycle), cycles->list->len - start);
+	g_array_append_vals (array, &g_array_index (cycles->list, UpHistoryCycle, start),
+			     cycles->list->len - start);
+	return array;
+}
+
+/**
+ * up_history_get_filename:
+ * @type: the name of the data, or %NULL for the shared samples
+ **/
+static gchar *
+up_history_get_filename (UpHistory *history, const gchar *type, UpHistoryTier tier)
+{
+	gchar *path;
+	gchar *filename;
+
+	if (type == NULL && tier == UP_HISTORY_TIER_RAW)
+		filename = g_strdup_printf ("history-%s.dat", history->priv->id);
+	else if (type == NULL)
+		filename = g_strdup_printf ("history-%s-%s.dat", up_history_tier_names[tier], history->priv->id);
+	else if (tier == UP_HISTORY_TIER_RAW)
+		filename = g_strdup_printf ("history-%s-%s.dat", type, history->priv->id);
+	else
+		filename = g_strdup_printf ("history-%s-%s-%s.dat", type,
+					    up_history_tier_names[tier], history->priv->id);
+	path = g_build_filename (history->priv->dir, filename, NULL);
+	g_free (filename);
+	return path;
+}
+
+/**
+ * up_history_write_uint32:
+ **/
+static void
+up_history_write_uint32 (guint8 *buf, guint32 value)
+{
+	value = GUINT32_TO_LE (value);
+	memcpy (buf, &value, sizeof (value));
+}
+
+/**
+ * up_history_read_uint32:
+ **/
+static guint32
+up_history_read_uint32 (const guint8 *buf)
+{
+	guint32 value;
+	memcpy (&value, buf, sizeof (value));
+	return GUINT32_FROM_LE (value);
+}
+
+/**
+ * up_history_checksum:
+ *
+ * FNV-1a, which is cheap and good enough to spot torn or corrupted records.
+ **/
+static guint32
+up_history_checksum (const guint8 *buf, gsize len)
+{
+	guint32 hash = 2166136261u;
+	gsize i;
+
+	for (i=0; i<len; i++) {
+		hash ^= buf[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * up_history_header_encode:
+ **/
+static void
+up_history_header_encode (guint8 *buf, guint32 record_size)
+{
+	memcpy (buf, UP_HISTORY_FILE_MAGIC, 8);
+	up_history_write_uint32 (buf + 8, UP_HISTORY_FILE_VERSION);
+	up_history_write_uint32 (buf + 12, record_size);
+}
+
+/**
+ * up_history_write_double:
+ **/
+static void
+up_history_write_double (guint8 *buf, gdouble value)
+{
+	guint64 bits;
+
+	memcpy (&bits, &value, sizeof (bits));
+	bits = GUINT64_TO_LE (bits);
+	memcpy (buf, &bits, sizeof (bits));
+}
+
+/**
+ * up_history_read_double:
+ **/
+static gdouble
+up_history_read_double (const guint8 *buf)
+{
+	guint64 bits;
+	gdouble value;
+
+	memcpy (&bits, buf, sizeof (bits));
+	bits = GUINT64_FROM_LE (bits);
+	memcpy (&value, &bits, sizeof (bits));
+	return value;
+}
+
+/**
+ * up_history_store_get_record_size:
+ **/
+static guint32
+up_history_store_get_record_size (const UpHistoryStore *store)
+{
+	if (store->aggregate)
+		return UP_HISTORY_FILE_AGGREGATE_SIZE;
+	return UP_HISTORY_FILE_RECORD_SIZE;
+}
+
+/**
+ * up_history_record_decode:
+ *
+ * Appends the version 1 record to @store, which decides the type of the record.
+ *
+ * Return value: %FALSE if the checksum does not match
+ **/
+static gboolean
+up_history_record_decode (const guint8 *buf, UpHistoryStore *store, UpHistoryType metric)
+{
+	gsize size;
+	guint32 time_s;
+	gdouble value;
+	UpDeviceState state;
+
+	size = up_history_store_get_record_size (store) - 4;
+	if (up_history_checksum (buf, size) != up_history_read_uint32 (buf + size))
+		return FALSE;
+
+	time_s = up_history_read_uint32 (buf);
+	state = up_history_read_uint32 (buf + 4);
+	value = up_history_read_double (buf + 8);
+	if (store->aggregate)
+		up_history_store_add_aggregate (store, time_s, metric, value,
+						up_history_read_double (buf + 16),
+						up_history_read_double (buf + 24),
+						up_history_read_uint32 (buf + 32),
+						state);
+	else
+		up_history_store_add (store, time_s, metric, value, state);
+	return TRUE;
+}
+
+/**
+ * up_history_block_append:
+ **/
+static void
+up_history_block_append (GByteArray *buf, const guint8 *payload, gsize length, guint count)
+{
+	guint8 header[UP_HISTORY_FILE_BLOCK_SIZE];
+	guint32 checksum;
+
+	up_history_write_uint32 (header, length);
+	up_history_write_uint32 (header + 4, count);
+	checksum = up_history_checksum (header, 8) ^ up_history_checksum (payload, length);
+	up_history_write_uint32 (header + 8, checksum);
+	g_byte_array_append (buf, header, UP_HISTORY_FILE_BLOCK_SIZE);
+	g_byte_array_append (buf, payload, length);
+}
+
+/**
+ * up_history_array_encode:
+ * @store: the samples
+ * @start: the first item to encode, which must be 0 or a hot sample
+ * @header: if the file header should be included
+ * @length: the returned size of the data
+ *
+ * Return value: the header and blocks, free with g_free()
+ **/
+static guint8 *
+up_history_array_encode (const UpHistoryStore *store, guint start, gboolean header, gsize *length)
+{
+	guint i;
+	guint end;
+	guint8 *payload;
+	gsize payload_length;
+	const UpHistorySegment *segment;
+	guint8 buf[UP_HISTORY_FILE_HEADER_SIZE];
+	GByteArray *data;
+
+	data = g_byte_array_new ();
+	if (header) {
+		up_history_header_encode (buf, up_history_store_get_record_size (store));
+		g_byte_array_append (data, buf, UP_HISTORY_FILE_HEADER_SIZE);
+	}
+
+	/* the cold segments are already encoded */
+	if (start == 0) {
+		for (i=0; i<store->segments->len; i++) {
+			segment = g_ptr_array_index (store->segments, i);
+			up_history_block_append (data, segment->data, segment->length, segment->count);
+		}
+	} else {
+		start -= store->cold_len;
+	}
+
+	for (i=start; i<store->len; i=end) {
+		end = MIN (i + UP_HISTORY_SEGMENT_SIZE, store->len);
+		payload = up_history_store_compress (store, i, end, &payload_length);
+		up_history_block_append (data, payload, payload_length, end - i);
+		g_free (payload);
+	}
+
+	*length = data->len;
+	return g_byte_array_free (data, FALSE);
+}
+
+/**
+ * up_history_data_to_file:
+ **/
+static gboolean
+up_history_data_to_file (const guint8 *data, gsize length, const gchar *filename)
+{
+	gboolean ret;
+	GError *error = NULL;
+
+	/* save to disk */
+	ret = g_file_set_contents (filename, (const gchar *) data, length, &error);
+	if (!ret) {
+		egg_warning ("failed to set data: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+	egg_debug ("saved %s", filename);
+out:
+	return ret;
+}
+
+/**
+ * up_history_array_to_file:
+ * @store: the samples
+ * @filename: a filename
+ *
+ * Saves a copy of the samples to a file
+ **/
+static gboolean
+up_history_array_to_file (const UpHistoryStore *store, const gchar *filename)
+{
+	guint8 *data;
+	gsize length;
+	gboolean ret;
+
+	/* generate data */
+	data = up_history_array_encode (store, 0, TRUE, &length);
+
+	/* save to disk */
+	ret = up_history_data_to_file (data, length, filename);
+	g_free (data);
+	return ret;
+}
+
+/**
+ * up_history_data_append_to_file:
+ **/
+static gboolean
+up_history_data_append_to_file (const guint8 *data, gsize length, const gchar *filename)
+{
+	gboolean ret = FALSE;
+	GError *error = NULL;
+	GFile *file;
+	GFileOutputStream *stream;
+
+	/* append to disk */
+	file = g_file_new_for_path (filename);
+	stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, &error);
+	if (stream == NULL) {
+		egg_warning ("failed to open %s: %s", filename, error->message);
+		g_error_free (error);
+		goto out;
+	}
+	ret = g_output_stream_write_all (G_OUTPUT_STREAM (stream), data, length, NULL, NULL, &error);
+	if (!ret) {
+		egg_warning ("failed to append data: %s", error->message);
+		g_error_free (error);
+		g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, NULL);
+		goto out;
+	}
+	ret = g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+	if (!ret) {
+		egg_warning ("failed to close %s: %s", filename, error->message);
+		g_error_free (error);
+		goto out;
+	}
+	egg_debug ("appended %" G_GSIZE_FORMAT " bytes to %s", length, filename);
+out:
+	if (stream != NULL)
+		g_object_unref (stream);
+	g_object_unref (file);
+	return ret;
+}
+
+/**
+ * up_history_array_append_to_file:
+ * @store: the samples
+ * @start: the first sample that is not yet in the file
+ * @filename: a filename
+ *
+ * Appends the new samples to an existing file
+ **/
+static gboolean
+up_history_array_append_to_file (const UpHistoryStore *store, guint start, const gchar *filename)
+{
+	guint8 *data;
+	gsize length;
+	gboolean ret;
+
+	/* generate data */
+	data = up_history_array_encode (store, start, FALSE, &length);
+
+	/* append to disk */
+	ret = up_history_data_append_to_file (data, length, filename);
+	g_free (data);
+	return ret;
+}
+
+/**
+ * up_history_file_sync:
+ *
+ * Waits for the contents of @filename to reach the disk.
+ **/
+static gboolean
+up_history_file_sync (const gchar *filename)
+{
+	gint fd;
+	gboolean ret = FALSE;
+
+	fd = g_open (filename, O_RDONLY, 0);
+	if (fd < 0) {
+		egg_warning ("failed to open %s: %s", filename, g_strerror (errno));
+		goto out;
+	}
+	if (fsync (fd) < 0) {
+		egg_warning ("failed to sync %s: %s", filename, g_strerror (errno));
+		goto out;
+	}
+	ret = TRUE;
+out:
+	if (fd >= 0)
+		close (fd);
+	return ret;
+}
+
+/**
+ * up_history_writer_job_free:
+ **/
+static void
+up_history_writer_job_free (UpHistoryWriterJob *job)
+{
+	if (job->snapshot != NULL)
+		up_history_store_free (job->snapshot);
+	g_free (job->data);
+	g_free (job->filename);
+	g_free (job);
+}
+
+/**
+ * up_history_writer_job_run:
+ **/
+static gboolean
+up_history_writer_job_run (UpHistoryWriterJob *job)
+{
+	gboolean ret;
+
+	if (job->snapshot == NULL && job->rewrite)
+		ret = up_history_data_to_file (job->data, job->length, job->filename);
+	else if (job->snapshot == NULL)
+		ret = up_history_data_append_to_file (job->data, job->length, job->filename);
+	else if (job->rewrite)
+		ret = up_history_array_to_file (job->snapshot, job->filename);
+	else
+		ret = up_history_array_append_to_file (job->snapshot, 0, job->filename);
+	if (ret && job->sync)
+		ret = up_history_file_sync (job->filename);
+	return ret;
+}
+
+/**
+ * up_history_writer_thread:
+ **/
+static gpointer
+up_history_writer_thread (UpHistoryWriter *writer)
+{
+	UpHistoryWriterJob *job;
+	gboolean ret;
+
+	g_mutex_lock (writer->mutex);
+	while (TRUE) {
+		while (g_queue_is_empty (writer->queue))
+			g_cond_wait (writer->cond, writer->mutex);
+		job = g_queue_pop_head (writer->queue);
+		g_cond_broadcast (writer->cond);
+		g_mutex_unlock (writer->mutex);
+
+		/* do the slow part without the lock held */
+		ret = up_history_writer_job_run (job);
+
+		g_mutex_lock (writer->mutex);
+		if (!ret)
+			g_hash_table_insert (writer->failed, g_strdup (job->filename), GINT_TO_POINTER (TRUE));
+		writer->pending--;
+		g_cond_broadcast (writer->cond);
+		up_history_writer_job_free (job);
+	}
+	return NULL;
+}
+
+/**
+ * up_history_writer_get:
+ *
+ * Return value: the writer, which is started the first time it is used
+ **/
+static UpHistoryWriter *
+up_history_writer_get (void)
+{
+	UpHistoryWriter *writer;
+	GError *error = NULL;
+
+	if (up_history_writer != NULL)
+		return up_history_writer;
+
+	writer = g_new0 (UpHistoryWriter, 1);
+	writer->mutex = g_mutex_new ();
+	writer->cond = g_cond_new ();
+	writer->queue = g_queue_new ();
+	writer->failed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	writer->thread = g_thread_create ((GThreadFunc) up_history_writer_thread, writer, FALSE, &error);
+	if (writer->thread == NULL) {
+		/* the jobs are run by up_history_writer_push() instead */
+		egg_warning ("failed to start history writer: %s", error->message);
+		g_error_free (error);
+	}
+	up_history_writer = writer;
+	return writer;
+}
+
+/**
+ * up_history_writer_queue:
+ * @job: the job, which the writer takes ownership of
+ **/
+static void
+up_history_writer_queue (UpHistoryWriterJob *job)
+{
+	UpHistoryWriter *writer;
+
+	writer = up_history_writer_get ();
+	if (writer->thread == NULL) {
+		if (!up_history_writer_job_run (job))
+			g_hash_table_insert (writer->failed, g_strdup (job->filename), GINT_TO_POINTER (TRUE));
+		up_history_writer_job_free (job);
+		return;
+	}
+
+	g_mutex_lock (writer->mutex);
+
+	/* wait for the writer to catch up if the disk is very slow */
+	while (g_queue_get_length (writer->queue) >= UP_HISTORY_WRITER_QUEUE_MAX)
+		g_cond_wait (writer->cond, writer->mutex);
+
+	g_queue_push_tail (writer->queue, job);
+	writer->pending++;
+	g_cond_broadcast (writer->cond);
+	g_mutex_unlock (writer->mutex);
+}
+
+/**
+ * up_history_writer_push:
+ * @snapshot: the samples to write, which the writer takes ownership of
+ * @filename: a filename
+ * @rewrite: %TRUE to replace the file, %FALSE to append to it
+ * @sync: %TRUE to wait for the file to reach the disk
+ **/
+static void
+up_history_writer_push (UpHistoryStore *snapshot, const gchar *filename, gboolean rewrite, gboolean sync)
+{
+	UpHistoryWriterJob *job;
+
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->snapshot = snapshot;
+	job->filename = g_strdup (filename);
+	job->rewrite = rewrite;
+	job->sync = sync;
+	up_history_writer_queue (job);
+}
+
+/**
+ * up_history_writer_push_data:
+ * @data: the file contents, which the writer takes ownership of
+ * @length: the size of @data
+ * @filename: a filename
+ * @rewrite: %TRUE to replace the file, %FALSE to append to it
+ * @sync: %TRUE to wait for the file to reach the disk
+ **/
+static void
+up_history_writer_push_data (guint8 *data, gsize length, const gchar *filename,
+			     gboolean rewrite, gboolean sync)
+{
+	UpHistoryWriterJob *job;
+
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->data = data;
+	job->length = length;
+	job->filename = g_strdup (filename);
+	job->rewrite = rewrite;
+	job->sync = sync;
+	up_history_writer_queue (job);
+}
+
+/**
+ * up_history_writer_take_failed:
+ *
+ * Return value: %TRUE if a write to @filename failed since the last call
+ **/
+static gboolean
+up_history_writer_take_failed (const gchar *filename)
+{
+	UpHistoryWriter *writer;
+	gboolean ret;
+
+	writer = up_history_writer_get ();
+	g_mutex_lock (writer->mutex);
+	ret = g_hash_table_remove (writer->failed, filename);
+	g_mutex_unlock (writer->mutex);
+	return ret;
+}
+
+/**
+ * up_history_array_save:
+ * @store: the samples
+ * @state: what we know about the file
+ * @filename: a filename
+ * @sync: %TRUE to wait for the file to reach the disk
+ *
+ * Queues only the samples added since the last save, and rewrites the
+ * whole file when it is damaged, in an old format, or has been appended
+ * to many times.
+ **/
+static gboolean
+up_history_array_save (UpHistoryStore *store, UpHistoryFileState *state, const gchar *filename,
+		       gboolean sync)
+{
+	guint total;
+
+	/* the last write failed, so the tail may now be torn */
+	if (up_history_writer_take_failed (filename))
+		state->compact = TRUE;
+
+	/* nothing to do */
+	total = up_history_store_get_total (store);
+	if (!state->compact && state->saved == total)
+		return TRUE;
+
+	if (state->compact ||
+	    state->saved > total ||
+	    state->appends >= UP_HISTORY_COMPACT_INTERVAL) {
+		up_history_writer_push (up_history_store_copy (store, 0), filename, TRUE, sync);
+		state->compact = FALSE;
+		state->appends = 0;
+	} else {
+		up_history_writer_push (up_history_store_copy (store, state->saved), filename, FALSE, sync);
+		state->appends++;
+	}
+	state->saved = total;
+
+	/* the snapshot has been taken, so the saved samples can be compressed */
+	if (store->aggregate)
+		up_history_store_freeze (store, state->saved);
+	return TRUE;
+}
+
+/**
+ * up_history_array_from_text:
+ * @store: the samples
+ * @metric: the history type of the file
+ * @data: the file contents
+ *
+ * Appends the samples from the legacy tab-separated format. The data is
+ * written back in the binary format on the next save.
+ **/
+static gboolean
+up_history_array_from_text (UpHistoryStore *store, UpHistoryType metric, const gchar *data)
+{
+	gchar **parts;
+	gchar **sections;
+	guint i;
+	guint length;
+
+	/* split by line ending */
+	parts = g_strsplit (data, "\n", 0);
+	length = g_strv_length (parts);
+	if (length == 0) {
+		egg_debug ("no data");
+		g_strfreev (parts);
+		return FALSE;
+	}
+
+	/* add valid entries */
+	egg_debug ("migrating %i items of legacy data", length);
+	for (i=0; i<length-1; i++) {
+		/* same format as up_history_item_to_string() */
+		sections = g_strsplit (parts[i], "\t", 0);
+		if (g_strv_length (sections) == 3)
+			up_history_store_add (store,
+					      atoi (sections[0]),
+					      metric,
+					      atof (sections[1]),
+					      up_device_state_from_string (sections[2]));
+		else
+			egg_warning ("invalid string: '%s'", parts[i]);
+		g_strfreev (sections);
+	}
+	g_strfreev (parts);
+	return TRUE;
+}
+
+/**
+ * up_history_array_from_records:
+ *
+ * Appends the samples from the version 1 format, skipping corrupt records.
+ **/
+static gboolean
+up_history_array_from_records (UpHistoryStore *store, UpHistoryType metric,
+			       const guint8 *data, gsize length, gboolean *compact)
+{
+	gsize offset;
+	guint32 record_size;
+	guint corrupt = 0;
+
+	/* a trailing partial record is from an interrupted write, so ignore it */
+	record_size = up_history_store_get_record_size (store);
+	for (offset = UP_HISTORY_FILE_HEADER_SIZE;
+	     offset + record_size <= length;
+	     offset += record_size) {
+		if (!up_history_record_decode (data + offset, store, metric))
+			corrupt++;
+	}
+	if (corrupt > 0)
+		egg_warning ("ignored %i corrupt records", corrupt);
+
+	/* the file is written back in the current format */
+	*compact = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_history_array_from_binary:
+ * @store: the samples
+ * @metric: the history type of a file from before the samples were
+ *          shared, or %UP_HISTORY_TYPE_UNKNOWN
+ * @data: the file contents
+ * @length: the size of @data
+ * @compact: set to %TRUE if the file should be rewritten
+ *
+ * Appends the samples from the binary format. Everything from the first
+ * damaged block onwards is dropped, as the sizes after it cannot be trusted.
+ **/
+static gboolean
+up_history_array_from_binary (UpHistoryStore *store, UpHistoryType metric,
+			      const guint8 *data, gsize length, gboolean *compact)
+{
+	guint32 version;
+	guint32 record_size;
+	guint32 size;
+	guint32 count;
+	guint32 checksum;
+	gsize offset;
+	gboolean ret;
+
+	version = up_history_read_uint32 (data + 8);
+	record_size = up_history_read_uint32 (data + 12);
+	if (metric == UP_HISTORY_TYPE_UNKNOWN)
+		ret = (version == UP_HISTORY_FILE_VERSION ||
+		       version == UP_HISTORY_FILE_VERSION_SHARED);
+	else
+		ret = (version == UP_HISTORY_FILE_VERSION_BLOCKS ||
+		       version == UP_HISTORY_FILE_VERSION_RECORDS);
+	if (!ret || record_size != up_history_store_get_record_size (store)) {
+		egg_warning ("unsupported history version %i with record size %i",
+			     version, record_size);
+		*compact = TRUE;
+		return FALSE;
+	}
+	if (version == UP_HISTORY_FILE_VERSION_RECORDS)
+		return up_history_array_from_records (store, metric, data, length, compact);
+
+	/* blocks in the current format cannot be appended to an older file */
+	if (version != UP_HISTORY_FILE_VERSION)
+		*compact = TRUE;
+
+	for (offset = UP_HISTORY_FILE_HEADER_SIZE;
+	     offset + UP_HISTORY_FILE_BLOCK_SIZE <= length;
+	     offset += UP_HISTORY_FILE_BLOCK_SIZE + size) {
+		size = up_history_read_uint32 (data + offset);
+		count = up_history_read_uint32 (data + offset + 4);
+		checksum = up_history_read_uint32 (data + offset + 8);
+
+		/* a trailing partial block is from an interrupted write */
+		if (size > length - offset - UP_HISTORY_FILE_BLOCK_SIZE)
+			break;
+		if (checksum != (up_history_checksum (data + offset, 8) ^
+				 up_history_checksum (data + offset + UP_HISTORY_FILE_BLOCK_SIZE, size)) ||
+		    !up_history_store_decompress (store, store->aggregate, version, metric,
+						  data + offset + UP_HISTORY_FILE_BLOCK_SIZE, size, count)) {
+			egg_warning ("ignoring corrupt block at offset %" G_GSIZE_FORMAT, offset);
+			break;
+		}
+	}
+
+	/* we can only append if every block was valid */
+	if (offset != length)
+		*compact = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_history_array_from_file:
+ * @store: the samples
+ * @metric: the history type of a file from before the samples were
+ *          shared, or %UP_HISTORY_TYPE_UNKNOWN
+ * @filename: a filename
+ * @compact: set to %TRUE if the file should be rewritten
+ *
+ * Appends the samples from a file
+ **/
+static gboolean
+up_history_array_from_file (UpHistoryStore *store, UpHistoryType metric,
+			    const gchar *filename, gboolean *compact)
+{
+	gboolean ret;
+	GError *error = NULL;
+	gchar *data = NULL;
+	gsize length;
+
+	/* anything other than a clean binary file gets written from scratch */
+	*compact = TRUE;
+
+	/* do we exist */
+	ret = g_file_test (filename, G_FILE_TEST_EXISTS);
+	if (!ret) {
+		egg_debug ("failed to get data from %s as file does not exist", filename);
+		goto out;
+	}
+
+	/* get contents */
+	ret = g_file_get_contents (filename, &data, &length, &error);
+	if (!ret) {
+		egg_warning ("failed to get data: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	/* legacy text file, which only ever had one history type */
+	if (length < UP_HISTORY_FILE_HEADER_SIZE ||
+	    memcmp (data, UP_HISTORY_FILE_MAGIC, 8) != 0) {
+		egg_debug ("%s is in the legacy format", filename);
+		ret = FALSE;
+		if (metric != UP_HISTORY_TYPE_UNKNOWN)
+			ret = up_history_array_from_text (store, metric, data);
+		goto out;
+	}
+
+	egg_debug ("loading data from %s", filename);
+	*compact = FALSE;
+	ret = up_history_array_from_binary (store, metric, (const guint8 *) data, length, compact);
+out:
+	g_free (data);
+	return ret;
+}
+
+/**
+ * up_history_series_save:
+ *
+ * The files are synced when there is a journal, as it is emptied once
+ * they have been written.
+ **/
+static void
+up_history_series_save (UpHistory *history, UpHistorySeries *series)
+{
+	guint i;
+	gchar *filename;
+	gboolean sync;
+
+	sync = (history->priv->journal_interval > 0);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		filename = up_history_get_filename (history, NULL, i);
+		up_history_array_save (series->tier[i], &series->file[i], filename, sync);
+		g_free (filename);
+	}
+
+	/* most devices never have a capacity */
+	if (up_history_store_get_total (series->capacity) == 0)
+		return;
+	filename = up_history_get_filename (history, "capacity", UP_HISTORY_TIER_RAW);
+	up_history_array_save (series->capacity, &series->capacity_file, filename, sync);
+	g_free (filename);
+}
+
+/**
+ * up_history_store_merge:
+ * @store: the samples
+ * @sources: a store for each history type, which only has that type
+ *
+ * Appends the samples of @sources in time order, so that the values from
+ * the same time and state share a sample.
+ **/
+static void
+up_history_store_merge (UpHistoryStore *store, UpHistoryStore **sources)
+{
+	guint pos[UP_HISTORY_LEGACY_METRICS];
+	const UpHistoryStore *src;
+	guint best;
+	guint i;
+	guint j;
+
+	memset (pos, 0, sizeof (pos));
+	while (TRUE) {
+		best = UP_HISTORY_LEGACY_METRICS;
+		for (j=0; j<UP_HISTORY_LEGACY_METRICS; j++) {
+			if (pos[j] >= sources[j]->len)
+				continue;
+			if (best == UP_HISTORY_LEGACY_METRICS ||
+			    sources[j]->time[pos[j]] < sources[best]->time[pos[best]])
+				best = j;
+		}
+		if (best == UP_HISTORY_LEGACY_METRICS)
+			break;
+
+		src = sources[best];
+		i = pos[best]++;
+		if (src->aggregate)
+			up_history_store_add_aggregate (store, src->time[i], best, src->value[best][i],
+							src->min[best][i], src->max[best][i],
+							src->count[best][i], src->state[i]);
+		else
+			up_history_store_add (store, src->time[i], best, src->value[best][i], src->state[i]);
+	}
+}
+
+/**
+ * up_history_series_load_legacy:
+ *
+ * Merges the files that each history type was kept in before the samples
+ * were shared. They are removed once the shared file has been written.
+ **/
+static void
+up_history_series_load_legacy (UpHistory *history, UpHistorySeries *series, UpHistoryTier tier)
+{
+	guint i;
+	gchar *filename;
+	gboolean compact;
+	UpHistoryStore *sources[UP_HISTORY_LEGACY_METRICS];
+
+	for (i=0; i<UP_HISTORY_LEGACY_METRICS; i++) {
+		sources[i] = up_history_store_new (series->tier[tier]->aggregate);
+		filename = up_history_get_filename (history, up_history_type_names[i], tier);
+		up_history_array_from_file (sources[i], i, filename, &compact);
+		g_free (filename);
+	}
+	up_history_store_merge (series->tier[tier], sources);
+	for (i=0; i<UP_HISTORY_LEGACY_METRICS; i++)
+		up_history_store_free (sources[i]);
+
+	/* the shared file has to be written from scratch */
+	series->file[tier].compact = TRUE;
+}
+
+/**
+ * up_history_series_remove_legacy:
+ **/
+static void
+up_history_series_remove_legacy (UpHistory *history, UpHistoryTier tier)
+{
+	guint i;
+	gchar *filename;
+
+	for (i=0; i<UP_HISTORY_LEGACY_METRICS; i++) {
+		filename = up_history_get_filename (history, up_history_type_names[i], tier);
+		if (g_unlink (filename) == 0)
+			egg_debug ("removed migrated %s", filename);
+		g_free (filename);
+	}
+}
+
+/**
+ * up_history_series_load:
+ **/
+static void
+up_history_series_load (UpHistory *history, UpHistorySeries *series)
+{
+	guint i;
+	gchar *filename;
+
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		filename = up_history_get_filename (history, NULL, i);
+		if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+			up_history_array_from_file (series->tier[i], UP_HISTORY_TYPE_UNKNOWN,
+						    filename, &series->file[i].compact);
+			if (!history->priv->read_only)
+				up_history_series_remove_legacy (history, i);
+		} else {
+			up_history_series_load_legacy (history, series, i);
+		}
+		if (up_history_store_sort (series->tier[i]))
+			series->file[i].compact = TRUE;
+		series->file[i].saved = up_history_store_get_total (series->tier[i]);
+		if (series->tier[i]->aggregate)
+			up_history_store_freeze (series->tier[i], series->file[i].saved);
+		g_free (filename);
+	}
+
+	filename = up_history_get_filename (history, "capacity", UP_HISTORY_TIER_RAW);
+	up_history_array_from_file (series->capacity, UP_HISTORY_TYPE_UNKNOWN,
+				    filename, &series->capacity_file.compact);
+	if (up_history_store_sort (series->capacity))
+		series->capacity_file.compact = TRUE;
+	series->capacity_file.saved = series->capacity->len;
+	g_free (filename);
+}
+
+/**
+ * up_history_profile_encode:
+ *
+ * Return value: the file contents, free with g_free()
+ **/
+static guint8 *
+up_history_profile_encode (const UpHistoryProfile *profile)
+{
+	guint i;
+	guint j;
+	guint8 *data;
+	guint8 *buf;
+
+	data = g_malloc (UP_HISTORY_PROFILE_SIZE);
+	memcpy (data, UP_HISTORY_PROFILE_MAGIC, 8);
+	up_history_write_uint32 (data + 8, UP_HISTORY_PROFILE_VERSION);
+	up_history_write_uint32 (data + 12, UP_HISTORY_PROFILE_BINS);
+	buf = data + UP_HISTORY_FILE_HEADER_SIZE;
+	for (j=0; j<2; j++) {
+		for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
+			up_history_write_double (buf, profile->sum[j][i]);
+			up_history_write_uint32 (buf + 8, profile->count[j][i]);
+			buf += 12;
+		}
+	}
+	up_history_write_uint32 (buf, profile->has_last);
+	up_history_write_uint32 (buf + 4, profile->last_state);
+	up_history_write_uint32 (buf + 8, profile->has_old);
+	up_history_write_uint32 (buf + 12, profile->old_time);
+	up_history_write_double (buf + 16, profile->old_value);
+	up_history_write_uint32 (buf + 24, profile->oldbin);
+	up_history_write_uint32 (buf + 28, up_history_checksum (data, UP_HISTORY_PROFILE_SIZE - 4));
+	return data;
+}
+
+/**
+ * up_history_profile_decode:
+ *
+ * Return value: %FALSE if the data is not a valid profile
+ **/
+static gboolean
+up_history_profile_decode (UpHistoryProfile *profile, const guint8 *data, gsize length)
+{
+	guint i;
+	guint j;
+	const guint8 *buf;
+
+	if (length != UP_HISTORY_PROFILE_SIZE ||
+	    memcmp (data, UP_HISTORY_PROFILE_MAGIC, 8) != 0 ||
+	    up_history_read_uint32 (data + 8) != UP_HISTORY_PROFILE_VERSION ||
+	    up_history_read_uint32 (data + 12) != UP_HISTORY_PROFILE_BINS ||
+	    up_history_read_uint32 (data + length - 4) != up_history_checksum (data, length - 4))
+		return FALSE;
+
+	buf = data + UP_HISTORY_FILE_HEADER_SIZE;
+	for (j=0; j<2; j++) {
+		for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
+			profile->sum[j][i] = up_history_read_double (buf);
+			profile->count[j][i] = up_history_read_uint32 (buf + 8);
+			buf += 12;
+		}
+	}
+	profile->has_last = up_history_read_uint32 (buf);
+	profile->last_state = up_history_read_uint32 (buf + 4);
+	profile->has_old = up_history_read_uint32 (buf + 8);
+	profile->old_time = up_history_read_uint32 (buf + 12);
+	profile->old_value = up_history_read_double (buf + 16);
+	profile->oldbin = up_history_read_uint32 (buf + 24);
+	profile->dirty = FALSE;
+	return TRUE;
+}
+
+/**
+ * up_history_profile_load:
+ *
+ * Return value: %FALSE if there is no valid saved profile
+ **/
+static gboolean
+up_history_profile_load (UpHistory *history, UpHistoryProfile *profile)
+{
+	gboolean ret;
+	gchar *filename;
+	gchar *data = NULL;
+	gsize length;
+	GError *error = NULL;
+
+	filename = up_history_get_filename (history, "profile", UP_HISTORY_TIER_RAW);
+	ret = g_file_test (filename, G_FILE_TEST_EXISTS);
+	if (!ret) {
+		egg_debug ("no saved profile in %s", filename);
+		goto out;
+	}
+	ret = g_file_get_contents (filename, &data, &length, &error);
+	if (!ret) {
+		egg_warning ("failed to get data: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+	ret = up_history_profile_decode (profile, (const guint8 *) data, length);
+	if (!ret)
+		egg_warning ("ignoring invalid profile in %s", filename);
+out:
+	g_free (data);
+	g_free (filename);
+	return ret;
+}
+
+/**
+ * up_history_profile_save:
+ **/
+static void
+up_history_profile_save (UpHistory *history)
+{
+	gchar *filename;
+
+	if (!history->priv->profile->dirty)
+		return;
+	filename = up_history_get_filename (history, "profile", UP_HISTORY_TIER_RAW);
+	up_history_writer_push_data (up_history_profile_encode (history->priv->profile),
+				     UP_HISTORY_PROFILE_SIZE, filename,
+				     TRUE, history->priv->journal_interval > 0);
+	history->priv->profile->dirty = FALSE;
+	g_free (filename);
+}
+
+/**
+ * up_history_profile_rebuild:
+ *
+ * Builds the profile from the charge history, for when it was not saved.
+ **/
+static void
+up_history_profile_rebuild (UpHistoryProfile *profile, const UpHistorySeries *series)
+{
+	guint i;
+	const UpHistoryStore *store;
+
+	store = series->tier[UP_HISTORY_TIER_RAW];
+	egg_debug ("building profile from %i samples", store->len);
+	for (i=0; i<store->len; i++) {
+		if (up_history_store_has (store, i, UP_HISTORY_TYPE_CHARGE))
+			up_history_profile_add (profile, store->time[i],
+						store->value[UP_HISTORY_TYPE_CHARGE][i], store->state[i]);
+	}
+}
+
+/**
+ * up_history_cycles_encode:
+ *
+ * Return value: the file contents, free with g_free()
+ **/
+static guint8 *
+up_history_cycles_encode (const UpHistoryCycles *cycles, gsize *length)
+{
+	guint i;
+	guint8 *data;
+	guint8 *buf;
+	const UpHistoryCycle *cycle;
+
+	*length = UP_HISTORY_FILE_HEADER_SIZE +
+		  cycles->list->len * UP_HISTORY_CYCLES_RECORD_SIZE +
+		  UP_HISTORY_CYCLES_TRAILER_SIZE;
+	data = g_malloc (*length);
+	memcpy (data, UP_HISTORY_CYCLES_MAGIC, 8);
+	up_history_write_uint32 (data + 8, UP_HISTORY_CYCLES_VERSION);
+	up_history_write_uint32 (data + 12, cycles->list->len);
+	buf = data + UP_HISTORY_FILE_HEADER_SIZE;
+	for (i=0; i<cycles->list->len; i++) {
+		cycle = &g_array_index (cycles->list, UpHistoryCycle, i);
+		up_history_write_uint32 (buf, cycle->time_start);
+		up_history_write_uint32 (buf + 4, cycle->time_end);
+		up_history_write_uint32 (buf + 8, cycle->state);
+		up_history_write_double (buf + 12, cycle->percentage_start);
+		up_history_write_double (buf + 20, cycle->percentage_end);
+		up_history_write_double (buf + 28, cycle->energy);
+		buf += UP_HISTORY_CYCLES_RECORD_SIZE;
+	}
+	up_history_write_uint32 (buf, cycles->has_rate);
+	up_history_write_double (buf + 4, cycles->rate);
+	up_history_write_uint32 (buf + 12, cycles->rate_time);
+	up_history_write_uint32 (buf + 16, cycles->has_percentage);
+	up_history_write_double (buf + 20, cycles->percentage);
+	up_history_write_uint32 (buf + 28, up_history_checksum (data, *length - 4));
+	return data;
+}
+
+/**
+ * up_history_cycles_decode:
+ *
+ * Return value: %FALSE if the data is not a valid list of cycles
+ **/
+static gboolean
+up_history_cycles_decode (UpHistoryCycles *cycles, const guint8 *data, gsize length)
+{
+	guint i;
+	guint32 count;
+	const guint8 *buf;
+	UpHistoryCycle cycle;
+
+	if (length < UP_HISTORY_FILE_HEADER_SIZE + UP_HISTORY_CYCLES_TRAILER_SIZE ||
+	    memcmp (data, UP_HISTORY_CYCLES_MAGIC, 8) != 0 ||
+	    up_history_read_uint32 (data + 8) != UP_HISTORY_CYCLES_VERSION)
+		return FALSE;
+	count = up_history_read_uint32 (data + 12);
+	if (count > (length - UP_HISTORY_FILE_HEADER_SIZE - UP_HISTORY_CYCLES_TRAILER_SIZE) / UP_HISTORY_CYCLES_RECORD_SIZE ||
+	    length != UP_HISTORY_FILE_HEADER_SIZE + count * UP_HISTORY_CYCLES_RECORD_SIZE + UP_HISTORY_CYCLES_TRAILER_SIZE ||
+	    up_history_read_uint32 (data + length - 4) != up_history_checksum (data, length - 4))
+		return FALSE;
+
+	buf = data + UP_HISTORY_FILE_HEADER_SIZE;
+	for (i=0; i<count; i++) {
+		cycle.time_start = up_history_read_uint32 (buf);
+		cycle.time_end = up_history_read_uint32 (buf + 4);
+		cycle.state = up_history_read_uint32 (buf + 8);
+		cycle.percentage_start = up_history_read_double (buf + 12);
+		cycle.percentage_end = up_history_read_double (buf + 20);
+		cycle.energy = up_history_read_double (buf + 28);
+		g_array_append_val (cycles->list, cycle);
+		buf += UP_HISTORY_CYCLES_RECORD_SIZE;
+	}
+	cycles->has_rate = up_history_read_uint32 (buf);
+	cycles->rate = up_history_read_double (buf + 4);
+	cycles->rate_time = up_history_read_uint32 (buf + 12);
+	cycles->has_percentage = up_history_read_uint32 (buf + 16);
+	cycles->percentage = up_history_read_double (buf + 20);
+	cycles->dirty = FALSE;
+	return TRUE;
+}
+
+/**
+ * up_history_cycles_load:
+ *
+ * Return value: %FALSE if there are no valid saved cycles
+ **/
+static gboolean
+up_history_cycles_load (UpHistory *history, UpHistoryCycles *cycles)
+{
+	gboolean ret;
+	gchar *filename;
+	gchar *data = NULL;
+	gsize length;
+	GError *error = NULL;
+
+	filename = up_history_get_filename (history, "cycles", UP_HISTORY_TIER_RAW);
+	ret = g_file_test (filename, G_FILE_TEST_EXISTS);
+	if (!ret) {
+		egg_debug ("no saved cycles in %s", filename);
+		goto out;
+	}
+	ret = g_file_get_contents (filename, &data, &length, &error);
+	if (!ret) {
+		egg_warning ("failed to get data: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+	ret = up_history_cycles_decode (cycles, (const guint8 *) data, length);
+	if (!ret) {
+		egg_warning ("ignoring invalid cycles in %s", filename);
+		g_array_set_size (cycles->list, 0);
+	}
+out:
+	g_free (data);
+	g_free (filename);
+	return ret;
+}
+
+/**
+ * up_history_cycles_save:
+ **/
+static void
+up_history_cycles_save (UpHistory *history)
+{
+	gchar *filename;
+	guint8 *data;
+	gsize length;
+
+	if (!history->priv->cycles->dirty)
+		return;
+	filename = up_history_get_filename (history, "cycles", UP_HISTORY_TIER_RAW);
+	data = up_history_cycles_encode (history->priv->cycles, &length);
+	up_history_writer_push_data (data, length, filename,
+				     TRUE, history->priv->journal_interval > 0);
+	history->priv->cycles->dirty = FALSE;
+	g_free (filename);
+}
+
+/**
+ * up_history_cycles_rebuild:
+ *
+ * Builds the cycles from all the tiers of the history, for when they were
+ * not saved.
+ **/
+static void
+up_history_cycles_rebuild (UpHistoryCycles *cycles, const UpHistorySeries *series)
+{
+	guint i;
+	UpHistoryStore *store;
+
+	store = up_history_series_flatten (series, 1);
+	egg_debug ("building cycles from %i samples", store->len);
+	for (i=0; i<store->len; i++)
+		up_history_cycles_add_sample (cycles, store, i);
+	up_history_store_free (store);
+}
+
+/**
+ * up_history_series_get_time_first:
+ *
+ * Return value: the time of the oldest sample in any tier, or 0 if there
+ * are none
+ **/
+static guint32
+up_history_series_get_time_first (const UpHistorySeries *series)
+{
+	gint i;
+
+	for (i=UP_HISTORY_TIER_LAST-1; i>=0; i--) {
+		if (up_history_store_get_total (series->tier[i]) > 0)
+			return up_history_store_get_time_first (series->tier[i]);
+	}
+	return 0;
+}
+
+/**
+ * up_history_get_memory_usage:
+ *
+ * Return value: the bytes used by the history of the device, not counting
+ * what is still being read from disk
+ **/
+gsize
+up_history_get_memory_usage (UpHistory *history)
+{
+	guint i;
+	gsize size;
+	const UpHistorySeries *series;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), 0);
+
+	series = history->priv->data;
+	size = sizeof (UpHistorySeries) + sizeof (UpHistoryProfile) + sizeof (UpHistoryCycles);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		size += up_history_store_get_memory (series->tier[i]);
+	size += up_history_store_get_memory (series->capacity);
+	size += history->priv->cycles->list->len * sizeof (UpHistoryCycle);
+	size += history->priv->journal->len;
+	return size;
+}
+
+/**
+ * up_history_memory_enforce:
+ *
+ * Evicts from the devices using the most memory until the history of all
+ * of them fits in the budget.
+ **/
+static void
+up_history_memory_enforce (void)
+{
+	guint i;
+	gsize total;
+	gsize usage;
+	gsize usage_max;
+	UpHistory *history;
+	UpHistory *history_max;
+	static gboolean warned = FALSE;
+
+	if (up_history_memory_budget == 0 || up_history_instances == NULL)
+		return;
+
+	while (TRUE) {
+		total = 0;
+		usage_max = 0;
+		history_max = NULL;
+		for (i=0; i<up_history_instances->len; i++) {
+			history = g_ptr_array_index (up_history_instances, i);
+			usage = up_history_get_memory_usage (history);
+			total += usage;
+
+			/* what is being loaded is replaced anyway */
+			if (history->priv->load == NULL && usage > usage_max) {
+				usage_max = usage;
+				history_max = history;
+			}
+		}
+		if (total <= up_history_memory_budget) {
+			warned = FALSE;
+			return;
+		}
+
+		if (history_max == NULL || !up_history_series_evict (history_max->priv->data)) {
+			if (!warned)
+				egg_warning ("history uses %" G_GSIZE_FORMAT " bytes, more than the budget of %" G_GSIZE_FORMAT,
+					     total, up_history_memory_budget);
+			warned = TRUE;
+			return;
+		}
+		up_history_cycles_expire (history_max->priv->cycles,
+					  up_history_series_get_time_first (history_max->priv->data));
+		up_history_cache_clear (history_max);
+	}
+}
+
+/**
+ * up_history_journal_add:
+ *
+ * Adds the record to those waiting for the next commit.
+ **/
+static void
+up_history_journal_add (UpHistory *history, guint32 time_s, UpHistoryType metric,
+			gdouble value, UpDeviceState state)
+{
+	guint8 buf[UP_HISTORY_JOURNAL_RECORD_SIZE];
+
+	if (history->priv->journal_interval == 0)
+		return;
+	up_history_write_uint32 (buf, time_s);
+	up_history_write_uint32 (buf + 4, state);
+	up_history_write_uint32 (buf + 8, metric);
+	up_history_write_double (buf + 12, value);
+	up_history_write_uint32 (buf + 20, up_history_checksum (buf, 20));
+	g_byte_array_append (history->priv->journal, buf, UP_HISTORY_JOURNAL_RECORD_SIZE);
+}
+
+/**
+ * up_history_journal_load:
+ * @series: the samples read from the files
+ * @journal: where to add the samples that are not in @series
+ *
+ * Reads the journal up to the first torn or corrupted record.
+ *
+ * Return value: %TRUE if any samples were added to @journal
+ **/
+static gboolean
+up_history_journal_load (UpHistory *history, const UpHistorySeries *series, UpHistorySeries *journal)
+{
+	gchar *filename;
+	gchar *data = NULL;
+	gsize length;
+	gsize offset;
+	guint32 time_s;
+	UpHistoryType metric;
+	const guint8 *buf;
+	const UpHistoryStore *store;
+	gboolean ret = FALSE;
+
+	filename = up_history_get_filename (history, "journal", UP_HISTORY_TIER_RAW);
+	if (!g_file_get_contents (filename, &data, &length, NULL))
+		goto out;
+	buf = (const guint8 *) data;
+	if (length < UP_HISTORY_FILE_HEADER_SIZE ||
+	    memcmp (buf, UP_HISTORY_JOURNAL_MAGIC, 8) != 0 ||
+	    up_history_read_uint32 (buf + 8) != UP_HISTORY_JOURNAL_VERSION ||
+	    up_history_read_uint32 (buf + 12) != UP_HISTORY_JOURNAL_RECORD_SIZE) {
+		egg_warning ("ignoring invalid journal %s", filename);
+		goto out;
+	}
+
+	for (offset = UP_HISTORY_FILE_HEADER_SIZE;
+	     offset + UP_HISTORY_JOURNAL_RECORD_SIZE <= length;
+	     offset += UP_HISTORY_JOURNAL_RECORD_SIZE) {
+		buf = (const guint8 *) data + offset;
+		if (up_history_checksum (buf, 20) != up_history_read_uint32 (buf + 20)) {
+			egg_warning ("journal %s is torn at %" G_GSIZE_FORMAT, filename, offset);
+			break;
+		}
+		time_s = up_history_read_uint32 (buf);
+		metric = up_history_read_uint32 (buf + 8);
+		if (metric >= UP_HISTORY_METRICS)
+			continue;
+
+		/* already saved */
+		if (metric == UP_HISTORY_TYPE_CAPACITY)
+			store = series->capacity;
+		else
+			store = series->tier[UP_HISTORY_TIER_RAW];
+		if (up_history_store_has_value (store, time_s, up_history_read_uint32 (buf + 4), metric))
+			continue;
+
+		if (metric == UP_HISTORY_TYPE_CAPACITY)
+			up_history_store_add (journal->capacity, time_s, metric,
+					      up_history_read_double (buf + 12),
+					      up_history_read_uint32 (buf + 4));
+		else
+			up_history_store_add (journal->tier[UP_HISTORY_TIER_RAW], time_s, metric,
+					      up_history_read_double (buf + 12),
+					      up_history_read_uint32 (buf + 4));
+		ret = TRUE;
+	}
+	egg_debug ("replayed journal %s", filename);
+out:
+	g_free (data);
+	g_free (filename);
+	return ret;
+}
+
+/**
+ * up_history_add_sample:
+ *
+ * Values added in the same second and state share a sample. Charge values
+ * also update the profile, and charge and rate values the cycles, unless
+ * they are still being loaded, and then the memory budget is checked.
+ **/
+static void
+up_history_add_sample (UpHistory *history, UpHistoryType metric, gdouble value, UpDeviceState state)
+{
+	guint32 now;
+	guint row;
+	gboolean in_order;
+	UpHistorySeries *series = history->priv->data;
+	UpHistoryStore *store;
+	UpHistoryFileState *file;
+
+	now = up_history_get_time_now ();
+	if (metric == UP_HISTORY_TYPE_CAPACITY) {
+		store = series->capacity;
+		file = &series->capacity_file;
+	} else {
+		store = series->tier[UP_HISTORY_TIER_RAW];
+		file = &series->file[UP_HISTORY_TIER_RAW];
+	}
+	row = up_history_store_add (store, now, metric, value, state);
+	series->generation[metric]++;
+	up_history_journal_add (history, now, metric, value, state);
+
+	/* the wall clock was stepped back, so clients have to start again,
+	 * and the file too if the sample went in what is already saved */
+	in_order = (row + 1 == store->len);
+	if (!in_order) {
+		egg_debug ("sample at %i is older than the newest", now);
+		series->rewrites++;
+		if (store->cold_len + row < file->saved)
+			file->compact = TRUE;
+	} else if (now <= series->served) {
+		/* a client was already told there was nothing more in this second */
+		egg_debug ("sample at %i is in a second already served", now);
+		series->rewrites++;
+	}
+	if (history->priv->load != NULL)
+		return;
+
+	/* the profile and cycles only ever go forwards */
+	if (in_order && metric == UP_HISTORY_TYPE_CHARGE)
+		up_history_profile_add (history->priv->profile, now, value, state);
+	if (in_order && (metric == UP_HISTORY_TYPE_CHARGE || metric == UP_HISTORY_TYPE_RATE))
+		up_history_cycles_add (history->priv->cycles, now, metric, value, state);
+	up_history_memory_enforce ();
+}
+
+/**
+ * up_history_expire_data:
+ **/
+static void
+up_history_expire_data (UpHistory *history)
+{
+	guint32 now;
+
+	now = up_history_get_time_now ();
+	up_history_series_expire (history, history->priv->data, now, TRUE);
+	up_history_cycles_expire (history->priv->cycles,
+				  up_history_series_get_time_first (history->priv->data));
+}
+
+/**
+ * up_history_journal_header_encode:
+ **/
+static void
+up_history_journal_header_encode (guint8 *buf)
+{
+	memcpy (buf, UP_HISTORY_JOURNAL_MAGIC, 8);
+	up_history_write_uint32 (buf + 8, UP_HISTORY_JOURNAL_VERSION);
+	up_history_write_uint32 (buf + 12, UP_HISTORY_JOURNAL_RECORD_SIZE);
+}
+
+/**
+ * up_history_journal_reset:
+ *
+ * Empties the journal once the files have everything in it, which the
+ * writer only does after writing them as it runs the jobs in order.
+ **/
+static void
+up_history_journal_reset (UpHistory *history)
+{
+	gchar *filename;
+	guint8 *header;
+
+	if (history->priv->journal_id != 0) {
+		g_source_remove (history->priv->journal_id);
+		history->priv->journal_id = 0;
+	}
+	g_byte_array_set_size (history->priv->journal, 0);
+	if (history->priv->journal_interval == 0)
+		return;
+
+	filename = up_history_get_filename (history, "journal", UP_HISTORY_TIER_RAW);
+	header = g_new (guint8, UP_HISTORY_FILE_HEADER_SIZE);
+	up_history_journal_header_encode (header);
+	up_history_writer_push_data (header, UP_HISTORY_FILE_HEADER_SIZE, filename, TRUE, TRUE);
+	history->priv->journal_new = FALSE;
+	g_free (filename);
+}
+
+/**
+ * up_history_save_data:
+ **/
+static gboolean
+up_history_save_data (UpHistory *history)
+{
+	/* we have an ID? */
+	if (history->priv->id == NULL) {
+		egg_warning ("no ID, cannot save");
+		return FALSE;
+	}
+
+	/* the files would lose the samples that are still being read */
+	if (history->priv->load != NULL) {
+		egg_debug ("not saving until loaded");
+		return FALSE;
+	}
+
+	/* only up_history_rewrite() changes the files that were opened */
+	if (history->priv->read_only) {
+		egg_debug ("opened read only, not saving");
+		return FALSE;
+	}
+
+	/* roll up old data before it gets written */
+	up_history_expire_data (history);
+
+	/* save history to disk */
+	up_history_series_save (history, history->priv->data);
+	up_history_profile_save (history);
+	up_history_cycles_save (history);
+
+	/* the files now have everything in the journal */
+	up_history_journal_reset (history);
+
+	return TRUE;
+}
+
+/**
+ * up_history_journal_commit:
+ *
+ * Queues the records added since the last commit, which the writer appends
+ * to the journal in one write and sync. The journal is replaced when it
+ * might not end with a whole record.
+ **/
+static gboolean
+up_history_journal_commit (UpHistory *history)
+{
+	gchar *filename;
+	guint8 header[UP_HISTORY_FILE_HEADER_SIZE];
+	GByteArray *journal = history->priv->journal;
+	gsize length;
+
+	/* nothing to do */
+	if (journal->len == 0)
+		return TRUE;
+
+	/* the journal is still being replayed */
+	if (history->priv->load != NULL)
+		return FALSE;
+
+	filename = up_history_get_filename (history, "journal", UP_HISTORY_TIER_RAW);
+
+	/* the records after a failed append cannot be read back */
+	if (up_history_writer_take_failed (filename)) {
+		egg_warning ("failed to write journal, saving instead");
+		up_history_save_data (history);
+		goto out;
+	}
+
+	if (history->priv->journal_new) {
+		up_history_journal_header_encode (header);
+		g_byte_array_prepend (journal, header, UP_HISTORY_FILE_HEADER_SIZE);
+	}
+	length = journal->len;
+	up_history_writer_push_data (g_byte_array_free (journal, FALSE), length, filename,
+				     history->priv->journal_new, TRUE);
+	history->priv->journal = g_byte_array_new ();
+	history->priv->journal_new = FALSE;
+out:
+	g_free (filename);
+	return TRUE;
+}
+
+/**
+ * up_history_journal_commit_cb:
+ **/
+static gboolean
+up_history_journal_commit_cb (UpHistory *history)
+{
+	history->priv->journal_id = 0;
+	up_history_journal_commit (history);
+	return FALSE;
+}
+
+/**
+ * up_history_journal_schedule:
+ **/
+static void
+up_history_journal_schedule (UpHistory *history)
+{
+	if (history->priv->journal_interval == 0 || history->priv->journal_id != 0)
+		return;
+	history->priv->journal_id = g_timeout_add_seconds (history->priv->journal_interval,
+							   (GSourceFunc) up_history_journal_commit_cb, history);
+#if GLIB_CHECK_VERSION(2,25,8)
+	g_source_set_name_by_id (history->priv->journal_id, "[UpHistory] journal");
+#endif
+}
+
+/**
+ * up_history_schedule_save_cb:
+ **/
+static gboolean
+up_history_schedule_save_cb (UpHistory *history)
+{
+	up_history_save_data (history);
+	history->priv->save_id = 0;
+	return FALSE;
+}
+
+/**
+ * up_history_is_low_power:
+ **/
+static gboolean
+up_history_is_low_power (UpHistory *history)
+{
+	guint length;
+	const UpHistoryStore *store;
 
-	/* save to disk */
-	ret = g_file_set_contents (filename, part, -1, &error);
-	if (!ret) {
-		egg_warning ("failed to set data: %s", error->message);
-		g_error_free (error);
-		goto out;
+	/* current status is always up to date */
+	if (history->priv->state != UP_DEVICE_STATE_DISCHARGING)
+		return FALSE;
+
+	/* have we got any data? */
+	store = history->priv->data->tier[UP_HISTORY_TIER_RAW];
+	for (length=store->len; length>0; length--) {
+		if (up_history_store_has (store, length-1, UP_HISTORY_TYPE_CHARGE))
+			break;
 	}
-	egg_debug ("saved %s", filename);
+	if (length == 0)
+		return FALSE;
 
-out:
-	g_free (part);
-	return ret;
+	/* get the last saved charge sample */
+	if (store->state[length-1] != UP_DEVICE_STATE_DISCHARGING)
+		return FALSE;
+
+	/* high enough */
+	if (store->value[UP_HISTORY_TYPE_CHARGE][length-1] > 10)
+		return FALSE;
+
+	/* we are low power */
+	return TRUE;
 }
 
 /**
- * up_history_array_from_file:
- * @list: a valid #GPtrArray instance
- * @filename: a filename
- *
- * Appends the list from a file
+ * up_history_schedule_save:
  **/
 static gboolean
-up_history_array_from_file (GPtrArray *list, const gchar *filename)
+up_history_schedule_save (UpHistory *history)
 {
 	gboolean ret;
-	GError *error = NULL;
-	gchar *data = NULL;
-	gchar **parts = NULL;
+	guint interval;
+
+	if (history->priv->read_only)
+		return FALSE;
+
+	/* if low power, then don't batch up save requests, although the
+	 * journal is enough to not lose them */
+	ret = up_history_is_low_power (history);
+	if (ret && history->priv->journal_interval > 0) {
+		egg_debug ("committing journal directly as low power");
+		up_history_journal_commit (history);
+	} else if (ret) {
+		egg_warning ("saving directly to disk as low power");
+		up_history_save_data (history);
+		return TRUE;
+	} else {
+		up_history_journal_schedule (history);
+	}
+
+	/* we already have one saved */
+	if (history->priv->save_id != 0) {
+		egg_debug ("deferring as others queued");
+		return TRUE;
+	}
+
+	/* nothing scheduled, do new */
+	interval = UP_HISTORY_SAVE_INTERVAL;
+	if (history->priv->journal_interval > 0)
+		interval = UP_HISTORY_SAVE_INTERVAL_JOURNAL;
+	egg_debug ("saving in %i seconds", interval);
+	history->priv->save_id = g_timeout_add_seconds (interval,
+							(GSourceFunc) up_history_schedule_save_cb, history);
+#if GLIB_CHECK_VERSION(2,25,8)
+	g_source_set_name_by_id (history->priv->save_id, "[UpHistory] save");
+#endif
+	return TRUE;
+}
+
+/**
+ * up_history_load_add:
+ *
+ * Adds the samples of @series, which are nearly always newer than anything
+ * in @load and so are appended, and otherwise merged in time order. Only
+ * the newer samples are added to the profile and cycles.
+ **/
+static void
+up_history_load_add (UpHistoryLoad *load, const UpHistorySeries *series)
+{
 	guint i;
-	guint length;
-	UpHistoryItem *item;
+	guint32 time_last = 0;
+	const UpHistoryStore *store;
+	UpHistoryStore *dest;
 
-	/* do we exist */
-	ret = g_file_test (filename, G_FILE_TEST_EXISTS);
-	if (!ret) {
-		egg_debug ("failed to get data from %s as file does not exist", filename);
-		goto out;
+	dest = load->series->tier[UP_HISTORY_TIER_RAW];
+	if (dest->len > 0)
+		time_last = dest->time[dest->len - 1];
+	store = series->tier[UP_HISTORY_TIER_RAW];
+	if (up_history_store_merge_sorted (dest, store))
+		load->series->file[UP_HISTORY_TIER_RAW].compact = TRUE;
+	for (i=0; i<store->len; i++) {
+		if (store->time[i] < time_last)
+			continue;
+		if (up_history_store_has (store, i, UP_HISTORY_TYPE_CHARGE))
+			up_history_profile_add (load->profile, store->time[i],
+						store->value[UP_HISTORY_TYPE_CHARGE][i], store->state[i]);
+		up_history_cycles_add_sample (load->cycles, store, i);
 	}
+	if (up_history_store_merge_sorted (load->series->capacity, series->capacity))
+		load->series->capacity_file.compact = TRUE;
+}
 
-	/* get contents */
-	ret = g_file_get_contents (filename, &data, NULL, &error);
-	if (!ret) {
-		egg_warning ("failed to get data: %s", error->message);
+/**
+ * up_history_load_finish:
+ *
+ * Takes over the history read by the load pool, adding the samples that
+ * arrived in the meantime, which are newer than anything on disk.
+ **/
+static void
+up_history_load_finish (UpHistory *history)
+{
+	UpHistoryLoad *load = history->priv->load;
+	gboolean replayed;
+
+	egg_debug ("loaded history for %s, adding %i new samples", history->priv->id,
+		   history->priv->data->tier[UP_HISTORY_TIER_RAW]->len);
+	up_history_load_add (load, history->priv->data);
+
+	/* clients holding samples from before the load have to start again */
+	load->series->rewrites += history->priv->data->rewrites + 1;
+	up_history_series_free (history->priv->data);
+	g_free (history->priv->profile);
+	up_history_cycles_free (history->priv->cycles);
+	history->priv->data = load->series;
+	history->priv->profile = load->profile;
+	history->priv->cycles = load->cycles;
+	history->priv->load = NULL;
+	replayed = load->replayed;
+	g_free (load);
+
+	/* now the new samples can be saved, and the ones from the journal
+	 * straight away so that it can be replaced */
+	up_history_cache_clear (history);
+	up_history_memory_enforce ();
+	if (replayed)
+		up_history_save_data (history);
+	else
+		up_history_schedule_save (history);
+}
+
+/**
+ * up_history_load_idle_cb:
+ **/
+static gboolean
+up_history_load_idle_cb (UpHistory *history)
+{
+	up_history_load_finish (history);
+	g_signal_emit (history, signals[UP_HISTORY_LOADED], 0);
+	return FALSE;
+}
+
+/**
+ * up_history_load_run:
+ *
+ * Reads the files into the series, profile and cycles of @load, which can
+ * be done in any thread as nothing else uses them yet.
+ **/
+static void
+up_history_load_run (UpHistoryLoad *load)
+{
+	UpHistorySeries *journal;
+
+	up_history_series_load (load->history, load->series);
+	journal = up_history_series_new ();
+	load->replayed = up_history_journal_load (load->history, load->series, journal);
+
+	/* the profile and cycles are only built from the history when they
+	 * were not saved */
+	if (!up_history_profile_load (load->history, load->profile))
+		up_history_profile_rebuild (load->profile, load->series);
+	if (!up_history_cycles_load (load->history, load->cycles))
+		up_history_cycles_rebuild (load->cycles, load->series);
+
+	/* these were lost from the files when the daemon last stopped */
+	up_history_load_add (load, journal);
+	up_history_series_free (journal);
+
+	/* don't keep more in memory than the retention allows */
+	up_history_series_expire (load->history, load->series, load->now, TRUE);
+	up_history_cycles_expire (load->cycles, up_history_series_get_time_first (load->series));
+}
+
+/**
+ * up_history_load_thread:
+ **/
+static void
+up_history_load_thread (UpHistoryLoad *load, gpointer user_data)
+{
+	GSource *idle;
+
+	up_history_load_run (load);
+
+	/* the idle can run and free @load as soon as it is attached, so it
+	 * is set up first and @load is not touched afterwards */
+	idle = g_idle_source_new ();
+	g_source_set_callback (idle, (GSourceFunc) up_history_load_idle_cb, load->history, NULL);
+#if GLIB_CHECK_VERSION(2,25,8)
+	g_source_set_name (idle, "[UpHistory] loaded");
+#endif
+
+	g_mutex_lock (up_history_load_mutex);
+	load->done = TRUE;
+	load->idle = idle;
+	g_source_attach (idle, NULL);
+	g_source_unref (idle);
+	g_cond_broadcast (up_history_load_cond);
+	g_mutex_unlock (up_history_load_mutex);
+}
+
+/**
+ * up_history_load_pool_get:
+ *
+ * Return value: the pool, which is started the first time it is used, or
+ * %NULL if the history has to be loaded in the main thread
+ **/
+static GThreadPool *
+up_history_load_pool_get (void)
+{
+	GError *error = NULL;
+
+	if (up_history_load_mutex != NULL)
+		return up_history_load_pool;
+
+	up_history_load_mutex = g_mutex_new ();
+	up_history_load_cond = g_cond_new ();
+	up_history_load_pool = g_thread_pool_new ((GFunc) up_history_load_thread, NULL,
+						  UP_HISTORY_LOAD_THREADS, FALSE, &error);
+	if (up_history_load_pool == NULL) {
+		egg_warning ("failed to start history loaders: %s", error->message);
 		g_error_free (error);
-		goto out;
 	}
+	return up_history_load_pool;
+}
 
-	/* split by line ending */
-	parts = g_strsplit (data, "\n", 0);
-	length = g_strv_length (parts);
-	if (length == 0) {
-		egg_debug ("no data in %s", filename);
-		goto out;
-	}
+/**
+ * up_history_load_wait:
+ *
+ * Waits for the load pool to read the history, and takes it over without
+ * waiting for the main loop.
+ *
+ * Return value: %TRUE if the history was still being loaded
+ **/
+static gboolean
+up_history_load_wait (UpHistory *history)
+{
+	UpHistoryLoad *load = history->priv->load;
 
-	/* add valid entries */
-	egg_debug ("loading %i items of data from %s", length, filename);
-	for (i=0; i<length-1; i++) {
-		item = up_history_item_new ();
-		ret = up_history_item_set_from_string (item, parts[i]);
+	if (load == NULL)
+		return FALSE;
+
+	g_mutex_lock (up_history_load_mutex);
+	while (!load->done)
+		g_cond_wait (up_history_load_cond, up_history_load_mutex);
+	g_mutex_unlock (up_history_load_mutex);
+
+	g_source_destroy (load->idle);
+	up_history_load_finish (history);
+	return TRUE;
+}
+
+/**
+ * up_history_load_new:
+ **/
+static UpHistoryLoad *
+up_history_load_new (UpHistory *history)
+{
+	UpHistoryLoad *load;
+
+	/* make sure the files are not still being written */
+	up_history_sync ();
+
+	load = g_new0 (UpHistoryLoad, 1);
+	load->history = history;
+	load->series = up_history_series_new ();
+	load->profile = up_history_profile_new ();
+	load->cycles = up_history_cycles_new ();
+	load->now = up_history_get_time_now ();
+	history->priv->load = load;
+	return load;
+}
+
+/**
+ * up_history_load_data:
+ *
+ * Starts reading the history in the load pool, so that devices with a lot
+ * of history do not hold up the others.
+ **/
+static gboolean
+up_history_load_data (UpHistory *history)
+{
+	UpHistoryLoad *load;
+	GThreadPool *pool;
+	GError *error = NULL;
+	gboolean ret;
+
+	load = up_history_load_new (history);
+
+	/* save a marker so we don't use incomplete percentages */
+	up_history_add_sample (history, UP_HISTORY_TYPE_RATE, 0.0f, UP_DEVICE_STATE_UNKNOWN);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, 0.0f, UP_DEVICE_STATE_UNKNOWN);
+	up_history_add_sample (history, UP_HISTORY_TYPE_TIME_FULL, 0.0f, UP_DEVICE_STATE_UNKNOWN);
+	up_history_add_sample (history, UP_HISTORY_TYPE_TIME_EMPTY, 0.0f, UP_DEVICE_STATE_UNKNOWN);
+
+	pool = up_history_load_pool_get ();
+	if (pool != NULL) {
+		ret = g_thread_pool_push (pool, load, &error);
 		if (ret)
-			g_ptr_array_add (list, item);
+			return TRUE;
+		egg_warning ("failed to queue history load: %s", error->message);
+		g_error_free (error);
 	}
 
-out:
-	g_strfreev (parts);
-	g_free (data);
+	/* do it the slow way */
+	up_history_load_run (load);
+	up_history_load_finish (history);
+	return TRUE;
+}
+
+/**
+ * up_history_is_loading:
+ *
+ * Return value: %TRUE if the history is still being read from disk, in
+ * which case no data is returned until the "loaded" signal
+ **/
+gboolean
+up_history_is_loading (UpHistory *history)
+{
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+	return history->priv->load != NULL;
+}
+
+/**
+ * up_history_wait_loaded:
+ *
+ * Blocks until the history has been read from disk, which is only useful
+ * when there is no main loop.
+ **/
+void
+up_history_wait_loaded (UpHistory *history)
+{
+	g_return_if_fail (UP_IS_HISTORY (history));
+
+	if (up_history_load_wait (history))
+		g_signal_emit (history, signals[UP_HISTORY_LOADED], 0);
+}
+
+/**
+ * up_history_set_id:
+ **/
+gboolean
+up_history_set_id (UpHistory *history, const gchar *id)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+
+	if (history->priv->id != NULL)
+		return FALSE;
+	if (id == NULL)
+		return FALSE;
+
+	egg_debug ("using id: %s", id);
+	history->priv->id = g_strdup (id);
+	/* load all previous data */
+	ret = up_history_load_data (history);
 	return ret;
 }
 
 /**
- * up_history_save_data:
+ * up_history_open:
+ * @history: a #UpHistory
+ * @id: the device id, as used in the filenames
+ *
+ * Reads the history of @id straight away, without the marker that
+ * up_history_set_id() adds for a restart, so that the files can be looked
+ * at or rewritten while the daemon is not running. Nothing is written or
+ * removed unless up_history_rewrite() or up_history_export_text() is
+ * called, even when the files are in an older format.
  **/
-static gboolean
-up_history_save_data (UpHistory *history)
+gboolean
+up_history_open (UpHistory *history, const gchar *id)
+{
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+
+	if (history->priv->id != NULL)
+		return FALSE;
+	if (id == NULL)
+		return FALSE;
+
+	egg_debug ("opening id: %s", id);
+	history->priv->id = g_strdup (id);
+	history->priv->read_only = TRUE;
+	up_history_load_run (up_history_load_new (history));
+	up_history_load_finish (history);
+	return TRUE;
+}
+
+/**
+ * up_history_rewrite:
+ * @history: a #UpHistory
+ *
+ * Applies the retention in full rather than in batches, and writes all
+ * the files again in the current format. The files of the older formats
+ * and the journal are removed once everything is on disk.
+ *
+ * Return value: %FALSE if a file could not be written
+ **/
+gboolean
+up_history_rewrite (UpHistory *history)
 {
+	guint i;
 	gchar *filename;
+	gboolean ret = TRUE;
+	UpHistorySeries *series;
 
-	/* we have an ID? */
-	if (history->priv->id == NULL) {
-		egg_warning ("no ID, cannot save");
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+
+	if (history->priv->id == NULL || history->priv->load != NULL)
 		return FALSE;
+
+	series = history->priv->data;
+	up_history_series_expire (history, series, up_history_get_time_now (), FALSE);
+	up_history_cycles_expire (history->priv->cycles, up_history_series_get_time_first (series));
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		series->file[i].compact = TRUE;
+	series->capacity_file.compact = TRUE;
+	history->priv->profile->dirty = TRUE;
+	history->priv->cycles->dirty = TRUE;
+	history->priv->read_only = FALSE;
+	up_history_save_data (history);
+	up_history_sync ();
+
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		filename = up_history_get_filename (history, NULL, i);
+		if (up_history_writer_take_failed (filename)) {
+			egg_warning ("failed to write %s", filename);
+			ret = FALSE;
+		}
+		g_free (filename);
+	}
+	filename = up_history_get_filename (history, "capacity", UP_HISTORY_TIER_RAW);
+	if (up_history_writer_take_failed (filename)) {
+		egg_warning ("failed to write %s", filename);
+		ret = FALSE;
 	}
+	g_free (filename);
+	if (!ret)
+		return FALSE;
+
+	/* only now is it safe to remove what the files were read from */
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		up_history_series_remove_legacy (history, i);
+	filename = up_history_get_filename (history, "journal", UP_HISTORY_TIER_RAW);
+	g_unlink (filename);
+	g_free (filename);
+	return TRUE;
+}
+
+/**
+ * up_history_export_text:
+ * @history: a #UpHistory
+ * @error: a #GError, or %NULL
+ *
+ * Writes the history in the text format of the first versions, with one
+ * file for each history type, and removes the files in the current
+ * format so that it is read again from the text. The rolled up samples
+ * are written as their mean, and the capacity is left as it is.
+ *
+ * The history is not saved again afterwards.
+ *
+ * Return value: %TRUE if all the files were written
+ **/
+gboolean
+up_history_export_text (UpHistory *history, GError **error)
+{
+	guint i;
+	guint j;
+	gchar *filename;
+	GString *string;
+	UpHistoryStore *store;
+	gboolean ret = TRUE;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+	g_return_val_if_fail (history->priv->id != NULL, FALSE);
+	g_return_val_if_fail (history->priv->load == NULL, FALSE);
 
-	/* save rate history to disk */
-	filename = up_history_get_filename (history, "rate");
-	up_history_array_to_file (history->priv->data_rate, filename);
-	g_free (filename);
+	store = up_history_series_flatten (history->priv->data, 1);
+	for (j=0; j<UP_HISTORY_LEGACY_METRICS && ret; j++) {
+		string = g_string_new ("");
+		for (i=0; i<store->len; i++) {
+			if (!up_history_store_has (store, i, j))
+				continue;
+			/* same format as up_history_item_to_string() */
+			g_string_append_printf (string, "%i\t%.3f\t%s\n",
+						store->time[i], store->value[j][i],
+						up_device_state_to_string (store->state[i]));
+		}
+		filename = up_history_get_filename (history, up_history_type_names[j], UP_HISTORY_TIER_RAW);
+		ret = g_file_set_contents (filename, string->str, string->len, error);
+		g_string_free (string, TRUE);
+		g_free (filename);
+	}
+	up_history_store_free (store);
+	if (!ret)
+		return FALSE;
 
-	/* save charge history to disk */
-	filename = up_history_get_filename (history, "charge");
-	up_history_array_to_file (history->priv->data_charge, filename);
+	/* the text files are only read when there is no shared file, and the
+	 * profile and cycles are rebuilt from them */
+	up_history_sync ();
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		filename = up_history_get_filename (history, NULL, i);
+		g_unlink (filename);
+		g_free (filename);
+		if (i == UP_HISTORY_TIER_RAW)
+			continue;
+		for (j=0; j<UP_HISTORY_LEGACY_METRICS; j++) {
+			filename = up_history_get_filename (history, up_history_type_names[j], i);
+			g_unlink (filename);
+			g_free (filename);
+		}
+	}
+	filename = up_history_get_filename (history, "profile", UP_HISTORY_TIER_RAW);
+	g_unlink (filename);
 	g_free (filename);
-
-	/* save charge history to disk */
-	filename = up_history_get_filename (history, "time-full");
-	up_history_array_to_file (history->priv->data_time_full, filename);
+	filename = up_history_get_filename (history, "cycles", UP_HISTORY_TIER_RAW);
+	g_unlink (filename);
 	g_free (filename);
-
-	/* save charge history to disk */
-	filename = up_history_get_filename (history, "time-empty");
-	up_history_array_to_file (history->priv->data_time_empty, filename);
+	filename = up_history_get_filename (history, "journal", UP_HISTORY_TIER_RAW);
+	g_unlink (filename);
 	g_free (filename);
 
+	/* so that finalizing does not write the shared files again */
+	history->priv->read_only = TRUE;
 	return TRUE;
 }
 
 /**
- * up_history_schedule_save_cb:
+ * up_history_to_text_store:
  **/
-static gboolean
-up_history_schedule_save_cb (UpHistory *history)
+static void
+up_history_to_text_store (GString *string, const gchar *name,
+			  const UpHistoryStore *store, const gchar *filename)
 {
-	up_history_save_data (history);
-	history->priv->save_id = 0;
-	return FALSE;
+	guint i;
+	guint j;
+	guint count[UP_HISTORY_METRICS];
+	const gchar *type;
+	gchar *first;
+	gchar *last;
+	GTimeVal timeval;
+	struct stat buf;
+	UpHistoryStore *thawed;
+	const UpHistorySegment *segment;
+
+	/* the cold segments have to be decoded to be counted */
+	thawed = up_history_store_new (store->aggregate);
+	for (i=0; i<store->segments->len; i++) {
+		segment = g_ptr_array_index (store->segments, i);
+		up_history_store_decompress (thawed, store->aggregate, UP_HISTORY_FILE_VERSION,
+					     UP_HISTORY_TYPE_UNKNOWN, segment->data,
+					     segment->length, segment->count);
+	}
+	for (i=0; i<store->len; i++)
+		up_history_store_add_sample (thawed, store, i);
+
+	g_string_append_printf (string, "  %s:\n", name);
+	g_string_append_printf (string, "    samples:             %i (%i compressed in memory)\n",
+				thawed->len, store->cold_len);
+	if (thawed->len > 0) {
+		timeval.tv_usec = 0;
+		timeval.tv_sec = thawed->time[0];
+		first = g_time_val_to_iso8601 (&timeval);
+		timeval.tv_sec = thawed->time[thawed->len - 1];
+		last = g_time_val_to_iso8601 (&timeval);
+		g_string_append_printf (string, "    time:                %s to %s\n", first, last);
+		g_free (first);
+		g_free (last);
+	}
+	memset (count, 0, sizeof (count));
+	for (i=0; i<thawed->len; i++) {
+		for (j=0; j<UP_HISTORY_METRICS; j++) {
+			if (up_history_store_has (thawed, i, j))
+				count[j]++;
+		}
+	}
+	for (j=0; j<UP_HISTORY_METRICS; j++) {
+		if (count[j] == 0)
+			continue;
+		type = j < UP_HISTORY_LEGACY_METRICS ? up_history_type_names[j] : "capacity";
+		g_string_append_printf (string, "    %s:%*s%i\n", type, (gint) (20 - strlen (type)), "", count[j]);
+	}
+	if (g_stat (filename, &buf) == 0)
+		g_string_append_printf (string, "    file:                %s, %li bytes\n",
+					filename, (glong) buf.st_size);
+	up_history_store_free (thawed);
 }
 
 /**
- * up_history_is_low_power:
+ * up_history_to_text:
+ * @history: a #UpHistory
+ *
+ * Return value: a description of how much history there is in each tier
+ * and on disk
  **/
-static gboolean
-up_history_is_low_power (UpHistory *history)
+gchar *
+up_history_to_text (UpHistory *history)
 {
-	guint length;
-	UpHistoryItem *item;
-
-	/* current status is always up to date */
-	if (history->priv->state != UP_DEVICE_STATE_DISCHARGING)
-		return FALSE;
-
-	/* have we got any data? */
-	length = history->priv->data_charge->len;
-	if (length == 0)
-		return FALSE;
-
-	/* get the last saved charge object */
-	item = (UpHistoryItem *) g_ptr_array_index (history->priv->data_charge, length-1);
-	if (up_history_item_get_state (item) != UP_DEVICE_STATE_DISCHARGING)
-		return FALSE;
+	guint i;
+	gchar *filename;
+	GString *string;
+	UpHistorySeries *series;
 
-	/* high enough */
-	if (up_history_item_get_value (item) > 10)
-		return FALSE;
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
 
-	/* we are low power */
-	return TRUE;
+	series = history->priv->data;
+	string = g_string_new ("");
+	g_string_append_printf (string, "  id:                    %s\n", history->priv->id);
+	g_string_append_printf (string, "  directory:             %s\n", history->priv->dir);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++) {
+		filename = up_history_get_filename (history, NULL, i);
+		up_history_to_text_store (string, i == UP_HISTORY_TIER_RAW ? "raw" : up_history_tier_names[i],
+					  series->tier[i], filename);
+		g_free (filename);
+	}
+	filename = up_history_get_filename (history, "capacity", UP_HISTORY_TIER_RAW);
+	up_history_to_text_store (string, "capacity", series->capacity, filename);
+	g_free (filename);
+	g_string_append_printf (string, "  cycles:                %i\n", history->priv->cycles->list->len);
+	g_string_append_printf (string, "  memory:                %" G_GSIZE_FORMAT " bytes\n",
+				up_history_get_memory_usage (history));
+	return g_string_free (string, FALSE);
 }
 
 /**
- * up_history_schedule_save:
+ * up_history_sync:
+ *
+ * Waits until all the queued history has been written to disk, which
+ * should be done before the daemon exits.
  **/
-static gboolean
-up_history_schedule_save (UpHistory *history)
+void
+up_history_sync (void)
 {
-	gboolean ret;
+	UpHistoryWriter *writer = up_history_writer;
 
-	/* if low power, then don't batch up save requests */
-	ret = up_history_is_low_power (history);
-	if (ret) {
-		egg_warning ("saving directly to disk as low power");
-		up_history_save_data (history);
-		return TRUE;
-	}
-
-	/* we already have one saved */
-	if (history->priv->save_id != 0) {
-		egg_debug ("deferring as others queued");
-		return TRUE;
-	}
+	if (writer == NULL || writer->thread == NULL)
+		return;
 
-	/* nothing scheduled, do new */
-	egg_debug ("saving in %i seconds", UP_HISTORY_SAVE_INTERVAL);
-	history->priv->save_id = g_timeout_add_seconds (UP_HISTORY_SAVE_INTERVAL,
-							(GSourceFunc) up_history_schedule_save_cb, history);
-#if GLIB_CHECK_VERSION(2,25,8)
-	g_source_set_name_by_id (history->priv->save_id, "[UpHistory] save");
-#endif
-	return TRUE;
+	g_mutex_lock (writer->mutex);
+	while (writer->pending > 0)
+		g_cond_wait (writer->cond, writer->mutex);
+	g_mutex_unlock (writer->mutex);
 }
 
 /**
- * up_history_load_data:
+ * up_history_set_time:
+ * @time_s: the time to stamp the samples with, or 0 to follow the clock
+ *
+ * Stops the clock for the self tests, so that samples can be added at any
+ * time, in the same second, or with the clock stepped back.
  **/
-static gboolean
-up_history_load_data (UpHistory *history)
+void
+up_history_set_time (guint32 time_s)
 {
-	gchar *filename;
-	UpHistoryItem *item;
-
-	/* load rate history from disk */
-	filename = up_history_get_filename (history, "rate");
-	up_history_array_from_file (history->priv->data_rate, filename);
-	g_free (filename);
-
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "charge");
-	up_history_array_from_file (history->priv->data_charge, filename);
-	g_free (filename);
-
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "time-full");
-	up_history_array_from_file (history->priv->data_time_full, filename);
-	g_free (filename);
+	up_history_time_fixed = time_s;
+}
 
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "time-empty");
-	up_history_array_from_file (history->priv->data_time_empty, filename);
-	g_free (filename);
+/**
+ * up_history_set_memory_budget:
+ * @budget: the most memory the history of all the devices can use, in
+ * bytes, or 0 for no limit
+ *
+ * Once the budget is used up, the oldest history of the device using the
+ * most memory is rolled up early, and in the end dropped.
+ **/
+void
+up_history_set_memory_budget (gsize budget)
+{
+	up_history_memory_budget = budget;
+	up_history_memory_enforce ();
+}
 
-	/* save a marker so we don't use incomplete percentages */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	g_ptr_array_add (history->priv->data_rate, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_charge, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_time_full, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_time_empty, g_object_ref (item));
-	g_object_unref (item);
-	up_history_schedule_save (history);
+/**
+ * up_history_set_directory:
+ *
+ * Sets the directory the history files are kept in, which is only useful
+ * for the self tests.
+ **/
+void
+up_history_set_directory (UpHistory *history, const gchar *dir)
+{
+	g_return_if_fail (UP_IS_HISTORY (history));
 
-	return TRUE;
+	g_free (history->priv->dir);
+	history->priv->dir = g_strdup (dir);
 }
 
 /**
- * up_history_set_id:
+ * up_history_set_retention:
+ * @raw_age: how long to keep every sample, in seconds
+ * @minute_age: how long to keep the per-minute aggregates, in seconds
+ * @hour_age: how long to keep the per-hour aggregates, in seconds
+ * @capacity_age: how long to keep the capacity, in seconds
+ *
+ * Sets how long the data is kept in each tier, where zero means forever.
+ * This should be called before up_history_set_id().
  **/
-gboolean
-up_history_set_id (UpHistory *history, const gchar *id)
+void
+up_history_set_retention (UpHistory *history, guint raw_age, guint minute_age,
+			  guint hour_age, guint capacity_age)
 {
-	gboolean ret;
+	g_return_if_fail (UP_IS_HISTORY (history));
 
-	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+	history->priv->max_age[UP_HISTORY_TIER_RAW] = raw_age;
+	history->priv->max_age[UP_HISTORY_TIER_MINUTE] = minute_age;
+	history->priv->max_age[UP_HISTORY_TIER_HOUR] = hour_age;
+	history->priv->capacity_age = capacity_age;
 
-	if (history->priv->id != NULL)
-		return FALSE;
-	if (id == NULL)
-		return FALSE;
+	/* this decides which tiers the results come from */
+	up_history_cache_clear (history);
+}
 
-	egg_debug ("using id: %s", id);
-	history->priv->id = g_strdup (id);
-	/* load all previous data */
-	ret = up_history_load_data (history);
-	return ret;
+/**
+ * up_history_set_journal_interval:
+ * @interval: how often the journal is synced, in seconds
+ *
+ * Sets how many seconds of samples can be lost in a crash, where zero
+ * disables the journal and the samples are only saved every few minutes.
+ * This should be called before up_history_set_id().
+ **/
+void
+up_history_set_journal_interval (UpHistory *history, guint interval)
+{
+	g_return_if_fail (UP_IS_HISTORY (history));
+	history->priv->journal_interval = interval;
 }
 
 /**
@@ -681,6 +5382,11 @@ up_history_set_state (UpHistory *history, UpDeviceState state)
 
 	if (history->priv->id == NULL)
 		return FALSE;
+
+	/* a cycle can end without the charge or rate changing */
+	if (state != history->priv->state && history->priv->load == NULL)
+		up_history_cycles_add (history->priv->cycles, up_history_get_time_now (),
+				       UP_HISTORY_TYPE_UNKNOWN, 0.0f, state);
 	history->priv->state = state;
 	return TRUE;
 }
@@ -691,8 +5397,6 @@ up_history_set_state (UpHistory *history, UpDeviceState state)
 gboolean
 up_history_set_charge_data (UpHistory *history, gdouble percentage)
 {
-	UpHistoryItem *item;
-
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
 	if (history->priv->id == NULL)
@@ -703,11 +5407,7 @@ up_history_set_charge_data (UpHistory *history, gdouble percentage)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, percentage);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_charge, item);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, percentage, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -722,8 +5422,6 @@ up_history_set_charge_data (UpHistory *history, gdouble percentage)
 gboolean
 up_history_set_rate_data (UpHistory *history, gdouble rate)
 {
-	UpHistoryItem *item;
-
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
 	if (history->priv->id == NULL)
@@ -734,11 +5432,7 @@ up_history_set_rate_data (UpHistory *history, gdouble rate)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, rate);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_rate, item);
+	up_history_add_sample (history, UP_HISTORY_TYPE_RATE, rate, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -753,8 +5447,6 @@ up_history_set_rate_data (UpHistory *history, gdouble rate)
 gboolean
 up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 {
-	UpHistoryItem *item;
-
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
 	if (history->priv->id == NULL)
@@ -767,11 +5459,7 @@ up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, (gdouble) time_s);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_time_full, item);
+	up_history_add_sample (history, UP_HISTORY_TYPE_TIME_FULL, (gdouble) time_s, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -786,8 +5474,6 @@ up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 gboolean
 up_history_set_time_empty_data (UpHistory *history, gint64 time_s)
 {
-	UpHistoryItem *item;
-
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
 	if (history->priv->id == NULL)
@@ -800,11 +5486,7 @@ up_history_set_time_empty_data (UpHistory *history, gint64 time_s)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, (gdouble) time_s);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_time_empty, item);
+	up_history_add_sample (history, UP_HISTORY_TYPE_TIME_EMPTY, (gdouble) time_s, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -813,6 +5495,39 @@ up_history_set_time_empty_data (UpHistory *history, gint64 time_s)
 	return TRUE;
 }
 
+/**
+ * up_history_set_capacity_data:
+ * @capacity: the percentage of the design capacity the battery can hold
+ *
+ * The capacity is recorded the first time it is set, which is at coldplug,
+ * and then at most once a day.
+ **/
+gboolean
+up_history_set_capacity_data (UpHistory *history, gdouble capacity)
+{
+	guint32 now;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
+
+	if (history->priv->id == NULL)
+		return FALSE;
+	if (capacity <= 0.0f)
+		return FALSE;
+	now = up_history_get_time_now ();
+	if (history->priv->capacity_time_last != 0 &&
+	    now - history->priv->capacity_time_last < UP_HISTORY_CAPACITY_INTERVAL)
+		return FALSE;
+
+	/* add to array and schedule save file */
+	up_history_add_sample (history, UP_HISTORY_TYPE_CAPACITY, capacity, history->priv->state);
+	up_history_schedule_save (history);
+
+	/* save last time */
+	history->priv->capacity_time_last = now;
+
+	return TRUE;
+}
+
 /**
  * up_history_class_init:
  * @klass: The UpHistoryClass
@@ -823,6 +5538,14 @@ up_history_class_init (UpHistoryClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 	object_class->finalize = up_history_finalize;
 	g_type_class_add_private (klass, sizeof (UpHistoryPrivate));
+
+	signals[UP_HISTORY_LOADED] =
+		g_signal_new ("loaded",
+			      G_OBJECT_CLASS_TYPE (klass),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL,
+			      g_cclosure_marshal_VOID__VOID,
+			      G_TYPE_NONE, 0);
 }
 
 /**
@@ -834,14 +5557,25 @@ up_history_init (UpHistory *history)
 {
 	history->priv = UP_HISTORY_GET_PRIVATE (history);
 	history->priv->id = NULL;
+	history->priv->dir = g_build_filename (PACKAGE_LOCALSTATE_DIR, "lib", "upower", NULL);
 	history->priv->rate_last = 0;
 	history->priv->percentage_last = 0;
 	history->priv->state = UP_DEVICE_STATE_UNKNOWN;
-	history->priv->data_rate = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_charge = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_time_full = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_time_empty = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	history->priv->data = up_history_series_new ();
+	history->priv->profile = up_history_profile_new ();
+	history->priv->cycles = up_history_cycles_new ();
+	history->priv->max_age[UP_HISTORY_TIER_RAW] = UP_HISTORY_RAW_AGE_DEFAULT;
+	history->priv->max_age[UP_HISTORY_TIER_MINUTE] = UP_HISTORY_MINUTE_AGE_DEFAULT;
+	history->priv->max_age[UP_HISTORY_TIER_HOUR] = UP_HISTORY_HOUR_AGE_DEFAULT;
+	history->priv->capacity_age = UP_HISTORY_CAPACITY_AGE_DEFAULT;
 	history->priv->save_id = 0;
+	history->priv->journal = g_byte_array_new ();
+	history->priv->journal_new = TRUE;
+	history->priv->read_only = FALSE;
+
+	if (up_history_instances == NULL)
+		up_history_instances = g_ptr_array_new ();
+	g_ptr_array_add (up_history_instances, history);
 }
 
 /**
@@ -857,18 +5591,26 @@ up_history_finalize (GObject *object)
 
 	history = UP_HISTORY (object);
 
+	/* the load pool must be done with us */
+	up_history_load_wait (history);
+	g_ptr_array_remove_fast (up_history_instances, history);
+
 	/* save */
 	if (history->priv->save_id > 0)
 		g_source_remove (history->priv->save_id);
 	if (history->priv->id != NULL)
 		up_history_save_data (history);
 
-	g_ptr_array_unref (history->priv->data_rate);
-	g_ptr_array_unref (history->priv->data_charge);
-	g_ptr_array_unref (history->priv->data_time_full);
-	g_ptr_array_unref (history->priv->data_time_empty);
+	up_history_series_free (history->priv->data);
+	g_free (history->priv->profile);
+	up_history_cycles_free (history->priv->cycles);
+	up_history_cache_clear (history);
+	if (history->priv->journal_id > 0)
+		g_source_remove (history->priv->journal_id);
+	g_byte_array_free (history->priv->journal, TRUE);
 
 	g_free (history->priv->id);
+	g_free (history->priv->dir);
 
 	g_return_if_fail (history->priv != NULL);
 
@@ -888,3 +5630,329 @@ up_history_new (void)
 	return UP_HISTORY (history);
 }
 
+
+#ifdef EGG_TEST
+
+/**
+ * up_history_test_fill:
+ *
+ * Adds samples until @store has @len of them, with irregular steps in
+ * time, state changes, values that repeat, are negative or zero, and
+ * history types that come and go.
+ **/
+static void
+up_history_test_fill (UpHistoryStore *store, guint len)
+{
+	guint i;
+	guint32 time_s = 1300000000;
+	gdouble value;
+	UpDeviceState state;
+	const guint32 deltas[] = { 30, 30, 31, 90, 2, 0, 300, 30, 2500, 30, 100000, 45, 30, 1 };
+	const UpDeviceState states[] = { UP_DEVICE_STATE_CHARGING,
+					 UP_DEVICE_STATE_DISCHARGING,
+					 UP_DEVICE_STATE_FULLY_CHARGED };
+
+	for (i=0; store->len < len; i++) {
+		time_s += deltas[i % G_N_ELEMENTS (deltas)];
+		state = states[(i / 37) % G_N_ELEMENTS (states)];
+
+		/* the charge often stays the same */
+		value = 100.0f - (i / 5 % 97) * 0.37f;
+		if (i % 11 == 0)
+			value = 0.0f;
+		up_history_store_add_aggregate (store, time_s, UP_HISTORY_TYPE_CHARGE, value,
+						value - i % 4, value + i % 3 * 0.5f, 1 + i / 7 % 4, state);
+
+		/* the rate can be negative, and is not in every sample */
+		if (i % 3 != 0) {
+			value = ((gint) (i % 7) - 3) * 4.25f;
+			if (i % 101 == 0)
+				value = -1e300;
+			up_history_store_add_aggregate (store, time_s, UP_HISTORY_TYPE_RATE, value,
+							value, value + 1.0f, 1 + i % 2, state);
+		}
+
+		if (i % 50 < 10)
+			up_history_store_add_aggregate (store, time_s, UP_HISTORY_TYPE_TIME_EMPTY, i * 60.0f,
+							i * 60.0f, i * 60.0f, 1, state);
+	}
+}
+
+/**
+ * up_history_test_compare:
+ *
+ * Checks that the samples of @store, which must all be hot, are those of
+ * @expected, with the values bit for bit.
+ **/
+static void
+up_history_test_compare (const UpHistoryStore *store, const UpHistoryStore *expected)
+{
+	guint i;
+	guint j;
+
+	g_assert_cmpint (up_history_store_get_total (store), ==, expected->len);
+	for (i=0; i<expected->len; i++) {
+		g_assert_cmpint (store->time[i], ==, expected->time[i]);
+		g_assert_cmpint (store->state[i], ==, expected->state[i]);
+		g_assert_cmpint (store->present[i], ==, expected->present[i]);
+		for (j=0; j<UP_HISTORY_METRICS; j++) {
+			if (!up_history_store_has (expected, i, j))
+				continue;
+			g_assert (memcmp (&store->value[j][i], &expected->value[j][i], sizeof (gdouble)) == 0);
+			if (!expected->aggregate)
+				continue;
+			g_assert (memcmp (&store->min[j][i], &expected->min[j][i], sizeof (gdouble)) == 0);
+			g_assert (memcmp (&store->max[j][i], &expected->max[j][i], sizeof (gdouble)) == 0);
+			g_assert_cmpint (store->count[j][i], ==, expected->count[j][i]);
+		}
+	}
+}
+
+/**
+ * up_history_test_check_memory:
+ *
+ * Checks the running total of @store against the columns and segments it has.
+ **/
+static void
+up_history_test_check_memory (const UpHistoryStore *store)
+{
+	guint i;
+	gsize size;
+	const UpHistorySegment *segment;
+
+	size = sizeof (UpHistoryStore);
+	size += (gsize) store->size * up_history_store_get_row_size (store);
+	for (i=0; i<store->segments->len; i++) {
+		segment = g_ptr_array_index (store->segments, i);
+		size += sizeof (UpHistorySegment) + segment->length;
+	}
+	g_assert_cmpuint (up_history_store_get_memory (store), ==, size);
+}
+
+/**
+ * up_history_test_roundtrip:
+ *
+ * Decodes a store that is long enough to have several cold segments, both
+ * from the segments themselves and from the file they are written to.
+ **/
+static void
+up_history_test_roundtrip (gboolean aggregate)
+{
+	guint i;
+	guint8 *data;
+	gsize length;
+	gboolean ret;
+	gboolean compact = FALSE;
+	UpHistoryStore *store;
+	UpHistoryStore *expected;
+	UpHistoryStore *decoded;
+	const UpHistorySegment *segment;
+
+	store = up_history_store_new (aggregate);
+	up_history_test_fill (store, 3 * UP_HISTORY_SEGMENT_SIZE + 100);
+	expected = up_history_store_copy (store, 0);
+
+	/* everything is on disk, so all but the newest samples go cold */
+	up_history_store_freeze (store, up_history_store_get_total (store));
+	g_assert_cmpint (store->segments->len, ==, 3);
+	g_assert_cmpint (store->len, ==, 100);
+	up_history_test_check_memory (store);
+	up_history_test_check_memory (expected);
+
+	decoded = up_history_store_new (aggregate);
+	for (i=0; i<store->segments->len; i++) {
+		segment = g_ptr_array_index (store->segments, i);
+		ret = up_history_store_decompress (decoded, aggregate, UP_HISTORY_FILE_VERSION,
+						   UP_HISTORY_TYPE_UNKNOWN, segment->data,
+						   segment->length, segment->count);
+		g_assert (ret);
+	}
+	for (i=0; i<store->len; i++)
+		up_history_store_add_sample (decoded, store, i);
+	up_history_test_compare (decoded, expected);
+	up_history_test_check_memory (decoded);
+	up_history_store_free (decoded);
+
+	/* the file has the cold segments as they are, and the rest encoded */
+	data = up_history_array_encode (store, 0, TRUE, &length);
+	decoded = up_history_store_new (aggregate);
+	ret = up_history_array_from_binary (decoded, UP_HISTORY_TYPE_UNKNOWN, data, length, &compact);
+	g_assert (ret);
+	g_assert (!compact);
+	up_history_test_compare (decoded, expected);
+	up_history_store_free (decoded);
+
+	g_free (data);
+	up_history_store_free (expected);
+	up_history_store_free (store);
+}
+
+/**
+ * up_history_test_check_aggregate:
+ *
+ * Checks the aggregate of @metric in the hot sample @i of @store.
+ **/
+static void
+up_history_test_check_aggregate (const UpHistoryStore *store, guint i, UpHistoryType metric,
+				 guint32 time_s, UpDeviceState state, gdouble mean,
+				 gdouble min, gdouble max, guint32 count)
+{
+	g_assert (store->aggregate);
+	g_assert_cmpint (store->time[i], ==, time_s);
+	g_assert_cmpint (store->state[i], ==, state);
+	g_assert (up_history_store_has (store, i, metric));
+	g_assert_cmpfloat (ABS (store->value[metric][i] - mean), <, 0.001f);
+	g_assert_cmpfloat (store->min[metric][i], ==, min);
+	g_assert_cmpfloat (store->max[metric][i], ==, max);
+	g_assert_cmpint (store->count[metric][i], ==, count);
+}
+
+/**
+ * up_history_test_tiers:
+ *
+ * Rolls samples from several buckets into the coarser tiers once they are
+ * older than a short retention.
+ **/
+static void
+up_history_test_tiers (void)
+{
+	guint i;
+	UpHistory *history;
+	UpHistorySeries *series;
+	UpHistoryStore *raw;
+	UpHistoryStore *minute;
+	UpHistoryStore *hour;
+	UpDeviceState state;
+	const guint32 start = 1300000000 - 1300000000 % 3600;
+	const gdouble charge[] = { 10.0f, 20.0f, 30.0f, 40.0f, 50.0f, 60.0f, 70.0f, 80.0f, 90.0f };
+	const gdouble rate[] = { -5.0f, -15.0f };
+
+	history = up_history_new ();
+	up_history_set_retention (history, 60 * 60, 2 * 24 * 60 * 60, 0, 0);
+	series = history->priv->data;
+	raw = series->tier[UP_HISTORY_TIER_RAW];
+	minute = series->tier[UP_HISTORY_TIER_MINUTE];
+	hour = series->tier[UP_HISTORY_TIER_HOUR];
+
+	/* three minutes of samples, where the last one is charging */
+	for (i=0; i<G_N_ELEMENTS (charge); i++) {
+		state = (i < 8) ? UP_DEVICE_STATE_DISCHARGING : UP_DEVICE_STATE_CHARGING;
+		up_history_store_add (raw, start + i * 20, UP_HISTORY_TYPE_CHARGE, charge[i], state);
+		if (i < G_N_ELEMENTS (rate))
+			up_history_store_add (raw, start + i * 20, UP_HISTORY_TYPE_RATE, rate[i], state);
+	}
+	up_history_store_add (raw, start + 7230, UP_HISTORY_TYPE_CHARGE, 95.0f, UP_DEVICE_STATE_CHARGING);
+
+	/* an hour later only the newest sample is still raw */
+	up_history_series_expire (history, series, start + 7230, FALSE);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		up_history_test_check_memory (series->tier[i]);
+	g_assert_cmpint (up_history_store_get_total (raw), ==, 1);
+	g_assert_cmpint (up_history_store_get_total (minute), ==, 4);
+	g_assert_cmpint (up_history_store_get_total (hour), ==, 0);
+	up_history_test_check_aggregate (minute, 0, UP_HISTORY_TYPE_CHARGE, start,
+					 UP_DEVICE_STATE_DISCHARGING, 20.0f, 10.0f, 30.0f, 3);
+	up_history_test_check_aggregate (minute, 0, UP_HISTORY_TYPE_RATE, start,
+					 UP_DEVICE_STATE_DISCHARGING, -10.0f, -15.0f, -5.0f, 2);
+	up_history_test_check_aggregate (minute, 1, UP_HISTORY_TYPE_CHARGE, start + 60,
+					 UP_DEVICE_STATE_DISCHARGING, 50.0f, 40.0f, 60.0f, 3);
+	g_assert (!up_history_store_has (minute, 1, UP_HISTORY_TYPE_RATE));
+	up_history_test_check_aggregate (minute, 2, UP_HISTORY_TYPE_CHARGE, start + 120,
+					 UP_DEVICE_STATE_DISCHARGING, 75.0f, 70.0f, 80.0f, 2);
+	up_history_test_check_aggregate (minute, 3, UP_HISTORY_TYPE_CHARGE, start + 120,
+					 UP_DEVICE_STATE_CHARGING, 90.0f, 90.0f, 90.0f, 1);
+	g_assert (series->file[UP_HISTORY_TIER_RAW].compact);
+
+	/* days later the minutes are rolled up into hours, weighted by count */
+	up_history_store_add (raw, start + 3 * 24 * 60 * 60, UP_HISTORY_TYPE_CHARGE, 96.0f,
+			      UP_DEVICE_STATE_CHARGING);
+	up_history_series_expire (history, series, start + 3 * 24 * 60 * 60, FALSE);
+	for (i=0; i<UP_HISTORY_TIER_LAST; i++)
+		up_history_test_check_memory (series->tier[i]);
+	g_assert_cmpint (up_history_store_get_total (raw), ==, 1);
+	g_assert_cmpint (up_history_store_get_total (minute), ==, 0);
+	g_assert_cmpint (up_history_store_get_total (hour), ==, 3);
+	up_history_test_check_aggregate (hour, 0, UP_HISTORY_TYPE_CHARGE, start,
+					 UP_DEVICE_STATE_DISCHARGING, 45.0f, 10.0f, 80.0f, 8);
+	up_history_test_check_aggregate (hour, 0, UP_HISTORY_TYPE_RATE, start,
+					 UP_DEVICE_STATE_DISCHARGING, -10.0f, -15.0f, -5.0f, 2);
+	up_history_test_check_aggregate (hour, 1, UP_HISTORY_TYPE_CHARGE, start,
+					 UP_DEVICE_STATE_CHARGING, 90.0f, 90.0f, 90.0f, 1);
+	up_history_test_check_aggregate (hour, 2, UP_HISTORY_TYPE_CHARGE, start + 7200,
+					 UP_DEVICE_STATE_CHARGING, 95.0f, 95.0f, 95.0f, 1);
+
+	g_object_unref (history);
+}
+
+/**
+ * up_history_test_clock_step:
+ *
+ * Steps the wall clock back, first past samples that are not yet saved and
+ * then into those that are.
+ **/
+static void
+up_history_test_clock_step (void)
+{
+	guint i;
+	guint rewrites;
+	UpHistory *history;
+	UpHistorySeries *series;
+	UpHistoryStore *raw;
+	const guint32 times[] = { 1300000000, 1300000030, 1300000060, 1300000090, 1300000120 };
+	const gdouble values[] = { 50.0f, 46.0f, 49.0f, 47.0f, 48.0f };
+
+	history = up_history_new ();
+	series = history->priv->data;
+	raw = series->tier[UP_HISTORY_TIER_RAW];
+
+	up_history_set_time (times[0]);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, values[0], UP_DEVICE_STATE_DISCHARGING);
+	up_history_set_time (times[2]);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, values[2], UP_DEVICE_STATE_DISCHARGING);
+	up_history_set_time (times[4]);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, values[4], UP_DEVICE_STATE_DISCHARGING);
+	g_assert_cmpint (series->rewrites, ==, 0);
+
+	/* the first two samples are in the file */
+	series->file[UP_HISTORY_TIER_RAW].saved = 2;
+
+	/* back past the newest sample, which is not saved */
+	rewrites = series->rewrites;
+	up_history_set_time (times[3]);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, values[3], UP_DEVICE_STATE_DISCHARGING);
+	g_assert_cmpint (series->rewrites, ==, rewrites + 1);
+	g_assert (!series->file[UP_HISTORY_TIER_RAW].compact);
+
+	/* back into what is saved, so the file has to be rewritten */
+	up_history_set_time (times[1]);
+	up_history_add_sample (history, UP_HISTORY_TYPE_CHARGE, values[1], UP_DEVICE_STATE_DISCHARGING);
+	g_assert_cmpint (series->rewrites, ==, rewrites + 2);
+	g_assert (series->file[UP_HISTORY_TIER_RAW].compact);
+
+	/* every sample went in time order */
+	g_assert_cmpint (raw->len, ==, G_N_ELEMENTS (times));
+	for (i=0; i<raw->len; i++) {
+		g_assert_cmpint (raw->time[i], ==, times[i]);
+		g_assert_cmpfloat (raw->value[UP_HISTORY_TYPE_CHARGE][i], ==, values[i]);
+	}
+
+	up_history_set_time (0);
+	g_object_unref (history);
+}
+
+/**
+ * up_history_test:
+ *
+ * Tests the parts of the store that cannot be reached through the
+ * public API.
+ **/
+void
+up_history_test (gpointer user_data)
+{
+	up_history_test_roundtrip (FALSE);
+	up_history_test_roundtrip (TRUE);
+	up_history_test_tiers ();
+	up_history_test_clock_step ();
+}
+
+#endif
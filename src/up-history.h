@@ -55,9 +55,45 @@ typedef enum {
 	UP_HISTORY_TYPE_RATE,
 	UP_HISTORY_TYPE_TIME_FULL,
 	UP_HISTORY_TYPE_TIME_EMPTY,
+	UP_HISTORY_TYPE_CAPACITY,
 	UP_HISTORY_TYPE_UNKNOWN
 } UpHistoryType;
 
+typedef enum {
+	UP_HISTORY_DOWNSAMPLE_AVERAGE,
+	UP_HISTORY_DOWNSAMPLE_LTTB,
+	UP_HISTORY_DOWNSAMPLE_MINMAX,
+	UP_HISTORY_DOWNSAMPLE_UNKNOWN
+} UpHistoryDownsample;
+
+/* a downsampled point, without the cost of an UpHistoryItem */
+typedef struct {
+	guint32			 time;
+	gdouble			 value;
+	UpDeviceState		 state;
+} UpHistoryPoint;
+
+/* a run of samples in the same state, such as a charge or a discharge */
+typedef struct {
+	guint32			 time_start;
+	guint32			 time_end;
+	UpDeviceState		 state;
+	gdouble			 percentage_start;
+	gdouble			 percentage_end;
+	gdouble			 energy;	/* Wh, negative when discharging */
+} UpHistoryCycle;
+
+/* how long each tier of history is kept by default, in seconds */
+#define UP_HISTORY_RAW_AGE_DEFAULT	(7 * 24 * 60 * 60)
+#define UP_HISTORY_MINUTE_AGE_DEFAULT	(30 * 24 * 60 * 60)
+#define UP_HISTORY_HOUR_AGE_DEFAULT	(365 * 24 * 60 * 60)
+#define UP_HISTORY_CAPACITY_AGE_DEFAULT	(5 * 365 * 24 * 60 * 60)
+
+/* how often the journal is synced by default, in seconds */
+#define UP_HISTORY_JOURNAL_INTERVAL_DEFAULT	30
+
+/* how much memory the history of all the devices can use by default, in bytes */
+#define UP_HISTORY_MEMORY_BUDGET_DEFAULT	(8 * 1024 * 1024)
 
 GType		 up_history_get_type			(void);
 UpHistory	*up_history_new			(void);
@@ -67,10 +103,51 @@ GPtrArray	*up_history_get_data			(UpHistory		*history,
 							 UpHistoryType		 type,
 							 guint			 timespan,
 							 guint			 resolution);
+GArray		*up_history_get_data_downsampled	(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			 timespan,
+							 guint			 resolution,
+							 UpHistoryDownsample	 method);
+GArray		*up_history_get_data_since		(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint32		 since,
+							 guint			*generation);
 GPtrArray	*up_history_get_profile_data		(UpHistory		*history,
 							 gboolean		 charging);
+GArray		*up_history_get_cycles			(UpHistory		*history,
+							 guint			 timespan);
+gboolean	 up_history_get_statistics		(UpHistory		*history,
+							 gboolean		 charging,
+							 guint			 bins,
+							 guint			 timespan,
+							 GArray			**values,
+							 GArray			**accuracies);
+void		 up_history_get_cache_stats		(UpHistory		*history,
+							 guint			*hits,
+							 guint			*misses);
 gboolean	 up_history_set_id			(UpHistory		*history,
 							 const gchar		*id);
+gboolean	 up_history_open			(UpHistory		*history,
+							 const gchar		*id);
+gboolean	 up_history_rewrite			(UpHistory		*history);
+gboolean	 up_history_export_text			(UpHistory		*history,
+							 GError			**error);
+gchar		*up_history_to_text			(UpHistory		*history);
+gboolean	 up_history_is_loading			(UpHistory		*history);
+void		 up_history_wait_loaded			(UpHistory		*history);
+void		 up_history_set_directory		(UpHistory		*history,
+							 const gchar		*dir);
+void		 up_history_sync			(void);
+void		 up_history_set_time			(guint32		 time_s);
+void		 up_history_set_memory_budget		(gsize			 budget);
+gsize		 up_history_get_memory_usage		(UpHistory		*history);
+void		 up_history_set_retention		(UpHistory		*history,
+							 guint			 raw_age,
+							 guint			 minute_age,
+							 guint			 hour_age,
+							 guint			 capacity_age);
+void		 up_history_set_journal_interval	(UpHistory		*history,
+							 guint			 interval);
 gboolean	 up_history_set_state			(UpHistory		*history,
 							 UpDeviceState		 state);
 gboolean	 up_history_set_charge_data		(UpHistory		*history,
@@ -81,6 +158,8 @@ gboolean	 up_history_set_time_full_data		(UpHistory		*history,
 							 gint64			 time);
 gboolean	 up_history_set_time_empty_data	(UpHistory		*history,
 							 gint64			 time);
+gboolean	 up_history_set_capacity_data		(UpHistory		*history,
+							 gdouble		 capacity);
 
 G_END_DECLS
 
@@ -39,6 +39,7 @@
 #include "egg-debug.h"
 
 #include "up-daemon.h"
+#include "up-history.h"
 #include "up-qos.h"
 #include "up-wakeups.h"
 
@@ -145,6 +146,8 @@ main (gint argc, gchar **argv)
 		{ NULL}
 	};
 
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
 	g_type_init ();
 
 	context = g_option_context_new ("upower daemon");
@@ -213,6 +216,10 @@ out:
 		g_object_unref (wakeups);
 	if (daemon != NULL)
 		g_object_unref (daemon);
+
+	/* wait for the history to be written */
+	up_history_sync ();
+
 	if (loop != NULL)
 		g_main_loop_unref (loop);
 	return retval;
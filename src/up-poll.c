@@ -0,0 +1,432 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "egg-debug.h"
+
+#include "up-poll.h"
+
+static void	up_poll_finalize	(GObject	*object);
+
+#define UP_POLL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_POLL, UpPollPrivate))
+
+/*
+ * Every device that needs polling registers here rather than adding its
+ * own timeout, and one timer wakes the daemon for all of them. Each poll
+ * may run up to its slack after it is due, which is used to move the
+ * wakeup onto a multiple of UP_POLL_SLOT and to run every other poll that
+ * is due by then at the same time.
+ */
+
+typedef struct {
+	guint			 id;
+	guint			 interval;
+	guint			 slack;
+	gint64			 deadline;
+	GSourceFunc		 func;
+	gpointer		 user_data;
+	gchar			*name;
+} UpPollItem;
+
+struct UpPollPrivate
+{
+	GPtrArray		*items;
+	guint			 next_id;
+	guint			 timer_id;
+	gint64			 timer_wake;
+	gboolean		 dispatching;
+	guint			 wakeups;
+};
+
+G_DEFINE_TYPE (UpPoll, up_poll, G_TYPE_OBJECT)
+
+/**
+ * up_poll_get_time_now:
+ **/
+static gint64
+up_poll_get_time_now (void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return g_get_monotonic_time () / G_USEC_PER_SEC;
+#else
+	GTimeVal timeval;
+	g_get_current_time (&timeval);
+	return timeval.tv_sec;
+#endif
+}
+
+/**
+ * up_poll_item_free:
+ **/
+static void
+up_poll_item_free (UpPollItem *item)
+{
+	g_free (item->name);
+	g_free (item);
+}
+
+/**
+ * up_poll_find:
+ **/
+static UpPollItem *
+up_poll_find (UpPoll *poll, guint id, guint *index)
+{
+	UpPollItem *item;
+	guint i;
+
+	for (i=0; i<poll->priv->items->len; i++) {
+		item = g_ptr_array_index (poll->priv->items, i);
+		if (item->id == id) {
+			if (index != NULL)
+				*index = i;
+			return item;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * up_poll_get_wake_time:
+ * @deadline: when the poll is due
+ * @slack: seconds the poll may be late by
+ *
+ * Returns: the latest time in the window of the poll, moved back onto a
+ * multiple of %UP_POLL_SLOT if that is still in the window
+ **/
+gint64
+up_poll_get_wake_time (gint64 deadline, guint slack)
+{
+	gint64 wake;
+
+	wake = deadline + slack;
+	if (wake - wake % UP_POLL_SLOT >= deadline)
+		wake -= wake % UP_POLL_SLOT;
+	return wake;
+}
+
+/**
+ * up_poll_get_next_deadline:
+ * @deadline: when the poll was due
+ * @interval: seconds between calls
+ * @now: when the poll was run
+ *
+ * Returns: when the poll is due again, which keeps the phase unless the
+ * poll fell a whole interval behind
+ **/
+gint64
+up_poll_get_next_deadline (gint64 deadline, guint interval, gint64 now)
+{
+	deadline += interval;
+	if (deadline <= now)
+		deadline = now + interval;
+	return deadline;
+}
+
+/**
+ * up_poll_get_next_wake:
+ *
+ * Returns: the time the daemon has to wake up next, or -1 for never
+ **/
+gint64
+up_poll_get_next_wake (UpPoll *poll)
+{
+	UpPollItem *item;
+	gint64 wake = -1;
+	gint64 tmp;
+	guint i;
+
+	g_return_val_if_fail (UP_IS_POLL (poll), -1);
+
+	/* the other polls that are due by then run in the same wakeup */
+	for (i=0; i<poll->priv->items->len; i++) {
+		item = g_ptr_array_index (poll->priv->items, i);
+		tmp = up_poll_get_wake_time (item->deadline, item->slack);
+		if (wake < 0 || tmp < wake)
+			wake = tmp;
+	}
+	return wake;
+}
+
+static gboolean up_poll_timeout_cb (UpPoll *poll);
+
+/**
+ * up_poll_reschedule:
+ *
+ * Keeps the running timer if the next wakeup has not moved.
+ **/
+static void
+up_poll_reschedule (UpPoll *poll)
+{
+	UpPollPrivate *priv = poll->priv;
+	gint64 wake;
+	gint64 now;
+
+	/* done when the dispatch finishes */
+	if (priv->dispatching)
+		return;
+
+	wake = up_poll_get_next_wake (poll);
+	if (priv->timer_id != 0 && priv->timer_wake == wake)
+		return;
+	if (priv->timer_id != 0) {
+		g_source_remove (priv->timer_id);
+		priv->timer_id = 0;
+	}
+	if (wake < 0)
+		return;
+
+	now = up_poll_get_time_now ();
+	priv->timer_wake = wake;
+	priv->timer_id = g_timeout_add_seconds (MAX (wake - now, 0), (GSourceFunc) up_poll_timeout_cb, poll);
+#if GLIB_CHECK_VERSION(2,25,8)
+	g_source_set_name_by_id (priv->timer_id, "[UpPoll] wakeup");
+#endif
+}
+
+/**
+ * up_poll_dispatch:
+ * @poll: a #UpPoll
+ * @now: the time to run the polls for
+ *
+ * Runs every poll that is due at @now, removing those that return %FALSE.
+ * The polls may add and remove polls, including themselves.
+ **/
+void
+up_poll_dispatch (UpPoll *poll, gint64 now)
+{
+	UpPollPrivate *priv;
+	UpPollItem *item;
+	GArray *due;
+	gboolean ret;
+	guint index;
+	guint id;
+	guint i;
+
+	g_return_if_fail (UP_IS_POLL (poll));
+	g_return_if_fail (!poll->priv->dispatching);
+
+	priv = poll->priv;
+	priv->dispatching = TRUE;
+	priv->wakeups++;
+
+	/* collect them first, as the callbacks can add and remove polls */
+	due = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (i=0; i<priv->items->len; i++) {
+		item = g_ptr_array_index (priv->items, i);
+		if (item->deadline <= now)
+			g_array_append_val (due, item->id);
+	}
+
+	for (i=0; i<due->len; i++) {
+		id = g_array_index (due, guint, i);
+		item = up_poll_find (poll, id, NULL);
+		if (item == NULL)
+			continue;
+		egg_debug ("polling %s, %li seconds late", item->name, (glong) (now - item->deadline));
+		ret = item->func (item->user_data);
+
+		/* the callback may have removed it */
+		item = up_poll_find (poll, id, &index);
+		if (item == NULL)
+			continue;
+		if (!ret) {
+			g_ptr_array_remove_index_fast (priv->items, index);
+			continue;
+		}
+
+		item->deadline = up_poll_get_next_deadline (item->deadline, item->interval, now);
+	}
+	g_array_free (due, TRUE);
+	priv->dispatching = FALSE;
+
+	if (egg_debug_is_verbose ()) {
+		gchar *text = up_poll_to_string (poll);
+		egg_debug ("%s", text);
+		g_free (text);
+	}
+
+	up_poll_reschedule (poll);
+}
+
+/**
+ * up_poll_timeout_cb:
+ **/
+static gboolean
+up_poll_timeout_cb (UpPoll *poll)
+{
+	poll->priv->timer_id = 0;
+	up_poll_dispatch (poll, up_poll_get_time_now ());
+	return FALSE;
+}
+
+/**
+ * up_poll_add:
+ * @poll: a #UpPoll
+ * @interval: seconds between calls
+ * @slack: seconds each call may be late by, so it can share a wakeup
+ * @func: called like a #GSourceFunc, returning %FALSE to stop polling
+ * @user_data: data for @func
+ * @name: describes the poll for debugging
+ *
+ * Returns: an id for up_poll_remove(), which is never 0
+ **/
+guint
+up_poll_add (UpPoll *poll, guint interval, guint slack, GSourceFunc func, gpointer user_data, const gchar *name)
+{
+	UpPollItem *item;
+
+	g_return_val_if_fail (UP_IS_POLL (poll), 0);
+	g_return_val_if_fail (interval > 0, 0);
+	g_return_val_if_fail (func != NULL, 0);
+
+	item = g_new0 (UpPollItem, 1);
+	item->id = ++poll->priv->next_id;
+	item->interval = interval;
+	item->slack = slack;
+	item->deadline = up_poll_get_time_now () + interval;
+	item->func = func;
+	item->user_data = user_data;
+	item->name = g_strdup (name);
+	g_ptr_array_add (poll->priv->items, item);
+
+	egg_debug ("added %s every %i seconds, slack %i", name, interval, slack);
+	up_poll_reschedule (poll);
+	return item->id;
+}
+
+/**
+ * up_poll_remove:
+ *
+ * Returns: %TRUE if the poll existed
+ **/
+gboolean
+up_poll_remove (UpPoll *poll, guint id)
+{
+	guint index;
+
+	g_return_val_if_fail (UP_IS_POLL (poll), FALSE);
+
+	if (up_poll_find (poll, id, &index) == NULL)
+		return FALSE;
+	g_ptr_array_remove_index_fast (poll->priv->items, index);
+	up_poll_reschedule (poll);
+	return TRUE;
+}
+
+/**
+ * up_poll_get_size:
+ **/
+guint
+up_poll_get_size (UpPoll *poll)
+{
+	g_return_val_if_fail (UP_IS_POLL (poll), 0);
+	return poll->priv->items->len;
+}
+
+/**
+ * up_poll_to_string:
+ *
+ * Describes the schedule, for debugging.
+ **/
+gchar *
+up_poll_to_string (UpPoll *poll)
+{
+	UpPollItem *item;
+	GString *string;
+	gint64 now;
+	gint64 wake;
+	guint i;
+
+	g_return_val_if_fail (UP_IS_POLL (poll), NULL);
+
+	now = up_poll_get_time_now ();
+	wake = up_poll_get_next_wake (poll);
+	string = g_string_new ("");
+	g_string_append_printf (string, "%i polls after %i wakeups", poll->priv->items->len, poll->priv->wakeups);
+	if (wake >= 0)
+		g_string_append_printf (string, ", next in %li seconds", (glong) (wake - now));
+	g_string_append (string, "\n");
+	for (i=0; i<poll->priv->items->len; i++) {
+		item = g_ptr_array_index (poll->priv->items, i);
+		g_string_append_printf (string, "  %s: every %i seconds, slack %i, due in %li\n",
+					item->name, item->interval, item->slack,
+					(glong) (item->deadline - now));
+	}
+	return g_string_free (string, FALSE);
+}
+
+/**
+ * up_poll_init:
+ **/
+static void
+up_poll_init (UpPoll *poll)
+{
+	poll->priv = UP_POLL_GET_PRIVATE (poll);
+	poll->priv->items = g_ptr_array_new_with_free_func ((GDestroyNotify) up_poll_item_free);
+	poll->priv->next_id = 0;
+	poll->priv->timer_id = 0;
+	poll->priv->dispatching = FALSE;
+	poll->priv->wakeups = 0;
+}
+
+/**
+ * up_poll_finalize:
+ **/
+static void
+up_poll_finalize (GObject *object)
+{
+	UpPoll *poll;
+
+	g_return_if_fail (object != NULL);
+	g_return_if_fail (UP_IS_POLL (object));
+
+	poll = UP_POLL (object);
+	if (poll->priv->timer_id != 0)
+		g_source_remove (poll->priv->timer_id);
+	g_ptr_array_unref (poll->priv->items);
+
+	G_OBJECT_CLASS (up_poll_parent_class)->finalize (object);
+}
+
+/**
+ * up_poll_class_init:
+ **/
+static void
+up_poll_class_init (UpPollClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = up_poll_finalize;
+	g_type_class_add_private (klass, sizeof (UpPollPrivate));
+}
+
+/**
+ * up_poll_new:
+ **/
+UpPoll *
+up_poll_new (void)
+{
+	UpPoll *poll;
+	poll = g_object_new (UP_TYPE_POLL, NULL);
+	return UP_POLL (poll);
+}
@@ -0,0 +1,76 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_POLL_H
+#define __UP_POLL_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define UP_TYPE_POLL		(up_poll_get_type ())
+#define UP_POLL(o)		(G_TYPE_CHECK_INSTANCE_CAST ((o), UP_TYPE_POLL, UpPoll))
+#define UP_POLL_CLASS(k)	(G_TYPE_CHECK_CLASS_CAST((k), UP_TYPE_POLL, UpPollClass))
+#define UP_IS_POLL(o)		(G_TYPE_CHECK_INSTANCE_TYPE ((o), UP_TYPE_POLL))
+#define UP_IS_POLL_CLASS(k)	(G_TYPE_CHECK_CLASS_TYPE ((k), UP_TYPE_POLL))
+#define UP_POLL_GET_CLASS(o)	(G_TYPE_INSTANCE_GET_CLASS ((o), UP_TYPE_POLL, UpPollClass))
+
+/* wakeups are put on multiples of this where the slack allows */
+#define UP_POLL_SLOT		5	/* seconds */
+
+typedef struct UpPollPrivate UpPollPrivate;
+
+typedef struct
+{
+	GObject			 parent;
+	UpPollPrivate		*priv;
+} UpPoll;
+
+typedef struct
+{
+	GObjectClass		 parent_class;
+} UpPollClass;
+
+GType		 up_poll_get_type		(void);
+UpPoll		*up_poll_new			(void);
+
+guint		 up_poll_add			(UpPoll			*poll,
+						 guint			 interval,
+						 guint			 slack,
+						 GSourceFunc		 func,
+						 gpointer		 user_data,
+						 const gchar		*name);
+gboolean	 up_poll_remove			(UpPoll			*poll,
+						 guint			 id);
+guint		 up_poll_get_size		(UpPoll			*poll);
+gint64		 up_poll_get_next_wake		(UpPoll			*poll);
+void		 up_poll_dispatch		(UpPoll			*poll,
+						 gint64			 now);
+gint64		 up_poll_get_wake_time		(gint64			 deadline,
+						 guint			 slack);
+gint64		 up_poll_get_next_deadline	(gint64			 deadline,
+						 guint			 interval,
+						 gint64			 now);
+gchar		*up_poll_to_string		(UpPoll			*poll);
+
+G_END_DECLS
+
+#endif /* __UP_POLL_H */
@@ -21,7 +21,9 @@
 
 #include "config.h"
 
+#include <string.h>
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include "egg-debug.h"
 
 #include "up-backend.h"
@@ -29,11 +31,18 @@
 #include "up-device.h"
 #include "up-device-list.h"
 #include "up-history.h"
+#include "up-history-item.h"
 #include "up-native.h"
 #include "up-polkit.h"
+#include "up-poll.h"
 #include "up-qos.h"
 #include "up-wakeups.h"
 
+#ifdef BACKEND_TYPE_LINUX
+#include "linux/sysfs-utils.h"
+#include "linux/up-device-supply-snapshot.h"
+#endif
+
 static void
 up_test_native_func (void)
 {
@@ -112,16 +121,234 @@ up_test_device_list_func (void)
 	g_object_unref (list);
 }
 
+/**
+ * up_test_history_remove_files:
+ *
+ * Removes every file the history of "test" can leave in @dir, so that an
+ * aborted run does not leak into the next one.
+ **/
+static void
+up_test_history_remove_files (const gchar *dir)
+{
+	GDir *handle;
+	const gchar *name;
+	gchar *filename;
+
+	handle = g_dir_open (dir, 0, NULL);
+	if (handle == NULL)
+		return;
+	while ((name = g_dir_read_name (handle)) != NULL) {
+		if (g_strcmp0 (name, "history-test.dat") != 0 &&
+		    (!g_str_has_prefix (name, "history-") || !g_str_has_suffix (name, "-test.dat")))
+			continue;
+		filename = g_build_filename (dir, name, NULL);
+		g_unlink (filename);
+		g_free (filename);
+	}
+	g_dir_close (handle);
+}
+
 static void
 up_test_history_func (void)
 {
 	UpHistory *history;
+	GPtrArray *array;
+	GArray *points;
+	GArray *values;
+	UpHistoryItem *item;
+	gchar *filename;
+	gchar *data = NULL;
+	gboolean ret;
+	guint i;
+	guint found = 0;
+	guint hits;
+	guint misses;
+	guint generation;
+	guint32 since;
+	gchar *journal;
+	gsize length;
 
 	history = up_history_new ();
 	g_assert (history != NULL);
 
+	/* start from a clean slate */
+	up_history_set_directory (history, "/tmp");
+	up_test_history_remove_files ("/tmp");
+	filename = g_build_filename ("/tmp", "history-test.dat", NULL);
+	up_history_set_journal_interval (history, 1);
+
+	/* add some data */
+	ret = up_history_set_id (history, "test");
+	g_assert (ret);
+	up_history_set_state (history, UP_DEVICE_STATE_DISCHARGING);
+	up_history_set_charge_data (history, 40.0f);
+	up_history_set_charge_data (history, 41.0f);
+	up_history_set_charge_data (history, 42.0f);
+	up_history_set_rate_data (history, 10.0f);
+
+	/* unref, which saves the data */
+	g_object_unref (history);
+	up_history_sync ();
+
+	/* check it's in the binary format */
+	ret = g_file_get_contents (filename, &data, NULL, NULL);
+	g_assert (ret);
+	g_assert (memcmp (data, "UPHISTRY", 8) == 0);
+	g_free (data);
+
+	/* the journal is emptied once everything is saved */
+	journal = g_build_filename ("/tmp", "history-journal-test.dat", NULL);
+	ret = g_file_get_contents (journal, &data, &length, NULL);
+	g_assert (ret);
+	g_assert_cmpint (length, ==, 16);
+	g_assert (memcmp (data, "UPJOURNL", 8) == 0);
+
+	/* load it back */
+	history = up_history_new ();
+	up_history_set_directory (history, "/tmp");
+	ret = up_history_set_id (history, "test");
+	g_assert (ret);
+	up_history_wait_loaded (history);
+	g_assert (!up_history_is_loading (history));
+	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
+	g_assert (array != NULL);
+	for (i=0; i<array->len; i++) {
+		item = (UpHistoryItem *) g_ptr_array_index (array, i);
+		if (up_history_item_get_value (item) > 39.0f) {
+			g_assert_cmpint (up_history_item_get_state (item), ==, UP_DEVICE_STATE_DISCHARGING);
+			found++;
+		}
+	}
+	g_assert_cmpint (found, ==, 3);
+	g_ptr_array_unref (array);
+
+	/* the same query again comes from the cache */
+	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
+	g_assert (array != NULL);
+	g_ptr_array_unref (array);
+	up_history_get_cache_stats (history, &hits, &misses);
+	g_assert_cmpint (hits, ==, 1);
+	g_assert_cmpint (misses, ==, 1);
+
+	/* the rate shares the samples, but is returned on its own */
+	array = up_history_get_data (history, UP_HISTORY_TYPE_RATE, 10, 100);
+	g_assert (array != NULL);
+	g_assert_cmpint (array->len, ==, 3);
+	g_ptr_array_unref (array);
+
+	/* keeps the first and last points, oldest first */
+	points = up_history_get_data_downsampled (history, UP_HISTORY_TYPE_CHARGE, 10, 2, UP_HISTORY_DOWNSAMPLE_LTTB);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, ==, 2);
+	g_assert_cmpint (g_array_index (points, UpHistoryPoint, 0).time, <=, g_array_index (points, UpHistoryPoint, 1).time);
+	g_array_unref (points);
+
+	/* nothing is newer than the last sample */
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, 0, &generation);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, >=, 3);
+	since = g_array_index (points, UpHistoryPoint, points->len - 1).time;
+	g_array_unref (points);
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, since, &i);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, ==, 0);
+	g_assert_cmpint (i, ==, generation);
+	g_array_unref (points);
+
+	/* the capacity is only sampled once a day */
+	ret = up_history_set_capacity_data (history, 95.0f);
+	g_assert (ret);
+	ret = up_history_set_capacity_data (history, 94.0f);
+	g_assert (!ret);
+	array = up_history_get_data (history, UP_HISTORY_TYPE_CAPACITY, 10, 100);
+	g_assert (array != NULL);
+	g_assert_cmpint (array->len, ==, 1);
+	g_ptr_array_unref (array);
+
+	/* the samples since the load are all in one discharge */
+	points = up_history_get_cycles (history, 0);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, >=, 1);
+	g_assert_cmpint (g_array_index (points, UpHistoryCycle, points->len - 1).state, ==, UP_DEVICE_STATE_DISCHARGING);
+	g_array_unref (points);
+
+	/* the statistics can have any number of bins */
+	ret = up_history_get_statistics (history, FALSE, 11, 0, &points, &values);
+	g_assert (ret);
+	g_assert_cmpint (points->len, ==, 11);
+	g_assert_cmpint (values->len, ==, 11);
+	g_array_unref (points);
+	g_array_unref (values);
+	ret = up_history_get_statistics (history, FALSE, 1, 0, &points, &values);
+	g_assert (!ret);
+
+	/* a new state in the second a client last asked about is not lost */
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, 0, &generation);
+	g_assert (points != NULL);
+	since = g_array_index (points, UpHistoryPoint, points->len - 1).time + 100;
+	g_array_unref (points);
+	up_history_set_time (since);
+	up_history_set_state (history, UP_DEVICE_STATE_DISCHARGING);
+	up_history_set_charge_data (history, 39.0f);
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, since - 1, &i);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, ==, 1);
+	g_assert_cmpint (g_array_index (points, UpHistoryPoint, 0).time, ==, since);
+	g_assert_cmpint (i, ==, generation);
+	g_array_unref (points);
+	up_history_set_state (history, UP_DEVICE_STATE_CHARGING);
+	up_history_set_charge_data (history, 38.0f);
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, since, &i);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, ==, 0);
+	g_assert_cmpint (i, !=, generation);
+	g_array_unref (points);
+	points = up_history_get_data_since (history, UP_HISTORY_TYPE_CHARGE, since - 1, NULL);
+	g_assert (points != NULL);
+	g_assert_cmpint (points->len, ==, 2);
+	g_assert_cmpint (g_array_index (points, UpHistoryPoint, 1).time, ==, since);
+	g_assert_cmpint (g_array_index (points, UpHistoryPoint, 1).state, ==, UP_DEVICE_STATE_CHARGING);
+	g_array_unref (points);
+	up_history_set_time (0);
+
+	/* the memory used is counted */
+	g_assert_cmpint (up_history_get_memory_usage (history), >, 0);
+
+	/* add some more, which only gets appended */
+	up_history_set_state (history, UP_DEVICE_STATE_DISCHARGING);
+	up_history_set_charge_data (history, 43.0f);
+	g_object_unref (history);
+
+	/* check we can still read everything */
+	history = up_history_new ();
+	up_history_set_directory (history, "/tmp");
+	ret = up_history_set_id (history, "test");
+	g_assert (ret);
+	up_history_wait_loaded (history);
+	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
+	g_assert (array != NULL);
+	found = 0;
+	for (i=0; i<array->len; i++) {
+		item = (UpHistoryItem *) g_ptr_array_index (array, i);
+		if (up_history_item_get_value (item) > 39.0f)
+			found++;
+	}
+	g_assert_cmpint (found, ==, 4);
+	g_ptr_array_unref (array);
+
 	/* unref */
 	g_object_unref (history);
+	up_history_sync ();
+	up_test_history_remove_files ("/tmp");
+	g_free (filename);
+	g_free (journal);
+	g_free (data);
+}
+
+static void
+up_test_history_store_func (void)
+{
+	up_history_test (NULL);
 }
 
 static void
@@ -136,6 +363,95 @@ up_test_polkit_func (void)
 	g_object_unref (polkit);
 }
 
+typedef struct {
+	UpPoll		*poll;
+	guint		 id_self;
+	guint		 id_other;
+	guint		 calls;
+	gboolean	 ret;
+} UpTestPollData;
+
+static gboolean
+up_test_poll_cb (UpTestPollData *data)
+{
+	data->calls++;
+	if (data->id_self != 0)
+		up_poll_remove (data->poll, data->id_self);
+	if (data->id_other != 0)
+		up_poll_remove (data->poll, data->id_other);
+	return data->ret;
+}
+
+static void
+up_test_poll_func (void)
+{
+	UpPoll *poll;
+	UpTestPollData data[4];
+	gint64 wake;
+	guint id1;
+	guint id2;
+	guint i;
+
+	/* the wakeup moves back onto a slot only while the poll is due */
+	g_assert_cmpint (up_poll_get_wake_time (100, 7), ==, 105);
+	g_assert_cmpint (up_poll_get_wake_time (103, 1), ==, 104);
+	g_assert_cmpint (up_poll_get_wake_time (96, 12), ==, 105);
+	g_assert_cmpint (up_poll_get_wake_time (100, 0), ==, 100);
+
+	/* a late poll keeps its phase, unless it missed a whole interval */
+	g_assert_cmpint (up_poll_get_next_deadline (100, 30, 100), ==, 130);
+	g_assert_cmpint (up_poll_get_next_deadline (100, 30, 115), ==, 130);
+	g_assert_cmpint (up_poll_get_next_deadline (100, 30, 170), ==, 200);
+
+	poll = up_poll_new ();
+	g_assert (poll != NULL);
+	g_assert_cmpint (up_poll_get_next_wake (poll), ==, -1);
+	memset (data, 0, sizeof (data));
+	for (i=0; i<G_N_ELEMENTS (data); i++) {
+		data[i].poll = poll;
+		data[i].ret = TRUE;
+	}
+
+	/* both windows close at the same time, so they share a wakeup */
+	id1 = up_poll_add (poll, 30, 20, (GSourceFunc) up_test_poll_cb, &data[0], "test1");
+	g_assert_cmpint (id1, !=, 0);
+	id2 = up_poll_add (poll, 40, 10, (GSourceFunc) up_test_poll_cb, &data[1], "test2");
+	g_assert_cmpint (id2, !=, id1);
+	g_assert_cmpint (up_poll_get_size (poll), ==, 2);
+	wake = up_poll_get_next_wake (poll);
+	g_assert_cmpint (wake % UP_POLL_SLOT, ==, 0);
+	up_poll_dispatch (poll, wake);
+	g_assert_cmpint (data[0].calls, ==, 1);
+	g_assert_cmpint (data[1].calls, ==, 1);
+	g_assert_cmpint (up_poll_get_next_wake (poll), >, wake);
+
+	/* remove one, twice */
+	g_assert (up_poll_remove (poll, id1));
+	g_assert (!up_poll_remove (poll, id1));
+	g_assert_cmpint (up_poll_get_size (poll), ==, 1);
+	g_assert (up_poll_remove (poll, id2));
+
+	/* polls can remove others and themselves while being run */
+	for (i=0; i<G_N_ELEMENTS (data); i++)
+		data[i].calls = 0;
+	id1 = up_poll_add (poll, 10, 0, (GSourceFunc) up_test_poll_cb, &data[0], "test1");
+	id2 = up_poll_add (poll, 10, 0, (GSourceFunc) up_test_poll_cb, &data[1], "test2");
+	data[0].id_other = id2;
+	data[2].id_self = up_poll_add (poll, 10, 0, (GSourceFunc) up_test_poll_cb, &data[2], "test3");
+	data[3].ret = FALSE;
+	up_poll_add (poll, 10, 0, (GSourceFunc) up_test_poll_cb, &data[3], "test4");
+	up_poll_dispatch (poll, up_poll_get_next_wake (poll) + 1000);
+	g_assert_cmpint (data[0].calls, ==, 1);
+	g_assert_cmpint (data[1].calls, ==, 0);
+	g_assert_cmpint (data[2].calls, ==, 1);
+	g_assert_cmpint (data[3].calls, ==, 1);
+	g_assert_cmpint (up_poll_get_size (poll), ==, 1);
+	g_assert (up_poll_remove (poll, id1));
+
+	/* unref */
+	g_object_unref (poll);
+}
+
 static void
 up_test_qos_func (void)
 {
@@ -148,6 +464,120 @@ up_test_qos_func (void)
 	g_object_unref (qos);
 }
 
+#ifdef BACKEND_TYPE_LINUX
+static void
+up_test_sysfs_func (void)
+{
+	guint i;
+	gboolean ret;
+	double value_double;
+	int value_int;
+	guint64 value_uint64;
+	const struct {
+		const char	*text;
+		gboolean	 ret;
+		double		 value;
+	} doubles[] = {
+		{ "12.5\n",			TRUE,	12.5f },
+		{ "-3",				TRUE,	-3.0f },
+		{ "0\n",			TRUE,	0.0f },
+		{ "",				FALSE,	0.0f },
+		{ "\n",				FALSE,	0.0f },
+		{ "abc",			FALSE,	0.0f },
+		{ "12abc\n",			FALSE,	0.0f },
+		{ "1 2",			FALSE,	0.0f } };
+	const struct {
+		const char	*text;
+		gboolean	 ret;
+		int		 value;
+	} ints[] = {
+		{ "42\n",			TRUE,	42 },
+		{ "-7",				TRUE,	-7 },
+		{ "2147483647\n",		TRUE,	G_MAXINT },
+		{ "2147483648",			FALSE,	0 },
+		{ "-2147483649",		FALSE,	0 },
+		{ "9223372036854775808",	FALSE,	0 },
+		{ "",				FALSE,	0 },
+		{ "x1",				FALSE,	0 },
+		{ "1x\n",			FALSE,	0 } };
+	const struct {
+		const char	*text;
+		guint		 base;
+		gboolean	 ret;
+		guint64		 value;
+	} uint64s[] = {
+		{ "18446744073709551615\n",	10,	TRUE,	G_MAXUINT64 },
+		{ "ff\n",			16,	TRUE,	255 },
+		{ "18446744073709551616",	10,	FALSE,	0 },
+		{ "-1",				10,	FALSE,	0 },
+		{ " -1\n",			10,	FALSE,	0 },
+		{ "",				10,	FALSE,	0 },
+		{ "12g",			16,	FALSE,	0 } };
+
+	/* a value that does not parse is left alone */
+	for (i=0; i<G_N_ELEMENTS (doubles); i++) {
+		value_double = -1.0f;
+		ret = sysfs_parse_double (doubles[i].text, &value_double);
+		g_assert_cmpint (ret, ==, doubles[i].ret);
+		g_assert_cmpfloat (value_double, ==, ret ? doubles[i].value : -1.0f);
+	}
+	for (i=0; i<G_N_ELEMENTS (ints); i++) {
+		value_int = -1;
+		ret = sysfs_parse_int (ints[i].text, &value_int);
+		g_assert_cmpint (ret, ==, ints[i].ret);
+		g_assert_cmpint (value_int, ==, ret ? ints[i].value : -1);
+	}
+	for (i=0; i<G_N_ELEMENTS (uint64s); i++) {
+		value_uint64 = 1;
+		ret = sysfs_parse_uint64 (uint64s[i].text, uint64s[i].base, &value_uint64);
+		g_assert_cmpint (ret, ==, uint64s[i].ret);
+		g_assert_cmpuint (value_uint64, ==, ret ? uint64s[i].value : 1);
+	}
+}
+
+static void
+up_test_supply_snapshot_func (void)
+{
+	UpDeviceSupplySnapshot snapshot;
+
+	memset (&snapshot, 0, sizeof (snapshot));
+	g_strlcpy (snapshot.buffer,
+		   "POWER_SUPPLY_NAME=BAT0\n"
+		   "POWER_SUPPLY_ONLINE=2\n"
+		   "POWER_SUPPLY_PRESENT=1\n"
+		   "POWER_SUPPLY_STATUS=Discharging\n"
+		   "POWER_SUPPLY_CYCLE_COUNT=12\n"
+		   "POWER_SUPPLY_ENERGY_NOW=unknown\n"
+		   "POWER_SUPPLY_ENERGY_FULL=50000000\n"
+		   "POWER_SUPPLY_VOLTAGE_NOW=\n"
+		   "POWER_SUPPLY_MODEL_NAME= DELL 1C75X \n"
+		   "POWER_SUPPLY_TECHNOLOGY\n"
+		   "DEVTYPE=power_supply\n",
+		   sizeof (snapshot.buffer));
+	up_device_supply_snapshot_parse_uevent (&snapshot);
+
+	/* unknown keys and values that do not parse are left out */
+	g_assert_cmpint (snapshot.has, ==, (1 << UP_DEVICE_SUPPLY_FIELD_ONLINE) |
+					   (1 << UP_DEVICE_SUPPLY_FIELD_PRESENT) |
+					   (1 << UP_DEVICE_SUPPLY_FIELD_STATUS) |
+					   (1 << UP_DEVICE_SUPPLY_FIELD_ENERGY_FULL) |
+					   (1 << UP_DEVICE_SUPPLY_FIELD_MODEL_NAME));
+	g_assert (snapshot.online);
+	g_assert (snapshot.present);
+	g_assert_cmpstr (snapshot.status, ==, "Discharging");
+	g_assert_cmpstr (snapshot.model_name, ==, "DELL 1C75X");
+	g_assert_cmpfloat (snapshot.energy_now, ==, 0.0f);
+	g_assert_cmpfloat (snapshot.energy_full, ==, 50000000.0f);
+
+	/* offline is the only value that is not online */
+	memset (&snapshot, 0, sizeof (snapshot));
+	g_strlcpy (snapshot.buffer, "POWER_SUPPLY_ONLINE=0", sizeof (snapshot.buffer));
+	up_device_supply_snapshot_parse_uevent (&snapshot);
+	g_assert (UP_DEVICE_SUPPLY_SNAPSHOT_HAS (&snapshot, UP_DEVICE_SUPPLY_FIELD_ONLINE));
+	g_assert (!snapshot.online);
+}
+#endif
+
 static void
 up_test_wakeups_func (void)
 {
@@ -163,6 +593,8 @@ up_test_wakeups_func (void)
 int
 main (int argc, char **argv)
 {
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
 	g_type_init ();
 	g_test_init (&argc, &argv, NULL);
 
@@ -171,9 +603,15 @@ main (int argc, char **argv)
 	g_test_add_func ("/power/device", up_test_device_func);
 	g_test_add_func ("/power/device_list", up_test_device_list_func);
 	g_test_add_func ("/power/history", up_test_history_func);
+	g_test_add_func ("/power/history_store", up_test_history_store_func);
 	g_test_add_func ("/power/native", up_test_native_func);
 	g_test_add_func ("/power/polkit", up_test_polkit_func);
+	g_test_add_func ("/power/poll", up_test_poll_func);
 	g_test_add_func ("/power/qos", up_test_qos_func);
+#ifdef BACKEND_TYPE_LINUX
+	g_test_add_func ("/power/supply_snapshot", up_test_supply_snapshot_func);
+	g_test_add_func ("/power/sysfs", up_test_sysfs_func);
+#endif
 	g_test_add_func ("/power/wakeups", up_test_wakeups_func);
 	g_test_add_func ("/power/daemon", up_test_daemon_func);
 
@@ -0,0 +1,121 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Richard Hughes <richard@hughsie.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+
+#include "up-history.h"
+
+#include "egg-debug.h"
+
+/**
+ * main:
+ *
+ * Works on the history files of a device while the daemon is not running,
+ * so that they can be shrunk or converted when building an image or
+ * migrating a system rather than by the daemon on the first boot.
+ **/
+int
+main (int argc, char **argv)
+{
+	gint retval = EXIT_FAILURE;
+	GOptionContext *context;
+	gchar *opt_directory = NULL;
+	gchar *opt_id = NULL;
+	gboolean opt_compact = FALSE;
+	gboolean opt_to_text = FALSE;
+	gint opt_raw_age = UP_HISTORY_RAW_AGE_DEFAULT;
+	gint opt_minute_age = UP_HISTORY_MINUTE_AGE_DEFAULT;
+	gint opt_hour_age = UP_HISTORY_HOUR_AGE_DEFAULT;
+	gint opt_capacity_age = UP_HISTORY_CAPACITY_AGE_DEFAULT;
+	GError *error = NULL;
+	gchar *text;
+	UpHistory *history = NULL;
+
+	const GOptionEntry entries[] = {
+		{ "directory", 'd', 0, G_OPTION_ARG_STRING, &opt_directory, _("The directory the history is kept in"), NULL },
+		{ "id", 'i', 0, G_OPTION_ARG_STRING, &opt_id, _("The device id, as used in the history filenames"), NULL },
+		{ "compact", 'c', 0, G_OPTION_ARG_NONE, &opt_compact, _("Apply the retention and rewrite the files in the current format"), NULL },
+		{ "to-text", 't', 0, G_OPTION_ARG_NONE, &opt_to_text, _("Convert the history to the text format of older versions"), NULL },
+		{ "raw-retention", 0, 0, G_OPTION_ARG_INT, &opt_raw_age, _("Seconds to keep every sample for, or 0 for ever"), NULL },
+		{ "minute-retention", 0, 0, G_OPTION_ARG_INT, &opt_minute_age, _("Seconds to keep the samples of each minute for, or 0 for ever"), NULL },
+		{ "hour-retention", 0, 0, G_OPTION_ARG_INT, &opt_hour_age, _("Seconds to keep the samples of each hour for, or 0 for ever"), NULL },
+		{ "capacity-retention", 0, 0, G_OPTION_ARG_INT, &opt_capacity_age, _("Seconds to keep the capacity samples for, or 0 for ever"), NULL },
+		{ NULL }
+	};
+
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
+	g_type_init ();
+
+	context = g_option_context_new ("UPower history tool");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, egg_debug_get_option_group ());
+	g_option_context_parse (context, &argc, &argv, NULL);
+	g_option_context_free (context);
+
+	if (opt_id == NULL) {
+		g_print ("%s\n", _("A device id is required, for example --id=BAT0-..."));
+		goto out;
+	}
+	if (opt_compact && opt_to_text) {
+		g_print ("%s\n", _("Only one of --compact and --to-text can be used"));
+		goto out;
+	}
+
+	/* the retention is applied as the files are read */
+	history = up_history_new ();
+	if (opt_directory != NULL)
+		up_history_set_directory (history, opt_directory);
+	up_history_set_retention (history, opt_raw_age, opt_minute_age, opt_hour_age, opt_capacity_age);
+	if (!up_history_open (history, opt_id)) {
+		g_print (_("Failed to open the history for %s\n"), opt_id);
+		goto out;
+	}
+
+	if (opt_compact && !up_history_rewrite (history)) {
+		g_print (_("Failed to rewrite the history for %s\n"), opt_id);
+		goto out;
+	}
+
+	/* show what is left */
+	text = up_history_to_text (history);
+	g_print ("%s", text);
+	g_free (text);
+
+	if (opt_to_text && !up_history_export_text (history, &error)) {
+		g_print (_("Failed to convert the history: %s\n"), error->message);
+		g_error_free (error);
+		goto out;
+	}
+	retval = EXIT_SUCCESS;
+out:
+	if (history != NULL)
+		g_object_unref (history);
+	up_history_sync ();
+	g_free (opt_directory);
+	g_free (opt_id);
+	return retval;
+}